@@ -0,0 +1,204 @@
+// Measures decode_image_frames() throughput over video clips.
+// Prints one json line per clip and decoder configuration. By default only file
+// read options are swept, --full-sweep also sweeps output image options.
+// Every configuration runs in a child process, so peak_rss is its own.
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <json.hpp>
+
+#include "avutils.h"
+#include "logging_impl.h"
+#include "stopwatch.h"
+#include "video_streams.h"
+
+using namespace satori::video;
+
+namespace po = boost::program_options;
+
+namespace {
+
+struct decoder_config {
+  std::string resolution;
+  image_pixel_format pixel_format;
+  bool keep_aspect_ratio;
+  bool low_latency;
+  file_read_options read_options;
+};
+
+std::string to_string(image_pixel_format pixel_format) {
+  switch (pixel_format) {
+    case image_pixel_format::RGB0:
+      return "RGB0";
+    case image_pixel_format::BGR:
+      return "BGR";
+  }
+  ABORT() << "unsupported pixel format";
+  return "";
+}
+
+double cpu_time_millis() {
+  return 1000.0 * std::clock() / CLOCKS_PER_SEC;
+}
+
+// in kilobytes on Linux, in bytes on macOS
+long peak_rss() {
+  struct rusage usage;
+  CHECK_EQ(0, getrusage(RUSAGE_SELF, &usage));
+  return usage.ru_maxrss;
+}
+
+nlohmann::json run(const std::string &clip, const decoder_config &cfg, int iterations) {
+  const image_size size =
+      cfg.resolution == "original"
+          ? image_size{avutils::original_image_width, avutils::original_image_height}
+          : avutils::parse_image_size(cfg.resolution).get();
+
+  int frames{0};
+  const double cpu_start = cpu_time_millis();
+  stopwatch<> s;
+  for (int i = 0; i < iterations; i++) {
+    boost::asio::io_service io;
+    auto when_done = (file_source(io, clip, false, true, file_range{}, cfg.read_options)
+                      >> decode_image_frames(size, cfg.pixel_format,
+                                             cfg.keep_aspect_ratio, cfg.low_latency))
+                         ->process([&frames](owned_image_packet &&packet) {
+                           if (boost::get<owned_image_frame>(&packet) != nullptr) {
+                             frames++;
+                           }
+                         });
+    CHECK(when_done.ok()) << "failed to decode " << clip;
+  }
+  const double wall_millis = std::max<double>(1, s.millis());
+  const double cpu_millis = cpu_time_millis() - cpu_start;
+
+  nlohmann::json result = nlohmann::json::object();
+  result["clip"] = clip;
+  result["resolution"] = cfg.resolution;
+  result["pixel_format"] = to_string(cfg.pixel_format);
+  result["keep_aspect_ratio"] = cfg.keep_aspect_ratio;
+  result["low_latency"] = cfg.low_latency;
+  result["prefetch_packets"] = cfg.read_options.prefetch_packets;
+  result["io_buffer_size"] = cfg.read_options.io_buffer_size;
+  result["mmap"] = cfg.read_options.mmap;
+  result["frames"] = frames;
+  result["fps"] = 1000.0 * frames / wall_millis;
+  result["cpu_millis_per_frame"] = cpu_millis / std::max(1, frames);
+  result["peak_rss"] = peak_rss();
+  return result;
+}
+
+// ru_maxrss is a process-wide high water mark, a fresh process doesn't carry over
+// memory used by previous configurations.
+void run_in_child_process(const std::string &clip, const decoder_config &cfg,
+                          int iterations) {
+  std::cout.flush();
+  const pid_t pid = fork();
+  CHECK_NE(-1, pid) << "fork failed: " << strerror(errno);
+  if (pid == 0) {
+    std::cout << run(clip, cfg, iterations) << std::endl;
+    _exit(0);
+  }
+
+  int status{0};
+  CHECK_EQ(pid, waitpid(pid, &status, 0));
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+      << "benchmark of " << clip << " failed, status " << status;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  po::options_description options("Options");
+  options.add_options()("help", "produce help message");
+  options.add_options()(",v", po::value<std::string>(), "log verbosity level");
+  options.add_options()(
+      "clip",
+      po::value<std::vector<std::string>>()->multitoken()->default_value(
+          {"test_data/test.mp4", "test_data/test_rotated.mp4"},
+          "test_data/test.mp4 test_data/test_rotated.mp4"),
+      "video files to decode");
+  options.add_options()(
+      "resolution",
+      po::value<std::vector<std::string>>()->multitoken()->default_value(
+          {"original"}, "original, with --full-sweep original 320x240 1280x720"),
+      "(<width>x<height>|original) target image sizes");
+  options.add_options()(
+      "prefetch-packets",
+      po::value<std::vector<size_t>>()->multitoken()->default_value({0, 100}, "0 100"),
+      "packets read ahead of decoder, 0 reads synchronously");
+  options.add_options()(
+      "io-buffer-size",
+      po::value<std::vector<size_t>>()->multitoken()->default_value({0}, "0"),
+      "file read buffer sizes, 0 is FFmpeg default");
+  options.add_options()(
+      "mmap", po::value<std::vector<int>>()->multitoken()->default_value({0, 1}, "0 1"),
+      "1 reads files through memory mapping, 0 through FFmpeg file protocol");
+  options.add_options()("iterations", po::value<int>()->default_value(10),
+                        "number of times each clip is decoded");
+  options.add_options()("full-sweep",
+                        "also sweep resolutions, pixel formats, keeping aspect ratio "
+                        "and low latency decoding");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, options), vm);
+  po::notify(vm);
+  if (vm.count("help") > 0) {
+    std::cerr << options << std::endl;
+    return 1;
+  }
+
+  init_logging(argc, argv);
+
+  const int iterations = vm["iterations"].as<int>();
+  const bool full_sweep = vm.count("full-sweep") > 0;
+  std::vector<std::string> resolutions = vm["resolution"].as<std::vector<std::string>>();
+  if (full_sweep && vm["resolution"].defaulted()) {
+    resolutions = {"original", "320x240", "1280x720"};
+  }
+  std::vector<image_pixel_format> pixel_formats{image_pixel_format::RGB0};
+  std::vector<bool> keep_aspect_ratios{true};
+  std::vector<bool> low_latencies{false};
+  if (full_sweep) {
+    pixel_formats.push_back(image_pixel_format::BGR);
+    keep_aspect_ratios.push_back(false);
+    low_latencies.push_back(true);
+  }
+
+  for (const std::string &resolution : resolutions) {
+    CHECK(resolution == "original" || avutils::parse_image_size(resolution).ok())
+        << "bad resolution: " << resolution;
+  }
+
+  for (const std::string &clip : vm["clip"].as<std::vector<std::string>>()) {
+    for (const std::string &resolution : resolutions) {
+      for (image_pixel_format pixel_format : pixel_formats) {
+        for (bool keep_aspect_ratio : keep_aspect_ratios) {
+          for (bool low_latency : low_latencies) {
+            for (size_t prefetch_packets :
+                 vm["prefetch-packets"].as<std::vector<size_t>>()) {
+              for (size_t io_buffer_size :
+                   vm["io-buffer-size"].as<std::vector<size_t>>()) {
+                for (int mmap : vm["mmap"].as<std::vector<int>>()) {
+                  file_read_options read_options;
+                  read_options.prefetch_packets = prefetch_packets;
+                  read_options.io_buffer_size = io_buffer_size;
+                  read_options.mmap = mmap != 0;
+                  const decoder_config cfg{resolution, pixel_format, keep_aspect_ratio,
+                                           low_latency, read_options};
+                  run_in_child_process(clip, cfg, iterations);
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,102 @@
+// Measures encode_as_mjpeg() throughput for different numbers of encoder threads.
+// Prints one json line per configuration.
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <json.hpp>
+#include <thread>
+
+#include "avutils.h"
+#include "logging_impl.h"
+#include "stopwatch.h"
+#include "video_streams.h"
+
+using namespace satori::video;
+
+namespace po = boost::program_options;
+
+namespace {
+
+streams::publisher<owned_image_packet> synthetic_frames(int count, uint16_t width,
+                                                        uint16_t height) {
+  return streams::publishers::range(0, count) >> streams::map([width, height](int i) {
+           owned_image_frame f;
+           f.id = {i, i};
+           f.pixel_format = image_pixel_format::BGR;
+           f.width = width;
+           f.height = height;
+           f.timestamp =
+               std::chrono::system_clock::time_point{std::chrono::milliseconds(40 * i)};
+           f.plane_data[0].resize(width * height * 3);
+           for (size_t p = 0; p < f.plane_data[0].size(); p++) {
+             f.plane_data[0][p] = static_cast<char>((p + i) % 251);
+           }
+           f.plane_strides[0] = width * 3;
+           for (int p = 1; p < max_image_planes; p++) {
+             f.plane_strides[p] = 0;
+           }
+           return owned_image_packet{f};
+         });
+}
+
+double run(int frames, const image_size &size, size_t threads) {
+  stopwatch<std::chrono::steady_clock> s;
+  int encoded{0};
+  auto when_done = (synthetic_frames(frames, size.width, size.height)
+                    >> encode_as_mjpeg(threads))
+                       ->process([&encoded](encoded_packet &&packet) {
+                         if (boost::get<encoded_frame>(&packet) != nullptr) {
+                           encoded++;
+                         }
+                       });
+  CHECK(when_done.ok());
+  CHECK_EQ(encoded, frames);
+
+  return 1000.0 * frames / std::max<uint64_t>(1, s.millis());
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  po::options_description options("Options");
+  options.add_options()("help", "produce help message");
+  options.add_options()(",v", po::value<std::string>(), "log verbosity level");
+  options.add_options()("frames", po::value<int>()->default_value(500),
+                        "number of frames to encode");
+  options.add_options()("resolution", po::value<std::string>()->default_value("1280x720"),
+                        "(<width>x<height>) image size");
+  options.add_options()("max-threads", po::value<size_t>()->default_value(
+                                           std::thread::hardware_concurrency()),
+                        "maximum number of encoder threads");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, options), vm);
+  po::notify(vm);
+  if (vm.count("help") > 0) {
+    std::cerr << options << std::endl;
+    return 1;
+  }
+
+  init_logging(argc, argv);
+
+  const int frames = vm["frames"].as<int>();
+  const auto size = avutils::parse_image_size(vm["resolution"].as<std::string>());
+  CHECK(size.ok());
+
+  double single_thread_fps{0};
+  for (size_t threads = 1; threads <= vm["max-threads"].as<size_t>(); threads *= 2) {
+    const double fps = run(frames, size.get(), threads);
+    if (threads == 1) {
+      single_thread_fps = fps;
+    }
+
+    nlohmann::json result = nlohmann::json::object();
+    result["threads"] = threads;
+    result["frames"] = frames;
+    result["resolution"] = vm["resolution"].as<std::string>();
+    result["fps"] = fps;
+    result["speedup"] = fps / single_thread_fps;
+    std::cout << result << std::endl;
+  }
+
+  return 0;
+}
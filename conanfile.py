@@ -17,7 +17,8 @@ class SatorivideoConan(ConanFile):
                "Loguru/1.5.0-40@satorivideo/master", \
                "Openssl/1.1.0g-40@satorivideo/master", \
                "PrometheusCpp/2018.04.23-40@satorivideo/master", \
-               "SDL/2.0.5-40@satorivideo/master"
+               "SDL/2.0.5-40@satorivideo/master", \
+               "Zlib/1.2.11-40@satorivideo/master"
 
     license = "proprietary"
     version = '0.15.57'
@@ -35,7 +36,9 @@ class SatorivideoConan(ConanFile):
                       "SDL:shared=False", \
                       "SDL:fPIC=True", \
                       "PrometheusCpp:shared=False", \
-                      "PrometheusCpp:fPIC=True"
+                      "PrometheusCpp:fPIC=True", \
+                      "Zlib:shared=False", \
+                      "Zlib:fPIC=True"
 
     generators = "cmake"
     exports_sources = "*", ".clang-tidy", ".clang-format", \
@@ -24,6 +24,10 @@ struct multiframe_bot_descriptor {
   // Invoked on every received control command, guaranteed to be invoked during
   // initialization
   bot_ctrl_callback_t ctrl_callback;
+
+  // Set to SEGMENT if bot state doesn't need frames preceding a key frame,
+  // to FRAME if bot keeps no state between frame batches
+  state_scope state{state_scope::STREAM};
 };
 
 // Registers opencv bot.
@@ -11,6 +11,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <json.hpp>
@@ -58,6 +59,23 @@ EXPORT struct image_metadata {
 // without drops to catch with live stream
 EXPORT enum class execution_mode { LIVE = 1, BATCH = 2 };
 
+// How long bot state lives. Batch mode may split a file into segments processed
+// in parallel by separate bot instances (see --batch-shards), which is correct
+// only for bots that are stateless or keep state only within a segment.
+// FRAME bots keep no state between frame batches, so batches may be processed
+// concurrently by several bot instances (see --bot-threads).
+EXPORT enum class state_scope { STREAM = 1, SEGMENT = 2, FRAME = 3 };
+
+// How live frames are grouped into batches for multiframe bots (see
+// --target-batch-size). Batch is delivered when it has target_size frames or when
+// its first frame has waited max_wait. In live mode, frames queued for longer than
+// max_staleness are dropped. Zero values disable the corresponding limit.
+EXPORT struct batching_policy {
+  size_t target_size{0};
+  std::chrono::milliseconds max_wait{0};
+  std::chrono::milliseconds max_staleness{0};
+};
+
 EXPORT struct bot_metrics {
   prometheus::Registry &registry;
   prometheus::Counter &frames_processed_total;
@@ -73,6 +91,8 @@ EXPORT struct bot_context {
   const image_metadata *frame_metadata;
   const execution_mode mode;
   bot_metrics metrics;
+  // batching policy of the job
+  const batching_policy *batching;
 };
 
 // API for image handler callback
@@ -98,6 +118,10 @@ struct bot_descriptor {
   // Invoked on every received control command, guaranteed to be invoked during
   // initialization
   bot_ctrl_callback_t ctrl_callback;
+
+  // Set to SEGMENT if bot state doesn't need frames preceding a key frame,
+  // to FRAME if bot keeps no state between frame batches
+  state_scope state{state_scope::STREAM};
 };
 
 // Used by bot implementation to specify type of output.
@@ -1,12 +1,20 @@
 #include "avutils.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
+#include <cstring>
 #include <sstream>
 #include <stdexcept>
 
 extern "C" {
 #include <libavdevice/avdevice.h>
 #include <libavfilter/avfilter.h>
+#include <libavformat/avio.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/parseutils.h>
 #include <libavutil/pixdesc.h>
@@ -28,6 +36,143 @@ std::string to_av_codec_name(const std::string &codec_name) {
   return codec_name;
 }
 
+// Reads bits of VP9 uncompressed header, most significant bit first.
+class bit_reader {
+ public:
+  explicit bit_reader(const std::string &data) : _data{data} {}
+
+  bool read(int bits, uint32_t &value) {
+    value = 0;
+    for (int i = 0; i < bits; i++, _position++) {
+      if (_position / 8 >= _data.size()) {
+        return false;
+      }
+      const uint8_t byte = static_cast<uint8_t>(_data[_position / 8]);
+      value = (value << 1) | ((byte >> (7 - _position % 8)) & 1);
+    }
+    return true;
+  }
+
+ private:
+  const std::string &_data;
+  size_t _position{0};
+};
+
+// VP9 bitstream specification, 6.2 Uncompressed header syntax
+// https://www.webmproject.org/vp9/
+boost::optional<image_size> vp9_key_frame_size(const std::string &data) {
+  bit_reader r{data};
+  uint32_t frame_marker, profile_low, profile_high, reserved, show_existing_frame,
+      frame_type, show_frame, error_resilient_mode;
+  if (!r.read(2, frame_marker) || frame_marker != 2 || !r.read(1, profile_low)
+      || !r.read(1, profile_high)) {
+    return {};
+  }
+  const uint32_t profile = (profile_high << 1) + profile_low;
+  if (profile == 3 && !r.read(1, reserved)) {
+    return {};
+  }
+  if (!r.read(1, show_existing_frame) || show_existing_frame != 0
+      || !r.read(1, frame_type) || frame_type != 0 /* KEY_FRAME */
+      || !r.read(1, show_frame) || !r.read(1, error_resilient_mode)) {
+    return {};
+  }
+
+  uint32_t sync_code;
+  if (!r.read(24, sync_code) || sync_code != 0x498342) {
+    return {};
+  }
+
+  uint32_t bit_depth_flag, color_space, color_range, subsampling_x, subsampling_y;
+  if (profile >= 2 && !r.read(1, bit_depth_flag)) {
+    return {};
+  }
+  if (!r.read(3, color_space)) {
+    return {};
+  }
+  if (color_space != 7 /* CS_RGB */) {
+    if (!r.read(1, color_range)) {
+      return {};
+    }
+    if ((profile == 1 || profile == 3)
+        && (!r.read(1, subsampling_x) || !r.read(1, subsampling_y)
+            || !r.read(1, reserved))) {
+      return {};
+    }
+  } else if ((profile == 1 || profile == 3) && !r.read(1, reserved)) {
+    return {};
+  }
+
+  uint32_t width_minus_1, height_minus_1;
+  if (!r.read(16, width_minus_1) || !r.read(16, height_minus_1)) {
+    return {};
+  }
+  return image_size{static_cast<int16_t>(width_minus_1 + 1),
+                    static_cast<int16_t>(height_minus_1 + 1)};
+}
+
+// https://tools.ietf.org/html/rfc6386#section-9.1
+boost::optional<image_size> vp8_key_frame_size(const std::string &data) {
+  if (data.size() < 10) {
+    return {};
+  }
+  const auto *bytes = reinterpret_cast<const uint8_t *>(data.data());
+  const bool key_frame = (bytes[0] & 1) == 0;
+  if (!key_frame || bytes[3] != 0x9d || bytes[4] != 0x01 || bytes[5] != 0x2a) {
+    return {};
+  }
+  const int width = (bytes[6] | (bytes[7] << 8)) & 0x3fff;
+  const int height = (bytes[8] | (bytes[9] << 8)) & 0x3fff;
+  return image_size{static_cast<int16_t>(width), static_cast<int16_t>(height)};
+}
+
+// Runs FFmpeg's parser which reads sequence headers (e.g. H.264 SPS)
+// from codec data and the frame.
+boost::optional<image_size> parsed_frame_size(AVCodecID codec_id,
+                                              const std::string &codec_data,
+                                              const std::string &data) {
+  const AVCodec *decoder = avcodec_find_decoder(codec_id);
+  if (decoder == nullptr) {
+    return {};
+  }
+  std::shared_ptr<AVCodecParserContext> parser(av_parser_init(codec_id),
+                                               [](AVCodecParserContext *p) {
+                                                 if (p != nullptr) {
+                                                   av_parser_close(p);
+                                                 }
+                                               });
+  std::shared_ptr<AVCodecContext> context = decoder_context(decoder);
+  if (!parser || !context) {
+    return {};
+  }
+  parser->flags |= PARSER_FLAG_COMPLETE_FRAMES;
+
+  if (!codec_data.empty()) {
+    context->extradata = reinterpret_cast<uint8_t *>(
+        av_mallocz(codec_data.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+    if (context->extradata == nullptr) {
+      return {};
+    }
+    memcpy(context->extradata, codec_data.data(), codec_data.size());
+    context->extradata_size = static_cast<int>(codec_data.size());
+  }
+
+  // parser may read past the end of input
+  std::string padded_data{data};
+  padded_data.resize(data.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+
+  uint8_t *out_data{nullptr};
+  int out_size{0};
+  av_parser_parse2(parser.get(), context.get(), &out_data, &out_size,
+                   reinterpret_cast<const uint8_t *>(padded_data.data()),
+                   static_cast<int>(data.size()), AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+  if (parser->width <= 0 || parser->height <= 0) {
+    return {};
+  }
+  return image_size{static_cast<int16_t>(parser->width),
+                    static_cast<int16_t>(parser->height)};
+}
+
 void dump_iformats() {
   AVInputFormat *f{nullptr};
   while (true) {
@@ -211,7 +356,8 @@ std::shared_ptr<AVCodecContext> encoder_context(const AVCodecID codec_id) {
 }
 
 std::shared_ptr<AVCodecContext> decoder_context(const std::string &codec_name,
-                                                gsl::cstring_span<> extra_data) {
+                                                gsl::cstring_span<> extra_data,
+                                                bool low_delay) {
   std::string av_codec_name = to_av_codec_name(codec_name);
   LOG(1) << "searching for decoder '" << av_codec_name << "'";
   const AVCodec *decoder = avcodec_find_decoder_by_name(av_codec_name.c_str());
@@ -241,7 +387,14 @@ std::shared_ptr<AVCodecContext> decoder_context(const std::string &codec_name,
   }
 
   context->thread_count = 4;
-  context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  if (low_delay) {
+    // frame threading delays output by thread_count - 1 frames
+    context->thread_type = FF_THREAD_SLICE;
+    context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    context->has_b_frames = 0;
+  } else {
+    context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  }
 
   err = avcodec_open2(context.get(), decoder, nullptr);
   if (err < 0) {
@@ -365,6 +518,22 @@ void sws_scale(const std::shared_ptr<SwsContext> &sws_context,
             dst_frame->data, dst_frame->linesize);
 }
 
+void sws_scale(const std::shared_ptr<SwsContext> &sws_context,
+               const owned_image_frame &src_image,
+               const std::shared_ptr<AVFrame> &dst_frame) {
+  const uint8_t *src_data[max_image_planes];
+  int src_linesize[max_image_planes];
+  for (int i = 0; i < max_image_planes; i++) {
+    src_data[i] = src_image.plane_strides[i] > 0
+                      ? reinterpret_cast<const uint8_t *>(src_image.plane_data[i].data())
+                      : nullptr;
+    src_linesize[i] = static_cast<int>(src_image.plane_strides[i]);
+  }
+
+  ::sws_scale(sws_context.get(), src_data, src_linesize, 0, src_image.height,
+              dst_frame->data, dst_frame->linesize);
+}
+
 std::shared_ptr<AVFormatContext> output_format_context(
     const std::string &format, const std::string &filename,
     const std::function<void(AVFormatContext *)> &file_cleaner) {
@@ -420,6 +589,176 @@ std::shared_ptr<AVFormatContext> open_input_format_context(const std::string &ur
   });
 }
 
+namespace {
+
+int read_file(void *opaque, uint8_t *buffer, int size) {
+  const int fd = *static_cast<int *>(opaque);
+  const ssize_t n = ::read(fd, buffer, static_cast<size_t>(size));
+  if (n < 0) {
+    return AVERROR(errno);
+  }
+  return n == 0 ? AVERROR_EOF : static_cast<int>(n);
+}
+
+int64_t seek_file(void *opaque, int64_t offset, int whence) {
+  const int fd = *static_cast<int *>(opaque);
+  if (whence == AVSEEK_SIZE) {
+    struct stat st;
+    return fstat(fd, &st) == 0 ? st.st_size : AVERROR(errno);
+  }
+  const off_t position = lseek(fd, offset, whence & ~AVSEEK_FORCE);
+  return position < 0 ? AVERROR(errno) : position;
+}
+
+struct mapped_file {
+  const uint8_t *data;
+  size_t size;
+  size_t position;
+};
+
+int read_mapped_file(void *opaque, uint8_t *buffer, int size) {
+  auto *file = static_cast<mapped_file *>(opaque);
+  if (file->position >= file->size) {
+    return AVERROR_EOF;
+  }
+  const size_t n = std::min(static_cast<size_t>(size), file->size - file->position);
+  std::memcpy(buffer, file->data + file->position, n);
+  file->position += n;
+  return static_cast<int>(n);
+}
+
+int64_t seek_mapped_file(void *opaque, int64_t offset, int whence) {
+  auto *file = static_cast<mapped_file *>(opaque);
+  int64_t position;
+  switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+      return static_cast<int64_t>(file->size);
+    case SEEK_SET:
+      position = offset;
+      break;
+    case SEEK_CUR:
+      position = static_cast<int64_t>(file->position) + offset;
+      break;
+    case SEEK_END:
+      position = static_cast<int64_t>(file->size) + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (position < 0) {
+    return AVERROR(EINVAL);
+  }
+  file->position = static_cast<size_t>(position);
+  return position;
+}
+
+// Opens format context reading through custom io callbacks,
+// release is called when opaque is not needed anymore.
+std::shared_ptr<AVFormatContext> open_custom_io_context(
+    const std::string &filename, size_t io_buffer_size, void *opaque,
+    int (*read)(void *, uint8_t *, int), int64_t (*seek)(void *, int64_t, int),
+    const std::function<void()> &release) {
+  CHECK_GT(io_buffer_size, 0);
+
+  // custom io context isn't freed by avformat_close_input()
+  auto free_io = [release](AVIOContext *io_context) {
+    if (io_context != nullptr) {
+      av_freep(&io_context->buffer);
+      avio_context_free(&io_context);
+    }
+    release();
+  };
+
+  auto *buffer = static_cast<uint8_t *>(av_malloc(io_buffer_size));
+  AVIOContext *io_context =
+      buffer == nullptr ? nullptr
+                        : avio_alloc_context(buffer, static_cast<int>(io_buffer_size), 0,
+                                             opaque, read, nullptr, seek);
+  if (io_context == nullptr) {
+    LOG(ERROR) << "failed to allocate io context for " << filename;
+    av_free(buffer);
+    free_io(nullptr);
+    return nullptr;
+  }
+
+  AVFormatContext *format_context = avformat_alloc_context();
+  if (format_context == nullptr) {
+    LOG(ERROR) << "failed to allocate format context";
+    free_io(io_context);
+    return nullptr;
+  }
+
+  format_context->pb = io_context;
+  LOG(1) << "opening file " << filename << " with " << io_buffer_size
+         << " bytes io buffer";
+  int ret = avformat_open_input(&format_context, filename.c_str(), nullptr, nullptr);
+  if (ret < 0) {
+    // format_context is freed on open error.
+    LOG(ERROR) << "failed to open " << filename << ": " << error_msg(ret);
+    free_io(io_context);
+    return nullptr;
+  }
+  LOG(1) << "opened file " << filename;
+
+  return std::shared_ptr<AVFormatContext>(
+      format_context, [filename, io_context, free_io](AVFormatContext *ctx) {
+        LOG(INFO) << "closing file " << filename;
+        avformat_close_input(&ctx);
+        free_io(io_context);
+        LOG(INFO) << "format context is destroyed for " << filename;
+      });
+}
+
+}  // namespace
+
+std::shared_ptr<AVFormatContext> open_input_file_context(const std::string &filename,
+                                                         size_t io_buffer_size) {
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "failed to open " << filename << ": " << std::strerror(errno);
+    return nullptr;
+  }
+
+  int *opaque = new int{fd};
+  return open_custom_io_context(filename, io_buffer_size, opaque, &read_file, &seek_file,
+                                [opaque]() {
+                                  ::close(*opaque);
+                                  delete opaque;
+                                });
+}
+
+std::shared_ptr<AVFormatContext> open_input_mapped_file_context(
+    const std::string &filename, size_t io_buffer_size) {
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "failed to open " << filename << ": " << std::strerror(errno);
+    return nullptr;
+  }
+  auto close_fd = gsl::finally([fd]() { ::close(fd); });
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    LOG(ERROR) << "failed to map " << filename << ": empty or not a regular file";
+    return nullptr;
+  }
+  const auto size = static_cast<size_t>(st.st_size);
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "failed to map " << filename << ": " << std::strerror(errno);
+    return nullptr;
+  }
+  if (madvise(data, size, MADV_SEQUENTIAL) != 0) {
+    LOG(WARNING) << "madvise failed for " << filename << ": " << std::strerror(errno);
+  }
+
+  auto *opaque = new mapped_file{static_cast<const uint8_t *>(data), size, 0};
+  return open_custom_io_context(filename, io_buffer_size, opaque, &read_mapped_file,
+                                &seek_mapped_file, [opaque, data, size]() {
+                                  munmap(data, size);
+                                  delete opaque;
+                                });
+}
+
 void copy_image_to_av_frame(const owned_image_frame &image,
                             const std::shared_ptr<AVFrame> &frame) {
   CHECK_EQ(image.width, frame->width) << "Image and frame widhts don't match";
@@ -500,6 +839,23 @@ int find_best_video_stream(AVFormatContext *context, AVCodec **decoder_out) {
   return ret;
 }
 
+streams::error_or<image_size> probe_image_size(const encoded_metadata &metadata,
+                                               const encoded_frame &frame) {
+  boost::optional<image_size> size;
+  if (metadata.codec_name == "vp9") {
+    size = vp9_key_frame_size(frame.data);
+  } else if (metadata.codec_name == "vp8") {
+    size = vp8_key_frame_size(frame.data);
+  } else if (metadata.codec_name == "h264") {
+    size = parsed_frame_size(AV_CODEC_ID_H264, metadata.codec_data, frame.data);
+  }
+
+  if (!size) {
+    return std::system_category().default_error_condition(EBADMSG);
+  }
+  return *size;
+}
+
 AVCodecID codec_id(const std::string &codec_name) {
   if (codec_name == "vp8") {
     return AV_CODEC_ID_VP8;
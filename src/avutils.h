@@ -39,8 +39,11 @@ image_pixel_format to_image_pixel_format(AVPixelFormat pixel_format);
 std::shared_ptr<AVCodecContext> encoder_context(AVCodecID codec_id);
 
 // Creates FFmpeg's decoder context for decoder identified by name.
+// In low delay mode decoder outputs frames as soon as possible,
+// at the price of lower throughput and possible artifacts on reordered frames.
 std::shared_ptr<AVCodecContext> decoder_context(const std::string &codec_name,
-                                                gsl::cstring_span<> extra_data);
+                                                gsl::cstring_span<> extra_data,
+                                                bool low_delay = false);
 
 std::shared_ptr<AVCodecContext> decoder_context(const AVCodec *decoder);
 
@@ -69,6 +72,11 @@ void sws_scale(const std::shared_ptr<SwsContext> &sws_context,
                const std::shared_ptr<const AVFrame> &src_frame,
                const std::shared_ptr<AVFrame> &dst_frame);
 
+// Applies sws conversion directly to image planes and fills data of destination frame.
+void sws_scale(const std::shared_ptr<SwsContext> &sws_context,
+               const owned_image_frame &src_image,
+               const std::shared_ptr<AVFrame> &dst_frame);
+
 // Creates FFmpeg's format context to write data to files
 std::shared_ptr<AVFormatContext> output_format_context(
     const std::string &format, const std::string &filename,
@@ -77,6 +85,20 @@ std::shared_ptr<AVFormatContext> output_format_context(
 std::shared_ptr<AVFormatContext> open_input_format_context(
     const std::string &url, AVInputFormat *forced_format = nullptr,
     AVDictionary *options = nullptr);
+
+// FFmpeg's default AVIO buffer size
+constexpr size_t default_io_buffer_size = 32768;
+
+// Opens a local file through AVIOContext with io_buffer_size bytes buffer,
+// larger buffers mean fewer and bigger reads.
+std::shared_ptr<AVFormatContext> open_input_file_context(const std::string &filename,
+                                                         size_t io_buffer_size);
+
+// Same as open_input_file_context(), but the whole file is memory-mapped with
+// sequential access advice, so reads are copies from page cache without syscalls.
+std::shared_ptr<AVFormatContext> open_input_mapped_file_context(
+    const std::string &filename, size_t io_buffer_size);
+
 int find_best_video_stream(AVFormatContext *context, AVCodec **decoder_out);
 
 // Copies image frame data to AVFrame
@@ -96,6 +118,11 @@ std::shared_ptr<allocated_image> allocate_image(const image_size &size,
 
 streams::error_or<image_size> parse_image_size(const std::string &str);
 
+// Extracts image size from stream headers without decoding the frame.
+// Supports VP8 and VP9 key frames and H.264 frames (using SPS from codec data).
+streams::error_or<image_size> probe_image_size(const encoded_metadata &metadata,
+                                               const encoded_frame &frame);
+
 AVCodecID codec_id(const std::string &codec_name);
 
 }  // namespace avutils
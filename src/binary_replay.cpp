@@ -0,0 +1,459 @@
+#include "binary_replay.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <gsl/gsl>
+#include <memory>
+
+#include "logging.h"
+#include "streams/asio_streams.h"
+#include "video_error.h"
+#include "video_streams.h"
+
+namespace satori {
+namespace video {
+
+namespace {
+
+constexpr size_t magic_size = 8;
+constexpr char header_magic[] = "SVREPLAY";
+constexpr char index_magic[] = "SVRINDEX";
+constexpr uint32_t format_version = 1;
+
+constexpr size_t frame_header_size = 4 + 4 * 8 + 1;
+constexpr size_t index_entry_size = 8 + 8 + 1;
+constexpr size_t footer_size = 8 + 8 + magic_size;
+
+constexpr uint8_t key_frame_flag = 1;
+
+template <typename T>
+void put(std::string &out, T value) {
+  using unsigned_t = typename std::make_unsigned<T>::type;
+  const auto v = static_cast<unsigned_t>(value);
+  for (size_t i = 0; i < sizeof(T); i++) {
+    out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+  }
+}
+
+void put_string(std::string &out, const std::string &value) {
+  put<uint32_t>(out, value.size());
+  out.append(value);
+}
+
+template <typename T>
+T get(const uint8_t *data) {
+  using unsigned_t = typename std::make_unsigned<T>::type;
+  unsigned_t v{0};
+  for (size_t i = 0; i < sizeof(T); i++) {
+    v |= static_cast<unsigned_t>(data[i]) << (8 * i);
+  }
+  return static_cast<T>(v);
+}
+
+int64_t to_micros(std::chrono::system_clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch())
+      .count();
+}
+
+std::chrono::system_clock::time_point from_micros(int64_t micros) {
+  return std::chrono::system_clock::time_point{
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+          std::chrono::microseconds{micros})};
+}
+
+// Reads header fields, stops at the end of data.
+class header_reader {
+ public:
+  header_reader(const uint8_t *data, size_t size) : _data{data}, _size{size} {}
+
+  bool read_u32(uint32_t &value) {
+    if (_size - _position < sizeof(value)) {
+      return false;
+    }
+    value = get<uint32_t>(_data + _position);
+    _position += sizeof(value);
+    return true;
+  }
+
+  bool read_string(std::string &value) {
+    uint32_t size;
+    if (!read_u32(size) || _size - _position < size) {
+      return false;
+    }
+    value.assign(reinterpret_cast<const char *>(_data + _position), size);
+    _position += size;
+    return true;
+  }
+
+  size_t position() const { return _position; }
+
+ private:
+  const uint8_t *const _data;
+  const size_t _size;
+  size_t _position{magic_size};
+};
+
+class binary_replay_source_impl {
+ public:
+  binary_replay_source_impl(const std::string &filename, const file_range &range)
+      : _filename{filename}, _reader{filename}, _range{range} {}
+
+  void generate_one(streams::observer<encoded_packet> &observer) {
+    if (!_metadata_sent) {
+      if (auto err = _reader.open()) {
+        observer.on_error(err);
+        return;
+      }
+      if ((_range.start_frame && !_reader.seek_frame(*_range.start_frame))
+          || (_range.start_time && !_reader.seek(*_range.start_time))) {
+        LOG(WARNING) << _filename << " has no index, reading range from the beginning";
+      }
+      _metadata_sent = true;
+      observer.on_next(encoded_packet{_reader.metadata()});
+      return;
+    }
+
+    const uint64_t frame_number = _reader.frame_number();
+    encoded_frame frame;
+    if (!_reader.next(frame)) {
+      LOG(4) << "eof in " << _filename;
+      observer.on_complete();
+      return;
+    }
+
+    const auto offset = frame.creation_time - _reader.start_time();
+    if ((_range.end_frame && frame_number >= *_range.end_frame)
+        || (_range.end_time && offset >= *_range.end_time)) {
+      LOG(4) << "end of range in " << _filename;
+      observer.on_complete();
+      return;
+    }
+    frame.decode_only = (_range.start_frame && frame_number < *_range.start_frame)
+                        || (_range.start_time && offset < *_range.start_time);
+    observer.on_next(encoded_packet{std::move(frame)});
+  }
+
+ private:
+  const std::string _filename;
+  binary_replay_reader _reader;
+  const file_range _range;
+  bool _metadata_sent{false};
+};
+
+}  // namespace
+
+bool is_binary_replay(const std::string &filename) {
+  std::ifstream input(filename, std::ios::binary);
+  char magic[magic_size];
+  return input.read(magic, magic_size) && memcmp(magic, header_magic, magic_size) == 0;
+}
+
+binary_replay_writer::binary_replay_writer(const std::string &filename,
+                                           const encoded_metadata &metadata)
+    : _filename{filename}, _output{filename, std::ios::binary | std::ios::trunc} {
+  CHECK(_output) << "failed to open " << _filename;
+
+  std::string header(header_magic, magic_size);
+  put<uint32_t>(header, format_version);
+  put_string(header, metadata.codec_name);
+  put_string(header, metadata.codec_data);
+  put_string(header,
+             metadata.additional_data.is_null() ? "" : metadata.additional_data.dump());
+  write_bytes(header);
+}
+
+binary_replay_writer::~binary_replay_writer() { close(); }
+
+void binary_replay_writer::write(const encoded_frame &frame) {
+  CHECK(!_closed) << _filename << " is closed";
+  _index.push_back(index_entry{_offset, frame.creation_time, frame.key_frame});
+
+  std::string header;
+  header.reserve(frame_header_size);
+  put<uint32_t>(header, frame.data.size());
+  put<int64_t>(header, frame.id.i1);
+  put<int64_t>(header, frame.id.i2);
+  put<int64_t>(header, to_micros(frame.timestamp));
+  put<int64_t>(header, to_micros(frame.creation_time));
+  put<uint8_t>(header, frame.key_frame ? key_frame_flag : 0);
+  write_bytes(header);
+  write_bytes(frame.data);
+}
+
+void binary_replay_writer::close() {
+  if (_closed) {
+    return;
+  }
+  _closed = true;
+
+  std::string index;
+  index.reserve(_index.size() * index_entry_size + footer_size);
+  for (const auto &entry : _index) {
+    put<uint64_t>(index, entry.offset);
+    put<int64_t>(index, to_micros(entry.creation_time));
+    put<uint8_t>(index, entry.key_frame ? key_frame_flag : 0);
+  }
+  put<uint64_t>(index, _offset);
+  put<uint64_t>(index, _index.size());
+  index.append(index_magic, magic_size);
+  write_bytes(index);
+
+  _output.close();
+  CHECK(_output) << "failed to close " << _filename;
+  LOG(INFO) << "Wrote " << _index.size() << " frames to " << _filename;
+}
+
+void binary_replay_writer::write_bytes(const std::string &bytes) {
+  _output.write(bytes.data(), bytes.size());
+  CHECK(_output) << "failed to write " << _filename;
+  _offset += bytes.size();
+}
+
+binary_replay_reader::binary_replay_reader(const std::string &filename)
+    : _filename{filename} {}
+
+binary_replay_reader::~binary_replay_reader() {
+  if (_data != nullptr) {
+    ::munmap(const_cast<uint8_t *>(_data), _size);
+  }
+}
+
+std::error_condition binary_replay_reader::open() {
+  CHECK(_data == nullptr) << _filename << " is already open";
+
+  const int fd = ::open(_filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "failed to open " << _filename << ": " << strerror(errno);
+    return std::make_error_condition(std::errc::no_such_file_or_directory);
+  }
+  auto close_file = gsl::finally([fd]() { ::close(fd); });
+
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) != 0) {
+    LOG(ERROR) << "failed to stat " << _filename << ": " << strerror(errno);
+    return video_error::STREAM_INITIALIZATION_ERROR;
+  }
+  if (static_cast<size_t>(file_stat.st_size) < magic_size) {
+    LOG(ERROR) << _filename << " is too short for binary replay";
+    return video_error::STREAM_INITIALIZATION_ERROR;
+  }
+
+  void *data = ::mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "failed to map " << _filename << ": " << strerror(errno);
+    return video_error::STREAM_INITIALIZATION_ERROR;
+  }
+  ::madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+  _data = static_cast<const uint8_t *>(data);
+  _size = file_stat.st_size;
+
+  if (!parse()) {
+    return video_error::STREAM_INITIALIZATION_ERROR;
+  }
+  return {};
+}
+
+bool binary_replay_reader::parse() {
+  if (memcmp(_data, header_magic, magic_size) != 0) {
+    LOG(ERROR) << _filename << " is not a binary replay";
+    return false;
+  }
+
+  header_reader header{_data, _size};
+  uint32_t version;
+  std::string additional_data;
+  if (!header.read_u32(version) || !header.read_string(_metadata.codec_name)
+      || !header.read_string(_metadata.codec_data)
+      || !header.read_string(additional_data)) {
+    LOG(ERROR) << "truncated header in " << _filename;
+    return false;
+  }
+  if (version != format_version) {
+    LOG(ERROR) << "unsupported binary replay version " << version << " in "
+               << _filename;
+    return false;
+  }
+  if (!additional_data.empty()) {
+    try {
+      _metadata.additional_data = nlohmann::json::parse(additional_data);
+    } catch (const std::exception &e) {
+      LOG(ERROR) << "bad additional data in " << _filename << ": " << e.what();
+      return false;
+    }
+  }
+
+  _frames_begin = _position = header.position();
+  _frame_number = 0;
+  if (_size - _frames_begin >= frame_header_size) {
+    _start_time = from_micros(get<int64_t>(_data + _frames_begin + 28));
+  }
+  _frames_end = _size;
+  _index_count = 0;
+
+  if (_size - _frames_begin >= footer_size
+      && memcmp(_data + _size - magic_size, index_magic, magic_size) == 0) {
+    const uint64_t index_offset = get<uint64_t>(_data + _size - footer_size);
+    const uint64_t index_count = get<uint64_t>(_data + _size - footer_size + 8);
+    if (index_offset >= _frames_begin && index_offset <= _size - footer_size
+        && (_size - footer_size - index_offset) / index_entry_size == index_count
+        && (_size - footer_size - index_offset) % index_entry_size == 0) {
+      _frames_end = index_offset;
+      _index_count = index_count;
+    }
+  }
+  for (uint64_t i = 0; i < _index_count; i++) {
+    const uint64_t offset = index_entry_offset(i);
+    if (offset < _frames_begin || offset >= _frames_end) {
+      LOG(WARNING) << "frame " << i << " offset " << offset << " is out of range in "
+                   << _filename << ", ignoring index";
+      _index_count = 0;
+    }
+  }
+  if (_index_count == 0) {
+    LOG(WARNING) << "no index in " << _filename;
+  }
+
+  LOG(1) << "binary replay " << _filename << ": codec " << _metadata.codec_name << ", "
+         << _index_count << " indexed frames";
+  return true;
+}
+
+bool binary_replay_reader::next(encoded_frame &frame) {
+  if (_frames_end - _position < frame_header_size) {
+    if (_position != _frames_end) {
+      LOG(WARNING) << "truncated frame at " << _position << " in " << _filename;
+      _position = _frames_end;
+    }
+    return false;
+  }
+
+  const uint8_t *header = _data + _position;
+  const uint32_t size = get<uint32_t>(header);
+  if (_frames_end - _position - frame_header_size < size) {
+    LOG(WARNING) << "truncated frame at " << _position << " in " << _filename;
+    _position = _frames_end;
+    return false;
+  }
+
+  frame.id = {get<int64_t>(header + 4), get<int64_t>(header + 12)};
+  frame.timestamp = from_micros(get<int64_t>(header + 20));
+  frame.creation_time = from_micros(get<int64_t>(header + 28));
+  frame.key_frame = (header[36] & key_frame_flag) != 0;
+  frame.data.assign(reinterpret_cast<const char *>(header + frame_header_size), size);
+
+  _position += frame_header_size + size;
+  _frame_number++;
+  return true;
+}
+
+bool binary_replay_reader::seek(std::chrono::microseconds offset) {
+  if (_index_count == 0) {
+    return false;
+  }
+
+  // the first frame which is later than target time
+  const auto target = _start_time + offset;
+  uint64_t begin = 0;
+  uint64_t end = _index_count;
+  while (begin < end) {
+    const uint64_t middle = begin + (end - begin) / 2;
+    if (index_entry_time(middle) <= target) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+
+  return seek_to_key_frame(begin > 0 ? begin - 1 : 0);
+}
+
+bool binary_replay_reader::seek_frame(uint64_t frame_number) {
+  if (_index_count == 0) {
+    return false;
+  }
+  return seek_to_key_frame(std::min(frame_number, _index_count - 1));
+}
+
+bool binary_replay_reader::seek_to_key_frame(uint64_t frame_number) {
+  uint64_t key_frame_number = frame_number;
+  while (key_frame_number > 0 && !index_entry_key_frame(key_frame_number)) {
+    key_frame_number--;
+  }
+  if (!index_entry_key_frame(key_frame_number)) {
+    LOG(WARNING) << "no key frame before frame " << frame_number << " in " << _filename;
+    key_frame_number = frame_number;
+  }
+
+  LOG(1) << "seeking to frame " << key_frame_number << " in " << _filename;
+  _position = index_entry_offset(key_frame_number);
+  _frame_number = key_frame_number;
+  return true;
+}
+
+uint64_t binary_replay_reader::index_entry_offset(uint64_t frame_number) const {
+  return get<uint64_t>(_data + _frames_end + frame_number * index_entry_size);
+}
+
+std::chrono::system_clock::time_point binary_replay_reader::index_entry_time(
+    uint64_t frame_number) const {
+  return from_micros(
+      get<int64_t>(_data + _frames_end + frame_number * index_entry_size + 8));
+}
+
+bool binary_replay_reader::index_entry_key_frame(uint64_t frame_number) const {
+  return (_data[_frames_end + frame_number * index_entry_size + 16] & key_frame_flag)
+         != 0;
+}
+
+streams::publisher<encoded_packet> binary_replay_source(
+    boost::asio::io_service &io, const std::string &filename, bool batch,
+    const file_range &range) {
+  streams::publisher<encoded_packet> result =
+      streams::generators<encoded_packet>::stateful(
+          [filename, range]() { return new binary_replay_source_impl(filename, range); },
+          [](binary_replay_source_impl *impl, streams::observer<encoded_packet> &sink) {
+            impl->generate_one(sink);
+          });
+
+  if (!batch) {
+    // frames are played at the pace they were recorded
+    using time_point = std::chrono::system_clock::time_point;
+    auto last_time = std::make_shared<boost::optional<time_point>>();
+    result = std::move(result)
+             >> streams::asio::delay(
+                    io,
+                    [last_time](const encoded_packet &packet) {
+                      const encoded_frame *frame = boost::get<encoded_frame>(&packet);
+                      if (frame == nullptr || frame->decode_only || !*last_time) {
+                        return std::chrono::milliseconds(0);
+                      }
+                      const auto delay =
+                          std::chrono::duration_cast<std::chrono::milliseconds>(
+                              frame->creation_time - **last_time);
+                      return std::max(std::chrono::milliseconds(0), delay);
+                    })
+             >> streams::map([last_time](encoded_packet &&packet) {
+                 auto *frame = boost::get<encoded_frame>(&packet);
+                 if (frame != nullptr && !frame->decode_only) {
+                   *last_time = frame->creation_time;
+                 }
+                 return std::move(packet);
+               });
+  }
+
+  // recorded creation times are only used for pacing
+  return std::move(result) >> streams::map([](encoded_packet &&packet) {
+           if (auto *frame = boost::get<encoded_frame>(&packet)) {
+             frame->creation_time = std::chrono::system_clock::now();
+           }
+           return std::move(packet);
+         })
+         >> repeat_metadata();
+}
+
+}  // namespace video
+}  // namespace satori
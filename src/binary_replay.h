@@ -0,0 +1,119 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "data.h"
+
+// Binary replay is a compact alternative to JSON-lines network replays:
+// frames are stored as raw bytes, so they don't need JSON parsing and base64
+// decoding, and an index at the end of the file allows seeking.
+//
+// All numbers are little-endian, times are microseconds since epoch.
+//
+//   header:  "SVREPLAY" | u32 version | u32 size | codec name
+//                       | u32 size | codec data | u32 size | additional data json
+//   frame:   u32 data size | i64 id.i1 | i64 id.i2 | i64 timestamp
+//                          | i64 creation time | u8 flags | data
+//   index:   one entry per frame, u64 frame offset | i64 creation time | u8 flags
+//   footer:  u64 index offset | u64 frames count | "SVRINDEX"
+//
+// Creation time is the time frame arrived to the recorder, it drives
+// playback speed. Files without an index (if recording was interrupted)
+// are readable, but not seekable.
+namespace satori {
+namespace video {
+
+// Returns true if the file starts with binary replay header.
+bool is_binary_replay(const std::string &filename);
+
+class binary_replay_writer {
+ public:
+  binary_replay_writer(const std::string &filename, const encoded_metadata &metadata);
+
+  // Writes index unless it's already done.
+  ~binary_replay_writer();
+
+  void write(const encoded_frame &frame);
+
+  // Writes index and closes the file.
+  void close();
+
+ private:
+  struct index_entry {
+    uint64_t offset;
+    std::chrono::system_clock::time_point creation_time;
+    bool key_frame;
+  };
+
+  void write_bytes(const std::string &bytes);
+
+  const std::string _filename;
+  std::ofstream _output;
+  uint64_t _offset{0};
+  std::vector<index_entry> _index;
+  bool _closed{false};
+};
+
+// Reads binary replay file mapped into memory.
+class binary_replay_reader {
+ public:
+  explicit binary_replay_reader(const std::string &filename);
+
+  ~binary_replay_reader();
+
+  // Maps the file and reads its header and index.
+  std::error_condition open();
+
+  const encoded_metadata &metadata() const { return _metadata; }
+
+  // zero if there is no index
+  uint64_t frames_count() const { return _index_count; }
+
+  // Creation time of the first frame, seek() offsets are counted from it.
+  std::chrono::system_clock::time_point start_time() const { return _start_time; }
+
+  // Number of the frame next() returns, counted from zero.
+  uint64_t frame_number() const { return _frame_number; }
+
+  // Returns false at the end of the file.
+  bool next(encoded_frame &frame);
+
+  // Positions the reader at the last key frame at or before given time since
+  // the first frame, or at the frame itself if no key frame precedes it.
+  // Returns false if the file has no index.
+  bool seek(std::chrono::microseconds offset);
+
+  // Same as seek(), but frames are counted from zero.
+  bool seek_frame(uint64_t frame_number);
+
+ private:
+  bool parse();
+  uint64_t index_entry_offset(uint64_t frame_number) const;
+  std::chrono::system_clock::time_point index_entry_time(uint64_t frame_number) const;
+  bool index_entry_key_frame(uint64_t frame_number) const;
+  bool seek_to_key_frame(uint64_t frame_number);
+
+  const std::string _filename;
+  const uint8_t *_data{nullptr};
+  size_t _size{0};
+  encoded_metadata _metadata;
+  uint64_t _frames_begin{0};
+  uint64_t _frames_end{0};
+  uint64_t _index_count{0};
+  uint64_t _position{0};
+  uint64_t _frame_number{0};
+  std::chrono::system_clock::time_point _start_time;
+};
+
+// Reads JSON-lines network replay with its .metadata file and writes it
+// as binary replay. Line timestamps become frame creation times.
+void convert_network_replay(const std::string &network_replay,
+                            const std::string &binary_replay);
+
+}  // namespace video
+}  // namespace satori
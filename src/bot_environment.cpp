@@ -2,14 +2,25 @@
 
 #include <algorithm>
 #include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <gsl/gsl>
 #include <json.hpp>
+#include <limits>
+#include <mutex>
+#include <thread>
 
 #include "avutils.h"
 #include "bot_instance.h"
 #include "bot_instance_builder.h"
+#include "frame_trace.h"
+#include "json_file_sink.h"
+#include "keyframe_index.h"
 #include "logging_impl.h"
 #include "ostream_sink.h"
 #include "rtm_streams.h"
@@ -18,11 +29,42 @@
 #include "streams/signal_breaker.h"
 #include "streams/threaded_worker.h"
 #include "tcmalloc.h"
+#include "threadutils.h"
 
 namespace satori {
 namespace video {
+namespace streams {
+
+template <>
+struct priority_traits<bot_input> {
+  static bool is_priority(const bot_input& input) {
+    return boost::get<nlohmann::json>(&input) != nullptr;
+  }
+};
+
+}  // namespace streams
+
 namespace {
 
+auto& frame_batch_wait_times_millis =
+    prometheus::BuildHistogram()
+        .Name("frame_batch_wait_times_millis")
+        .Register(metrics_registry())
+        .Add({}, std::vector<double>{0,   1,   2,   5,   10,  15,  20,  25,
+                                     30,  40,  50,  60,  70,  80,  90,  100,
+                                     200, 300, 400, 500, 750, 1000});
+auto& control_queue_delay_millis =
+    prometheus::BuildHistogram()
+        .Name("control_message_queue_delay_millis")
+        .Register(metrics_registry())
+        .Add({}, std::vector<double>{0,   1,   2,   5,   10,  15,  20,  25,
+                                     30,  40,  50,  60,  70,  80,  90,  100,
+                                     200, 300, 400, 500, 750, 1000});
+auto& frames_stale_dropped_total = prometheus::BuildCounter()
+                                       .Name("frames_stale_dropped_total")
+                                       .Register(metrics_registry())
+                                       .Add({});
+
 using variables_map = boost::program_options::variables_map;
 
 po::options_description bot_custom_options() {
@@ -50,6 +92,54 @@ po::options_description bot_custom_options() {
   bot_execution_options.add_options()("max-queued-frames",
                                       po::value<size_t>(),
                                       "limits bot input queue size");
+  bot_execution_options.add_options()(
+      "analysis-dir", po::value<std::string>(),
+      "with --input-manifest, saves analysis messages of each file to "
+      "<dir>/<file name>.analysis");
+  bot_execution_options.add_options()(
+      "concurrent-files", po::value<size_t>()->default_value(4),
+      "(number) with --input-manifest, how many files are processed in parallel");
+  bot_execution_options.add_options()(
+      "batch-shards", po::value<size_t>()->default_value(1),
+      "(number) in batch mode, splits --input-video-file into key frame aligned "
+      "segments processed in parallel, bot state scope should be SEGMENT");
+  bot_execution_options.add_options()(
+      "pool-capacity", po::value<size_t>()->default_value(1),
+      "(number) in pool mode, how many jobs are processed at the same time, "
+      "each job gets its own bot instance");
+  bot_execution_options.add_options()(
+      "target-batch-size", po::value<size_t>()->default_value(0),
+      "(number) frames in a multiframe batch, in live mode the batch waits for "
+      "--batch-max-wait-ms to fill up");
+  bot_execution_options.add_options()(
+      "batch-max-wait-ms", po::value<size_t>()->default_value(0),
+      "(number) in live mode, how long the first frame of a batch may wait for "
+      "--target-batch-size frames");
+  bot_execution_options.add_options()(
+      "batch-max-staleness-ms", po::value<size_t>()->default_value(0),
+      "(number) in live mode, frames queued for longer are dropped, 0 disables "
+      "dropping");
+  bot_execution_options.add_options()(
+      "target-latency-ms", po::value<size_t>(),
+      "(number) in live mode, skips frames uniformly to keep time from frame arrival "
+      "to the end of its processing under the target, skipped frames aren't converted "
+      "to images, and aren't decoded at all if the codec is intra-only (MJPEG)");
+  bot_execution_options.add_options()(
+      "bot-threads", po::value<size_t>()->default_value(1),
+      "(number) how many frame batches are processed concurrently, each thread gets "
+      "its own bot instance, bot state scope should be FRAME");
+  bot_execution_options.add_options()(
+      "message-files-compression", po::value<std::string>()->default_value("none"),
+      "(none|gzip) compresses --analysis-file and --debug-file");
+  bot_execution_options.add_options()(
+      "message-file-max-bytes", po::value<uint64_t>()->default_value(0),
+      "(number) continues --analysis-file and --debug-file in <name>.1<ext>, "
+      "<name>.2<ext>, ... after this many bytes of uncompressed messages, 0 disables "
+      "rotation");
+  bot_execution_options.add_options()(
+      "frame-trace-sampling", po::value<size_t>()->default_value(0),
+      "(number) every Nth bot message about a frame is followed by a debug message "
+      "with latency breakdown of the frame, 0 disables tracing output");
 
   return bot_configuration_options.add(bot_execution_options)
       .add(metrics_options())
@@ -94,8 +184,729 @@ nlohmann::json init_config(const po::variables_map& vm) {
 
   return json_config;
 }
+
+bool validate_batch_shards(const bot_configuration& config,
+                           const multiframe_bot_descriptor& bot) {
+  if (config.batch_shards == 1) {
+    return true;
+  }
+  if (config.batch_shards == 0) {
+    std::cerr << "--batch-shards should be positive\n";
+    return false;
+  }
+  if (!config.video_cfg.batch || !config.video_cfg.input_video_file) {
+    std::cerr << "--batch-shards requires --batch and --input-video-file\n";
+    return false;
+  }
+  if (bot.state == state_scope::STREAM) {
+    std::cerr << "--batch-shards requires a bot with SEGMENT or FRAME state scope\n";
+    return false;
+  }
+  if (!config.video_cfg.range.empty() || config.video_cfg.loop
+      || config.video_cfg.time_limit || config.video_cfg.frames_limit) {
+    std::cerr << "--batch-shards doesn't support file range, --loop, --time-limit and "
+                 "--frames-limit\n";
+    return false;
+  }
+  return true;
+}
+
+// Bot output of a segment is written to part files,
+// they are concatenated in segment order when all segments are done.
+struct segment_output : boost::static_visitor<void> {
+  explicit segment_output(const boost::filesystem::path& prefix)
+      : analysis_path{prefix.string() + ".analysis"},
+        debug_path{prefix.string() + ".debug"},
+        control_path{prefix.string() + ".control"},
+        analysis{analysis_path.string()},
+        debug{debug_path.string()},
+        control{control_path.string()} {}
+
+  void operator()(const owned_image_metadata& /*metadata*/) {}
+
+  void operator()(const owned_image_frame& /*frame*/) {}
+
+  void operator()(struct bot_message& msg) {
+    switch (msg.kind) {
+      case bot_message_kind::ANALYSIS:
+        analysis << msg.data << "\n";
+        break;
+      case bot_message_kind::CONTROL:
+        control << msg.data << "\n";
+        break;
+      case bot_message_kind::DEBUG:
+        debug << msg.data << "\n";
+        break;
+    }
+  }
+
+  void close() {
+    analysis.close();
+    debug.close();
+    control.close();
+  }
+
+  const boost::filesystem::path analysis_path;
+  const boost::filesystem::path debug_path;
+  const boost::filesystem::path control_path;
+  std::ofstream analysis;
+  std::ofstream debug;
+  std::ofstream control;
+};
+
+void append_file(const boost::filesystem::path& part, std::ostream& out) {
+  std::ifstream in{part.string()};
+  if (in.peek() != std::ifstream::traits_type::eof()) {
+    out << in.rdbuf();
+  }
+}
+
+bool validate_input_manifest(const bot_configuration& config) {
+  if (!config.video_cfg.input_manifest) {
+    return true;
+  }
+  if (config.concurrent_files == 0) {
+    std::cerr << "--concurrent-files should be positive\n";
+    return false;
+  }
+  if (config.video_cfg.loop || config.video_cfg.time_limit
+      || config.video_cfg.frames_limit) {
+    std::cerr << "--input-manifest doesn't support --loop, --time-limit and "
+                 "--frames-limit\n";
+    return false;
+  }
+  return true;
+}
+
+bool validate_bot_threads(const bot_configuration& config,
+                          const multiframe_bot_descriptor& bot) {
+  if (config.bot_threads == 1) {
+    return true;
+  }
+  if (config.bot_threads == 0) {
+    std::cerr << "--bot-threads should be positive\n";
+    return false;
+  }
+  if (bot.state != state_scope::FRAME) {
+    std::cerr << "--bot-threads requires a bot with FRAME state scope\n";
+    return false;
+  }
+  if (config.batch_shards > 1 || config.video_cfg.input_manifest) {
+    std::cerr << "--bot-threads can't be combined with --batch-shards and "
+                 "--input-manifest\n";
+    return false;
+  }
+  return true;
+}
+
+bool validate_batching(const bot_configuration& config) {
+  if (config.batching.max_wait.count() > 0 && config.batching.target_size == 0) {
+    std::cerr << "--batch-max-wait-ms requires --target-batch-size\n";
+    return false;
+  }
+  if (config.target_latency_ms && config.video_cfg.batch) {
+    std::cerr << "--target-latency-ms is not supported in batch mode\n";
+    return false;
+  }
+  if (config.target_latency_ms && config.target_latency_ms.get() == 0) {
+    std::cerr << "--target-latency-ms should be positive\n";
+    return false;
+  }
+  return true;
+}
+
+bool validate_message_files(const bot_configuration& config) {
+  if (!streams::parse_json_file_compression(config.message_files_compression)) {
+    std::cerr << "unknown --message-files-compression "
+              << config.message_files_compression << "\n";
+    return false;
+  }
+  // message files of these modes are concatenated from parts
+  if ((config.message_files_compression != "none" || config.message_file_max_bytes > 0)
+      && (config.batch_shards > 1 || config.video_cfg.input_manifest)) {
+    std::cerr << "--message-files-compression and --message-file-max-bytes can't be "
+                 "combined with --batch-shards and --input-manifest\n";
+    return false;
+  }
+  return true;
+}
+
+bool validate_frame_trace(const bot_configuration& config) {
+  if (config.frame_trace_sampling > 0
+      && (config.batch_shards > 1 || config.video_cfg.input_manifest)) {
+    std::cerr << "--frame-trace-sampling can't be combined with --batch-shards and "
+                 "--input-manifest\n";
+    return false;
+  }
+  return true;
+}
+
+bool validate_bot_config(const bot_configuration& config,
+                         const multiframe_bot_descriptor& bot) {
+  return validate_batch_shards(config, bot) && validate_input_manifest(config)
+         && validate_bot_threads(config, bot) && validate_batching(config)
+         && validate_message_files(config) && validate_frame_trace(config);
+}
+
+// Sharded and manifest runs process all files before returning,
+// so they would block the io thread shared by all jobs.
+bool validate_pool_job(const bot_configuration& config) {
+  if (config.batch_shards > 1 || config.video_cfg.input_manifest) {
+    std::cerr << "batch_shards and input_manifest are not supported in pool jobs\n";
+    return false;
+  }
+  return true;
+}
+
+streams::json_file_options message_file_options(const bot_configuration& config) {
+  // validated by validate_message_files()
+  const auto compression =
+      streams::parse_json_file_compression(config.message_files_compression);
+  CHECK(compression) << "unknown message files compression "
+                     << config.message_files_compression;
+  streams::json_file_options options;
+  options.compression = *compression;
+  options.max_file_bytes = config.message_file_max_bytes;
+  return options;
+}
+
+// In batch mode frames are never dropped, so every batch is complete except the
+// last one.
+streams::op<owned_image_packet, std::queue<owned_image_packet>> batch_packets(
+    size_t target_size) {
+  using batch_t = std::queue<owned_image_packet>;
+  const size_t batch_size = std::max<size_t>(target_size, 1);
+  return [batch_size](streams::publisher<owned_image_packet>&& src) {
+    auto pending = std::make_shared<batch_t>();
+    auto full_batches = std::move(src) >> streams::flat_map([pending, batch_size](
+                                              owned_image_packet&& pkt) {
+      pending->push(std::move(pkt));
+      if (pending->size() < batch_size) {
+        return streams::publishers::empty<batch_t>();
+      }
+      std::vector<batch_t> batch(1);
+      batch[0].swap(*pending);
+      return streams::publishers::of(std::move(batch));
+    });
+
+    // created when input completes
+    auto last_batch = streams::generators<batch_t>::stateful(
+        [pending]() {
+          auto* rest = new std::list<batch_t>;
+          if (!pending->empty()) {
+            rest->push_back(std::move(*pending));
+          }
+          return rest;
+        },
+        [](std::list<batch_t>* rest, streams::observer<batch_t>& sink) {
+          if (rest->empty()) {
+            sink.on_complete();
+            return;
+          }
+          batch_t batch = std::move(rest->front());
+          rest->pop_front();
+          sink.on_next(std::move(batch));
+        });
+
+    return streams::publishers::concat(std::move(full_batches), std::move(last_batch));
+  };
+}
+
+// Output of files processed concurrently goes to shared streams,
+// messages are tagged with the file name.
+class tagged_output {
+ public:
+  tagged_output(std::ostream& analysis, std::ostream& debug, std::ostream& control)
+      : _analysis(analysis), _debug(debug), _control(control) {}
+
+  void write(bot_message_kind kind, const nlohmann::json& data) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    switch (kind) {
+      case bot_message_kind::ANALYSIS:
+        _analysis << data << "\n";
+        break;
+      case bot_message_kind::CONTROL:
+        _control << data << "\n";
+        break;
+      case bot_message_kind::DEBUG:
+        _debug << data << "\n";
+        break;
+    }
+  }
+
+ private:
+  std::mutex _mutex;
+  std::ostream& _analysis;
+  std::ostream& _debug;
+  std::ostream& _control;
+};
+
+struct file_output : boost::static_visitor<void> {
+  // if analysis_dir is set, analysis goes to <analysis_dir>/<file name>.analysis
+  file_output(const std::string& filename, tagged_output& shared,
+              const boost::optional<std::string>& analysis_dir)
+      : filename{filename}, shared{shared} {
+    if (analysis_dir) {
+      const auto path = boost::filesystem::path{*analysis_dir}
+                        / (boost::filesystem::path{filename}.filename().string()
+                           + ".analysis");
+      analysis = std::make_unique<std::ofstream>(path.string());
+    }
+  }
+
+  void operator()(const owned_image_metadata& /*metadata*/) {}
+
+  void operator()(const owned_image_frame& /*frame*/) {}
+
+  void operator()(struct bot_message& msg) {
+    if (msg.kind == bot_message_kind::ANALYSIS && analysis) {
+      *analysis << msg.data << "\n";
+      return;
+    }
+    if (!filename.empty()) {
+      msg.data["file"] = filename;
+    }
+    shared.write(msg.kind, msg.data);
+  }
+
+  const std::string filename;
+  tagged_output& shared;
+  std::unique_ptr<std::ofstream> analysis;
+};
+
+// Shutdown messages are sent only if shutdown is true.
+template <typename Output>
+bool process_file(bot_instance& instance,
+                  const cli_streams::input_video_config& video_cfg,
+                  image_pixel_format pixel_format, bool shutdown, Output& output) {
+  boost::asio::io_service io;
+  auto source = cli_streams::decoded_publisher(io, nullptr, video_cfg, pixel_format)
+                >> batch_packets(instance.batching->target_size)
+                >> streams::map([](std::queue<owned_image_packet>&& q) {
+                    return bot_input{std::move(q)};
+                  });
+
+  auto when_done = (std::move(source) >> instance.run_bot(shutdown))
+                       ->process([&output](bot_output&& o) {
+                         boost::apply_visitor(output, o);
+                       });
+  return when_done.ok();
+}
+
+template <typename Output>
+void shutdown_bot(bot_instance& instance, Output& output) {
+  (streams::publishers::empty<bot_input>() >> instance.run_bot())
+      ->process([&output](bot_output&& o) { boost::apply_visitor(output, o); });
+}
+
+// Handle of the live input stream of a job, is used only on io thread.
+struct input_stopper {
+  bool stopped{false};
+  // set while the input is subscribed
+  std::function<void()> stop_input;
+
+  void stop() {
+    stopped = true;
+    if (stop_input) {
+      // stopping resets stop_input
+      auto stop_subscribed_input = stop_input;
+      stop_subscribed_input();
+    }
+  }
+};
+
+// Cancels its source and completes the stream when input_stopper is stopped.
+// RTM sources run callbacks on io thread, so this is the thread they're cancelled
+// on, unlike cancellation which comes from downstream threaded_worker.
+class stoppable_input_op {
+ public:
+  explicit stoppable_input_op(const std::shared_ptr<input_stopper>& stopper)
+      : _stopper(stopper) {}
+
+  template <typename T>
+  class instance : public streams::subscriber<T>, streams::subscription {
+   public:
+    static streams::publisher<T> apply(streams::publisher<T>&& source,
+                                       stoppable_input_op&& op) {
+      return streams::publisher<T>(
+          new streams::impl::op_publisher<T, T, stoppable_input_op>(std::move(source),
+                                                                    op));
+    }
+
+    instance(stoppable_input_op&& op, streams::subscriber<T>& sink)
+        : _stopper(op._stopper), _sink(sink) {}
+
+    ~instance() override { _stopper->stop_input = nullptr; }
+
+   private:
+    void on_subscribe(streams::subscription& s) override {
+      _source = &s;
+      _stopper->stop_input = [this]() { stop(); };
+      _sink.on_subscribe(*this);
+    }
+
+    void on_next(T&& t) override {
+      if (_stopper->stopped) {
+        stop();
+        return;
+      }
+      _sink.on_next(std::move(t));
+    }
+
+    void on_error(std::error_condition ec) override {
+      _sink.on_error(ec);
+      delete this;
+    }
+
+    void on_complete() override {
+      _sink.on_complete();
+      delete this;
+    }
+
+    void request(int n) override { _source->request(n); }
+
+    void cancel() override {
+      _source->cancel();
+      delete this;
+    }
+
+    void stop() {
+      LOG(INFO) << "stopping input";
+      _source->cancel();
+      _sink.on_complete();
+      delete this;
+    }
+
+    const std::shared_ptr<input_stopper> _stopper;
+    streams::subscriber<T>& _sink;
+    streams::subscription* _source{nullptr};
+  };
+
+ private:
+  const std::shared_ptr<input_stopper> _stopper;
+};
+
 }  // namespace
 
+// Pipeline of a single bot instance: decoded video and control messages go in,
+// bot messages go to analysis, debug and control outputs.
+class bot_job : boost::static_visitor<void> {
+ public:
+  bot_job(const multiframe_bot_descriptor& descriptor, const bot_configuration& config,
+          const nlohmann::json& job, boost::asio::io_service& io,
+          const std::shared_ptr<rtm::client>& rtm_client,
+          const std::shared_ptr<file_writer_pool>& message_writer_pool,
+          bool breaks_on_signal, std::function<void(bot_job*)>&& on_done)
+      : _descriptor(descriptor),
+        _config(config),
+        _job(job),
+        _io(io),
+        _rtm_client(rtm_client),
+        _message_writer_pool(message_writer_pool),
+        _breaks_on_signal(breaks_on_signal),
+        _on_done(std::move(on_done)) {}
+
+  const nlohmann::json& job() const { return _job; }
+
+  bool stopped() const { return _stopped; }
+
+  // Live input is stopped on io thread, batch input is checked on processing
+  // thread, so the pipeline ends at the next frame or control message.
+  void stop() {
+    LOG(INFO) << "stopping job " << _job;
+    _stopped = true;
+    _io.post([stopper = _input_stopper]() { stopper->stop(); });
+  }
+
+  void start() {
+    const bool batch = _config.video_cfg.batch;
+    size_t threads = _config.bot_threads;
+    if (threads > 1 && _descriptor.state != state_scope::FRAME) {
+      LOG(WARNING) << "bot state scope is not FRAME, ignoring bot threads: " << _job;
+      threads = 1;
+    }
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+      _bot_instances.push_back(
+          bot_instance_builder{_descriptor}
+              .set_execution_mode(batch ? execution_mode::BATCH : execution_mode::LIVE)
+              .set_bot_id(_config.id)
+              .set_config(_config.bot_config)
+              .set_batching_policy(_config.batching)
+              .build());
+    }
+
+    init_outputs();
+
+    streams::publisher<nlohmann::json> control_source;
+    if (_rtm_client) {
+      control_source = rtm::channel(_rtm_client,
+                                    _config.video_cfg.input_channel.get()
+                                        + control_channel_suffix,
+                                    {})
+                       >> streams::map(
+                              [](rtm::channel_data&& t) { return std::move(t.payload); });
+    } else {
+      control_source = streams::publishers::empty<nlohmann::json>();
+    }
+
+    std::shared_ptr<frame_skip_controller> skip_controller;
+    if (!batch && _config.target_latency_ms) {
+      frame_skip_controller::settings settings;
+      settings.target_latency =
+          std::chrono::milliseconds(_config.target_latency_ms.get());
+      skip_controller = std::make_shared<frame_skip_controller>(settings);
+    }
+    auto single_frame_source =
+        cli_streams::decoded_publisher(_io, _rtm_client, _config.video_cfg,
+                                       _descriptor.pixel_format, skip_controller);
+    streams::publisher<bot_input> bot_input_stream;
+    if (!batch) {
+      // Control messages share the processing queue with frames, but skip queued
+      // frames and are passed to the bot before the next frame batch.
+      auto input =
+          streams::publishers::merge<bot_input>(
+              std::move(control_source) >> streams::map([this](nlohmann::json&& t) {
+                std::lock_guard<std::mutex> lock(_control_mutex);
+                _control_arrivals.push_back(std::chrono::steady_clock::now());
+                return bot_input{t};
+              }),
+              std::move(single_frame_source)
+                  >> streams::map([](owned_image_packet&& pkt) {
+                      std::queue<owned_image_packet> q;
+                      q.push(std::move(pkt));
+                      return bot_input{q};
+                    }))
+          >> stoppable_input_op(_input_stopper)
+          >> streams::threaded_worker("processing_worker", _config.max_queued_frames,
+                                      live_batching(skip_controller));
+      if (_breaks_on_signal) {
+        input = std::move(input) >> streams::signal_breaker({SIGINT, SIGTERM, SIGQUIT});
+      }
+      bot_input_stream =
+          std::move(input) >> streams::flat_map([this](std::queue<bot_input>&& batch) {
+            return streams::publishers::of(split_live_batch(std::move(batch)));
+          });
+    } else {
+      auto source =
+          std::move(single_frame_source) >> batch_packets(_config.batching.target_size);
+      if (_breaks_on_signal) {
+        source = std::move(source) >> streams::signal_breaker({SIGINT, SIGTERM, SIGQUIT});
+      }
+      bot_input_stream = streams::publishers::merge<bot_input>(
+          std::move(control_source)
+              >> streams::map([](nlohmann::json&& t) { return bot_input{t}; }),
+          std::move(source) >> streams::map([this](std::queue<owned_image_packet>&& p) {
+            count_multiframe();
+            return bot_input{p};
+          }))
+          >> streams::take_while([this](const bot_input&) { return !_stopped; });
+    }
+
+    streams::publisher<bot_output> bot_output_stream;
+    if (_bot_instances.size() == 1) {
+      bot_output_stream = std::move(bot_input_stream) >> _bot_instances[0]->run_bot();
+    } else {
+      std::vector<bot_instance*> instances;
+      for (auto& instance : _bot_instances) {
+        instances.push_back(instance.get());
+      }
+      bot_output_stream = std::move(bot_input_stream) >> run_parallel_bots(instances);
+    }
+    bot_output_stream =
+        std::move(bot_output_stream) >> streams::do_finally([this]() { done(); });
+
+    bot_output_stream->process(
+        [this](bot_output&& o) { boost::apply_visitor(*this, o); });
+  }
+
+  void operator()(const owned_image_metadata& /*metadata*/) {}
+
+  void operator()(const owned_image_frame& /*frame*/) {}
+
+  void operator()(struct bot_message& msg) {
+    const auto published = std::chrono::steady_clock::now();
+    switch (msg.kind) {
+      case bot_message_kind::ANALYSIS:
+        _analysis_sink->on_next(std::move(msg.data));
+        break;
+      case bot_message_kind::CONTROL:
+        _control_sink->on_next(std::move(msg.data));
+        break;
+      case bot_message_kind::DEBUG:
+        _debug_sink->on_next(std::move(msg.data));
+        break;
+    }
+    trace_message(msg, published);
+  }
+
+ private:
+  // Callbacks run on processing thread and may outlive the job.
+  streams::batching_options live_batching(
+      const std::shared_ptr<frame_skip_controller>& skip_controller) {
+    streams::batching_options batching;
+    batching.target_size = _config.batching.target_size;
+    batching.max_wait = _config.batching.max_wait;
+    batching.max_staleness = _config.batching.max_staleness;
+    auto last_wait = std::make_shared<std::chrono::steady_clock::duration>();
+    batching.on_batch = [last_wait](size_t size, size_t dropped,
+                                    std::chrono::steady_clock::duration waited) {
+      *last_wait = waited;
+      if (size > 0) {
+        frame_batch_wait_times_millis.Observe(
+            std::chrono::duration_cast<std::chrono::milliseconds>(waited).count());
+      }
+      if (dropped > 0) {
+        LOG(WARNING) << "dropped " << dropped << " stale frames";
+        frames_stale_dropped_total.Increment(dropped);
+      }
+    };
+    if (skip_controller) {
+      batching.on_delivered = [last_wait, skip_controller](
+                                  size_t size, std::chrono::steady_clock::duration took) {
+        using std::chrono::microseconds;
+        skip_controller->on_processed(
+            size, std::chrono::duration_cast<microseconds>(took),
+            std::chrono::duration_cast<microseconds>(*last_wait + took));
+      };
+    }
+    return batching;
+  }
+
+  // Worker delivers control messages in a batch of their own,
+  // frames of a batch are joined into a single multiframe.
+  std::vector<bot_input> split_live_batch(std::queue<bot_input>&& batch) {
+    std::vector<bot_input> result;
+    std::queue<owned_image_packet> frames;
+    const auto now = std::chrono::steady_clock::now();
+    while (!batch.empty()) {
+      bot_input& input = batch.front();
+      if (auto* packets = boost::get<std::queue<owned_image_packet>>(&input)) {
+        while (!packets->empty()) {
+          frames.push(std::move(packets->front()));
+          packets->pop();
+        }
+      } else {
+        std::lock_guard<std::mutex> lock(_control_mutex);
+        CHECK(!_control_arrivals.empty());
+        control_queue_delay_millis.Observe(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                now - _control_arrivals.front())
+                .count());
+        _control_arrivals.pop_front();
+        result.push_back(std::move(input));
+      }
+      batch.pop();
+    }
+    if (!frames.empty()) {
+      count_multiframe();
+      result.emplace_back(std::move(frames));
+    }
+    return result;
+  }
+
+  // Messages about frames end the frame trace.
+  void trace_message(const struct bot_message& msg,
+                     std::chrono::steady_clock::time_point published) {
+    if (msg.trace.callback_end == std::chrono::steady_clock::time_point{}) {
+      return;
+    }
+    observe_message_stages(msg.trace, published);
+
+    const size_t sampling = _config.frame_trace_sampling;
+    if (sampling == 0 || (_traced_messages++ % sampling) != 0) {
+      return;
+    }
+    nlohmann::json trace = {{"frame_trace", frame_trace_to_json(msg.trace, published)},
+                            {"i", {msg.id.i1, msg.id.i2}}};
+    if (!_config.id.empty()) {
+      trace["from"] = _config.id;
+    }
+    _debug_sink->on_next(std::move(trace));
+  }
+
+  void count_multiframe() {
+    _multiframes_counter++;
+    constexpr int period = 100;
+    if ((_multiframes_counter % period) == 0) {
+      LOG(INFO) << "Processed " << _multiframes_counter << " multiframes";
+    }
+  }
+
+  void init_outputs() {
+    if (_config.analysis_file) {
+      std::string analysis_file = _config.analysis_file.get();
+      LOG(INFO) << "saving analysis output to " << analysis_file;
+      _analysis_sink = &streams::json_file_sink(
+          analysis_file, message_file_options(_config), _message_writer_pool);
+      _file_sinks.push_back(_analysis_sink);
+    } else if (_rtm_client) {
+      _analysis_sink =
+          &rtm::sink(_rtm_client, _io,
+                     _config.video_cfg.input_channel.get() + analysis_channel_suffix);
+    } else {
+      _analysis_sink = &streams::ostream_sink(std::cout);
+    }
+
+    if (_config.debug_file) {
+      std::string debug_file = _config.debug_file.get();
+      LOG(INFO) << "saving debug output to " << debug_file;
+      _debug_sink = &streams::json_file_sink(debug_file, message_file_options(_config),
+                                             _message_writer_pool);
+      _file_sinks.push_back(_debug_sink);
+    } else if (_rtm_client) {
+      _debug_sink =
+          &rtm::sink(_rtm_client, _io,
+                     _config.video_cfg.input_channel.get() + debug_channel_suffix);
+    } else {
+      _debug_sink = &streams::ostream_sink(std::cerr);
+    }
+
+    if (_rtm_client) {
+      _control_sink =
+          &rtm::sink(_rtm_client, _io,
+                     _config.video_cfg.input_channel.get() + control_channel_suffix);
+    } else {
+      _control_sink = &streams::ostream_sink(std::cout);
+    }
+  }
+
+  void done() {
+    LOG(INFO) << "job is done after " << _multiframes_counter << " multiframes: " << _job;
+    // waits until queued messages are written and files are closed
+    for (auto* sink : _file_sinks) {
+      sink->on_complete();
+    }
+    _file_sinks.clear();
+    _on_done(this);
+  }
+
+  const multiframe_bot_descriptor& _descriptor;
+  const bot_configuration _config;
+  const nlohmann::json _job;
+  boost::asio::io_service& _io;
+  const std::shared_ptr<rtm::client> _rtm_client;
+  const std::shared_ptr<file_writer_pool> _message_writer_pool;
+  const bool _breaks_on_signal;
+  const std::function<void(bot_job*)> _on_done;
+
+  std::atomic<bool> _stopped{false};
+  const std::shared_ptr<input_stopper> _input_stopper{
+      std::make_shared<input_stopper>()};
+  uint64_t _multiframes_counter{0};
+  uint64_t _traced_messages{0};
+  // arrival times of control messages waiting in processing queue
+  std::mutex _control_mutex;
+  std::deque<std::chrono::steady_clock::time_point> _control_arrivals;
+  // several instances with --bot-threads
+  std::vector<std::unique_ptr<bot_instance>> _bot_instances;
+
+  streams::observer<nlohmann::json>* _analysis_sink{nullptr};
+  streams::observer<nlohmann::json>* _debug_sink{nullptr};
+  streams::observer<nlohmann::json>* _control_sink{nullptr};
+  // file sinks are completed when the job is done, the rest are shared
+  std::vector<streams::observer<nlohmann::json>*> _file_sinks;
+};
+
 bot_environment& bot_environment::instance() {
   static bot_environment env;
   return env;
@@ -105,24 +916,6 @@ void bot_environment::register_bot(const multiframe_bot_descriptor& bot) {
   _bot_descriptor = bot;
 }
 
-void bot_environment::operator()(const owned_image_metadata& /*metadata*/) {}
-
-void bot_environment::operator()(const owned_image_frame& /*frame*/) {}
-
-void bot_environment::operator()(struct bot_message& msg) {
-  switch (msg.kind) {
-    case bot_message_kind::ANALYSIS:
-      _analysis_sink->on_next(std::move(msg.data));
-      break;
-    case bot_message_kind::CONTROL:
-      _control_sink->on_next(std::move(msg.data));
-      break;
-    case bot_message_kind::DEBUG:
-      _debug_sink->on_next(std::move(msg.data));
-      break;
-  }
-}
-
 struct env_configuration : cli_streams::configuration {
   env_configuration(int argc, char* argv[])
       : configuration(argc, argv, bot_cli_cfg(), bot_custom_options()) {}
@@ -133,6 +926,7 @@ struct env_configuration : cli_streams::configuration {
                                  : boost::optional<std::string>{};
   }
   std::string id() const { return _vm["id"].as<std::string>(); }
+  size_t pool_capacity() const { return _vm["pool-capacity"].as<size_t>(); }
 };
 
 bot_configuration::bot_configuration(const po::variables_map& vm)
@@ -145,7 +939,21 @@ bot_configuration::bot_configuration(const po::variables_map& vm)
       bot_config(init_config(vm)),
       max_queued_frames(vm.count("max-queued-frames") > 0
                             ? vm["max-queued-frames"].as<size_t>()
-                            : boost::optional<size_t>{}) {}
+                            : boost::optional<size_t>{}),
+      batch_shards(vm["batch-shards"].as<size_t>()),
+      analysis_dir(vm.count("analysis-dir") > 0 ? vm["analysis-dir"].as<std::string>()
+                                                : boost::optional<std::string>{}),
+      concurrent_files(vm["concurrent-files"].as<size_t>()),
+      bot_threads(vm["bot-threads"].as<size_t>()),
+      batching{vm["target-batch-size"].as<size_t>(),
+               std::chrono::milliseconds(vm["batch-max-wait-ms"].as<size_t>()),
+               std::chrono::milliseconds(vm["batch-max-staleness-ms"].as<size_t>())},
+      target_latency_ms(vm.count("target-latency-ms") > 0
+                            ? vm["target-latency-ms"].as<size_t>()
+                            : boost::optional<size_t>{}),
+      message_files_compression(vm["message-files-compression"].as<std::string>()),
+      message_file_max_bytes(vm["message-file-max-bytes"].as<uint64_t>()),
+      frame_trace_sampling(vm["frame-trace-sampling"].as<size_t>()) {}
 
 bot_configuration::bot_configuration(const nlohmann::json& config)
     : id(config["id"].get<std::string>()),
@@ -160,13 +968,55 @@ bot_configuration::bot_configuration(const nlohmann::json& config)
                             : boost::optional<size_t>{}),
       video_cfg(config),
       bot_config(config.find("config") != config.end() ? config["config"]
-                                                       : nlohmann::json(nullptr)) {}
+                                                       : nlohmann::json(nullptr)),
+      batch_shards(config.find("batch_shards") != config.end()
+                       ? config["batch_shards"].get<size_t>()
+                       : 1),
+      analysis_dir(config.find("analysis_dir") != config.end()
+                       ? config["analysis_dir"].get<std::string>()
+                       : boost::optional<std::string>{}),
+      concurrent_files(config.find("concurrent_files") != config.end()
+                           ? config["concurrent_files"].get<size_t>()
+                           : 4),
+      bot_threads(config.find("bot_threads") != config.end()
+                      ? config["bot_threads"].get<size_t>()
+                      : 1),
+      batching{config.find("target_batch_size") != config.end()
+                   ? config["target_batch_size"].get<size_t>()
+                   : 0,
+               std::chrono::milliseconds(config.find("batch_max_wait_ms") != config.end()
+                                             ? config["batch_max_wait_ms"].get<size_t>()
+                                             : 0),
+               std::chrono::milliseconds(
+                   config.find("batch_max_staleness_ms") != config.end()
+                       ? config["batch_max_staleness_ms"].get<size_t>()
+                       : 0)},
+      target_latency_ms(config.find("target_latency_ms") != config.end()
+                            ? config["target_latency_ms"].get<size_t>()
+                            : boost::optional<size_t>{}),
+      message_files_compression(
+          config.find("message_files_compression") != config.end()
+              ? config["message_files_compression"].get<std::string>()
+              : "none"),
+      message_file_max_bytes(config.find("message_file_max_bytes") != config.end()
+                                 ? config["message_file_max_bytes"].get<uint64_t>()
+                                 : 0),
+      frame_trace_sampling(config.find("frame_trace_sampling") != config.end()
+                               ? config["frame_trace_sampling"].get<size_t>()
+                               : 0) {}
 
 int bot_environment::main(int argc, char* argv[]) {
   init_tcmalloc();
   init_logging(argc, argv);
 
   env_configuration config{argc, argv};
+  if (!validate_bot_config(config.bot_config(), _bot_descriptor)) {
+    return 1;
+  }
+  if (config.pool_capacity() == 0) {
+    std::cerr << "--pool-capacity should be positive\n";
+    return 1;
+  }
 
   const bool batch = config.is_batch_mode();
   const std::string id = config.id();
@@ -182,17 +1032,18 @@ int bot_environment::main(int argc, char* argv[]) {
   }
   _metrics_config = config.metrics();
   _pool_mode = config.pool().is_initialized();
+  _pool_capacity = config.pool_capacity();
 
   auto start = [config, this]() {
     if (!_pool_mode) {
-      start_bot(config.bot_config());
+      start_bot(config.bot_config(), nullptr);
     } else {
       std::string pool = config.pool().get();
       // TODO: could use pool-job-type cli option
       std::string job_type = config.id();
 
-      auto job_controller =
-          new pool_job_controller(_io_service, pool, job_type, 1, _rtm_client, *this);
+      auto job_controller = new pool_job_controller(_io_service, pool, job_type,
+                                                    _pool_capacity, _rtm_client, *this);
 
       // Kubernetes sends SIGTERM, and then SIGKILL after 30 seconds
       // https://kubernetes.io/docs/concepts/workloads/pods/pod/#termination-of-pods
@@ -201,6 +1052,11 @@ int bot_environment::main(int argc, char* argv[]) {
             LOG(INFO) << "Got signal #" << signal << ", shutting down job controller";
             job_controller->shutdown();
             delete job_controller;
+            _io_service.post([this]() {
+              for (auto& job : _jobs) {
+                job->stop();
+              }
+            });
 
             _finished = true;
           });
@@ -239,128 +1095,245 @@ int bot_environment::main(int argc, char* argv[]) {
   return 0;
 }
 
-void bot_environment::start_bot(const bot_configuration& config) {
-  _metrics_config.push_job = config.id;
-  init_metrics(_metrics_config, _io_service);
-  expose_metrics(_rtm_client.get());
-
-  const bool batch = config.video_cfg.batch;
-  bot_instance_builder builder =
-      bot_instance_builder{_bot_descriptor}
-          .set_execution_mode(batch ? execution_mode::BATCH : execution_mode::LIVE)
-          .set_bot_id(config.id)
-          .set_config(config.bot_config);
-
-  _bot_instance = builder.build();
-  auto single_frame_source = cli_streams::decoded_publisher(
-      _io_service, _rtm_client, config.video_cfg, _bot_descriptor.pixel_format);
-  if (!batch) {
-    _source = std::move(single_frame_source)
-              >> streams::threaded_worker("processing_worker", config.max_queued_frames);
-  } else {
-    _source =
-        std::move(single_frame_source) >> streams::map([](owned_image_packet&& pkt) {
-          std::queue<owned_image_packet> q;
-          q.push(pkt);
-          return q;
-        });
+void bot_environment::start_bot(const bot_configuration& config,
+                                const nlohmann::json& job) {
+  if (!_metrics_started) {
+    _metrics_started = true;
+    _metrics_config.push_job = config.id;
+    init_metrics(_metrics_config, _io_service);
+    expose_metrics(_rtm_client.get());
+  }
+
+  if (config.batch_shards > 1) {
+    run_sharded_batch(config);
+    return;
+  }
+  if (config.video_cfg.input_manifest) {
+    run_manifest_batch(config);
+    return;
+  }
+
+  if (!_message_writer_pool && (config.analysis_file || config.debug_file)) {
+    _message_writer_pool =
+        std::make_shared<file_writer_pool>(1, std::numeric_limits<uint64_t>::max());
+  }
+
+  // signal_breaker allows a single instance, pool mode stops jobs on signals itself
+  _jobs.push_back(std::make_unique<bot_job>(
+      _bot_descriptor, config, job, _io_service, _rtm_client, _message_writer_pool,
+      !_pool_mode, [this](bot_job* done_job) { on_job_done(done_job); }));
+  _jobs.back()->start();
+}
+
+void bot_environment::on_job_done(bot_job* job) {
+  if (_pool_mode) {
+    // pipeline is still unwinding, so the job is destroyed later
+    _io_service.post([this, job]() {
+      _jobs.remove_if(
+          [job](const std::unique_ptr<bot_job>& j) { return j.get() == job; });
+    });
+    return;
+  }
+
+  _finished = true;
+
+  _io_service.post([]() {
+    LOG(INFO) << "stopping bot metrics";
+    stop_metrics();
+  });
+
+  if (_rtm_client) {
+    _io_service.post([rtm_client = _rtm_client]() {
+      LOG(INFO) << "stopping rtm client";
+      if (auto ec = rtm_client->stop()) {
+        LOG(ERROR) << "error stopping rtm client: " << ec.message();
+      } else {
+        LOG(INFO) << "rtm client was stopped";
+      }
+    });
+  }
+}
+
+void bot_environment::run_sharded_batch(const bot_configuration& config) {
+  namespace fs = boost::filesystem;
+
+  const std::string& filename = config.video_cfg.input_video_file.get();
+  auto index = load_keyframe_index(filename);
+  CHECK(index.ok()) << "failed to build keyframe index of " << filename << ": "
+                    << index.error_condition().message();
+  const std::vector<file_range> segments = index.get().split(config.batch_shards);
+  LOG(INFO) << "processing " << filename << " in " << segments.size() << " segments";
+
+  // instances are configured sequentially, configuration may change global state
+  std::vector<std::unique_ptr<bot_instance>> instances;
+  for (size_t i = 0; i < segments.size(); i++) {
+    instances.push_back(bot_instance_builder{_bot_descriptor}
+                            .set_execution_mode(execution_mode::BATCH)
+                            .set_bot_id(config.id)
+                            .set_config(config.bot_config)
+                            .set_batching_policy(config.batching)
+                            .build());
   }
 
+  avutils::init();
+  const fs::path parts_dir = fs::temp_directory_path() / fs::unique_path();
+  fs::create_directories(parts_dir);
+  auto remove_parts = gsl::finally([&parts_dir]() {
+    boost::system::error_code ec;
+    fs::remove_all(parts_dir, ec);
+  });
+
+  std::vector<std::unique_ptr<segment_output>> outputs;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < segments.size(); i++) {
+    outputs.push_back(
+        std::make_unique<segment_output>(parts_dir / ("segment-" + std::to_string(i))));
+    threads.emplace_back([this, i, &config, &filename, &segments, &instances,
+                          &outputs]() {
+      threadutils::set_current_thread_name("segment-" + std::to_string(i));
+      LOG(INFO) << "starting segment from frame " << *segments[i].start_frame;
+      const cli_streams::input_video_config video_cfg{config.video_cfg, filename,
+                                                      segments[i]};
+      if (!process_file(*instances[i], video_cfg, _bot_descriptor.pixel_format, true,
+                        *outputs[i])) {
+        LOG(ERROR) << "segment from frame " << *segments[i].start_frame << " failed";
+      }
+      outputs[i]->close();
+      LOG(INFO) << "segment from frame " << *segments[i].start_frame << " is done";
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  std::unique_ptr<std::ofstream> analysis_file;
   if (config.analysis_file) {
-    std::string analysis_file = config.analysis_file.get();
-    LOG(INFO) << "saving analysis output to " << analysis_file;
-    _analysis_file = std::make_unique<std::ofstream>(analysis_file.c_str());
-    _analysis_sink = &streams::ostream_sink(*_analysis_file);
-  } else if (_rtm_client) {
-    _analysis_sink =
-        &rtm::sink(_rtm_client, _io_service,
-                   config.video_cfg.input_channel.get() + analysis_channel_suffix);
-  } else {
-    _analysis_sink = &streams::ostream_sink(std::cout);
+    LOG(INFO) << "saving analysis output to " << config.analysis_file.get();
+    analysis_file = std::make_unique<std::ofstream>(config.analysis_file.get());
+  }
+  std::unique_ptr<std::ofstream> debug_file;
+  if (config.debug_file) {
+    LOG(INFO) << "saving debug output to " << config.debug_file.get();
+    debug_file = std::make_unique<std::ofstream>(config.debug_file.get());
   }
 
+  // segments are ordered by frame number, so concatenation keeps frame id order
+  for (const auto& output : outputs) {
+    append_file(output->analysis_path, analysis_file ? *analysis_file : std::cout);
+    append_file(output->debug_path, debug_file ? *debug_file : std::cerr);
+    append_file(output->control_path, std::cout);
+  }
+
+  _finished = true;
+}
+
+void bot_environment::run_manifest_batch(const bot_configuration& config) {
+  const std::vector<std::string> files =
+      cli_streams::read_input_manifest(config.video_cfg.input_manifest.get());
+  const size_t workers_count = std::min(config.concurrent_files, files.size());
+  LOG(INFO) << "processing " << files.size() << " files by " << workers_count
+            << " workers";
+
+  // Bot state doesn't outlive a key frame and every file starts with one,
+  // image size stays the same if it's set explicitly.
+  const bool reuse_instances = _bot_descriptor.state != state_scope::STREAM
+                               && config.video_cfg.resolution != "original";
+
+  std::unique_ptr<std::ofstream> analysis_file;
+  if (config.analysis_file) {
+    LOG(INFO) << "saving analysis output to " << config.analysis_file.get();
+    analysis_file = std::make_unique<std::ofstream>(config.analysis_file.get());
+  }
+  std::unique_ptr<std::ofstream> debug_file;
   if (config.debug_file) {
-    std::string debug_file = config.debug_file.get();
-    LOG(INFO) << "saving debug output to " << debug_file;
-    _debug_file = std::make_unique<std::ofstream>(debug_file.c_str());
-    _debug_sink = &streams::ostream_sink(*_debug_file);
-  } else if (_rtm_client) {
-    _debug_sink = &rtm::sink(_rtm_client, _io_service,
-                             config.video_cfg.input_channel.get() + debug_channel_suffix);
-  } else {
-    _debug_sink = &streams::ostream_sink(std::cerr);
+    LOG(INFO) << "saving debug output to " << config.debug_file.get();
+    debug_file = std::make_unique<std::ofstream>(config.debug_file.get());
+  }
+  if (config.analysis_dir) {
+    boost::filesystem::create_directories(config.analysis_dir.get());
   }
+  tagged_output shared{analysis_file ? *analysis_file : std::cout,
+                       debug_file ? *debug_file : std::cerr, std::cout};
 
-  if (_rtm_client) {
-    _control_sink = &rtm::sink(_rtm_client, _io_service, config.video_cfg.input_channel.get() + control_channel_suffix);
-    _control_source =
-        rtm::channel(_rtm_client, config.video_cfg.input_channel.get() + control_channel_suffix, {})
-        >> streams::map([](rtm::channel_data&& t) { return std::move(t.payload); });
-  } else {
-    _control_sink = &streams::ostream_sink(std::cout);
-    _control_source = streams::publishers::empty<nlohmann::json>();
-  }
-
-  _finished = false;
-  _multiframes_counter = 0;
-
-  _source = std::move(_source) >> streams::signal_breaker({SIGINT, SIGTERM, SIGQUIT})
-            >> streams::map([& multiframes_counter = _multiframes_counter](
-                                std::queue<owned_image_packet>&& pkt) mutable {
-                multiframes_counter++;
-                constexpr int period = 100;
-                if ((multiframes_counter % period) == 0) {
-                  LOG(INFO) << "Processed " << multiframes_counter << " multiframes";
-                }
-                return pkt;
-              })
-            >> streams::do_finally([this]() {
-                _finished = true;
-
-                _io_service.post([this]() {
-                  LOG(INFO) << "stopping bot metrics";
-                  stop_metrics();
-                });
-
-                if (!_pool_mode && _rtm_client) {
-                  _io_service.post([rtm_client = _rtm_client]() {
-                    LOG(INFO) << "stopping rtm client";
-                    if (auto ec = rtm_client->stop()) {
-                      LOG(ERROR) << "error stopping rtm client: " << ec.message();
-                    } else {
-                      LOG(INFO) << "rtm client was stopped";
-                    }
-                  });
-                }
-              });
+  // configuration may change global state
+  std::mutex build_mutex;
+  auto build_instance = [this, &config, &build_mutex]() {
+    std::lock_guard<std::mutex> lock(build_mutex);
+    return bot_instance_builder{_bot_descriptor}
+        .set_execution_mode(execution_mode::BATCH)
+        .set_bot_id(config.id)
+        .set_config(config.bot_config)
+        .set_batching_policy(config.batching)
+        .build();
+  };
 
-  auto bot_input_stream = streams::publishers::merge<bot_input>(
-      std::move(_control_source)
-          >> streams::map([](nlohmann::json&& t) { return bot_input{t}; }),
-      std::move(_source) >> streams::map([](std::queue<owned_image_packet>&& p) {
-        return bot_input{p};
-      }));
+  avutils::init();
+  std::atomic<size_t> next_file{0};
+  std::atomic<size_t> failed_files{0};
+  std::vector<std::thread> threads;
+  for (size_t w = 0; w < workers_count; w++) {
+    threads.emplace_back([this, w, reuse_instances, &config, &files, &shared,
+                          &build_instance, &next_file, &failed_files]() {
+      threadutils::set_current_thread_name("file-worker-" + std::to_string(w));
+      std::unique_ptr<bot_instance> instance;
+      for (size_t i = next_file++; i < files.size(); i = next_file++) {
+        if (!instance || !reuse_instances) {
+          instance = build_instance();
+        }
+
+        LOG(INFO) << "processing " << files[i];
+        file_output output{files[i], shared, config.analysis_dir};
+        const cli_streams::input_video_config video_cfg{config.video_cfg, files[i],
+                                                        file_range{}};
+        if (!process_file(*instance, video_cfg, _bot_descriptor.pixel_format,
+                          !reuse_instances, output)) {
+          LOG(ERROR) << "failed to process " << files[i];
+          failed_files++;
+        }
+      }
 
-  auto bot_output_stream = std::move(bot_input_stream) >> _bot_instance->run_bot();
+      if (instance && reuse_instances) {
+        file_output output{"", shared, boost::none};
+        shutdown_bot(*instance, output);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
 
-  bot_output_stream->process([this](bot_output&& o) { boost::apply_visitor(*this, o); });
+  LOG(INFO) << "processed " << files.size() << " files, " << failed_files << " failed";
+  _finished = true;
 }
 
 void bot_environment::add_job(const nlohmann::json& job) {
-  CHECK(_job.is_null()) << "Can't subscribe to more than one channel";
-  _job = job;
-  start_bot(bot_configuration{_job});
+  CHECK_LT(list_jobs().size(), _pool_capacity)
+      << "Can't process more than " << _pool_capacity << " jobs";
+  const bot_configuration config{job};
+  if (!validate_bot_config(config, _bot_descriptor) || !validate_pool_job(config)) {
+    LOG(ERROR) << "rejecting job with invalid options: " << job;
+    return;
+  }
+  LOG(INFO) << "starting job " << job;
+  start_bot(config, job);
 }
 
 void bot_environment::remove_job(const nlohmann::json& job) {
-  LOG(ERROR) << "Requested remove for the following job: " << job;
-  ABORT() << "Removing jobs is not supported";
+  for (auto& j : _jobs) {
+    if (!j->stopped() && j->job() == job) {
+      j->stop();
+      return;
+    }
+  }
+  LOG(WARNING) << "Requested remove for unknown job: " << job;
 }
 
 nlohmann::json bot_environment::list_jobs() const {
   nlohmann::json jobs = nlohmann::json::array();
-  if (!_job.is_null()) {
-    jobs.emplace_back(_job);
+  for (const auto& j : _jobs) {
+    if (!j->stopped()) {
+      jobs.emplace_back(j->job());
+    }
   }
   return jobs;
 }
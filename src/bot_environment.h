@@ -1,11 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <json.hpp>
 #include <list>
 #include <memory>
 
 #include "cli_streams.h"
 #include "data.h"
+#include "json_file_sink.h"
 #include "metrics.h"
 #include "pool_controller.h"
 #include "rtm_client.h"
@@ -22,6 +24,8 @@ struct bot_message {
   nlohmann::json data;
   bot_message_kind kind;
   frame_id id;
+  // trace of the frame the message is about
+  frame_trace trace;
 };
 
 namespace po = boost::program_options;
@@ -36,11 +40,23 @@ struct bot_configuration {
   const cli_streams::input_video_config video_cfg;
   const nlohmann::json bot_config;
   const boost::optional<size_t> max_queued_frames;
+  const size_t batch_shards;
+  const boost::optional<std::string> analysis_dir;
+  const size_t concurrent_files;
+  const size_t bot_threads;
+  const batching_policy batching;
+  const boost::optional<size_t> target_latency_ms;
+  const std::string message_files_compression;
+  const uint64_t message_file_max_bytes;
+  const size_t frame_trace_sampling;
 };
 
-class bot_environment : public job_controller,
-                        private rtm::error_callbacks,
-                        boost::static_visitor<void> {
+class bot_job;
+
+// Hosts bot jobs. Outside of pool mode there is a single job built from command
+// line, in pool mode there are up to --pool-capacity jobs, each with its own bot
+// instance and pipeline. Jobs share RTM client and io_service.
+class bot_environment : public job_controller, private rtm::error_callbacks {
  public:
   static bot_environment& instance();
 
@@ -49,38 +65,30 @@ class bot_environment : public job_controller,
 
   rtm::publisher& publisher() { return *_rtm_client; }
 
-  void operator()(const owned_image_metadata& metadata);
-  void operator()(const owned_image_frame& frame);
-  void operator()(struct bot_message& msg);
-
   void add_job(const nlohmann::json& job) override;
   void remove_job(const nlohmann::json& job) override;
   nlohmann::json list_jobs() const override;
 
  private:
-  void start_bot(const bot_configuration& config);
+  void start_bot(const bot_configuration& config, const nlohmann::json& job);
+  void on_job_done(bot_job* job);
+  void run_sharded_batch(const bot_configuration& config);
+  void run_manifest_batch(const bot_configuration& config);
   void on_error(std::error_condition ec) override;
 
-  bool _finished;
-  uint64_t _multiframes_counter{0};
-  nlohmann::json _job;
+  std::atomic<bool> _finished{false};
+  bool _metrics_started{false};
   metrics_config _metrics_config;
   boost::asio::io_service _io_service;
   multiframe_bot_descriptor _bot_descriptor;
-  std::unique_ptr<bot_instance> _bot_instance;
   std::shared_ptr<rtm::client> _rtm_client;
+  // writes analysis and debug files of all jobs
+  std::shared_ptr<file_writer_pool> _message_writer_pool;
   bool _pool_mode{false};
+  size_t _pool_capacity{1};
 
-  streams::observer<nlohmann::json>* _analysis_sink;
-  streams::observer<nlohmann::json>* _debug_sink;
-  streams::observer<nlohmann::json>* _control_sink;
-
-  std::unique_ptr<std::ofstream> _analysis_file;
-  std::unique_ptr<std::ofstream> _debug_file;
-
-  // TODO: maybe make them local variables?
-  streams::publisher<std::queue<owned_image_packet>> _source;
-  streams::publisher<nlohmann::json> _control_source;
+  // accessed from io_service thread only
+  std::list<std::unique_ptr<bot_job>> _jobs;
 };
 
 }  // namespace video
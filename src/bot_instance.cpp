@@ -1,9 +1,16 @@
 #include "bot_instance.h"
 
+#include <condition_variable>
+#include <deque>
+#include <future>
 #include <gsl/gsl>
+#include <mutex>
+#include <thread>
 
+#include "frame_trace.h"
 #include "metrics.h"
 #include "stopwatch.h"
+#include "threadutils.h"
 
 namespace satori {
 namespace video {
@@ -45,12 +52,162 @@ nlohmann::json build_shutdown_command() {
   return cmd;
 }
 
+void send_outputs(std::list<bot_output>* outputs, streams::observer<bot_output>& sink) {
+  if (outputs->empty()) {
+    sink.on_complete();
+    return;
+  }
+
+  bot_output output = std::move(outputs->front());
+  outputs->pop_front();
+  sink.on_next(std::move(output));
+}
+
+// Runs tasks one by one on its own thread.
+class bot_worker {
+ public:
+  explicit bot_worker(size_t number) : _thread([this, number]() { run(number); }) {}
+
+  ~bot_worker() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopped = true;
+    }
+    _cv.notify_one();
+    _thread.join();
+  }
+
+  template <typename Fn>
+  std::future<std::list<bot_output>> submit(Fn&& fn) {
+    std::packaged_task<std::list<bot_output>()> task(std::forward<Fn>(fn));
+    auto result = task.get_future();
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _tasks.push_back(std::move(task));
+    }
+    _cv.notify_one();
+    return result;
+  }
+
+ private:
+  void run(size_t number) {
+    threadutils::set_current_thread_name("bot-worker-" + std::to_string(number));
+    while (true) {
+      std::packaged_task<std::list<bot_output>()> task;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this]() { return _stopped || !_tasks.empty(); });
+        if (_tasks.empty()) {
+          return;
+        }
+        task = std::move(_tasks.front());
+        _tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<std::packaged_task<std::list<bot_output>()>> _tasks;
+  bool _stopped{false};
+  // started last, uses members above
+  std::thread _thread;
+};
+
+// Frame batches are handed out to instances round-robin, at most one batch per
+// instance is in flight, outputs are collected in input order.
+class parallel_bots : public boost::static_visitor<std::list<bot_output>> {
+ public:
+  explicit parallel_bots(const std::vector<bot_instance*>& instances)
+      : _instances(instances) {
+    for (size_t i = 0; i < _instances.size(); i++) {
+      _workers.push_back(std::make_unique<bot_worker>(i));
+    }
+  }
+
+  std::list<bot_output> process(bot_input&& input) {
+    return boost::apply_visitor(*this, input);
+  }
+
+  std::list<bot_output> operator()(owned_image_packets& packets) {
+    // outputs are passed on as soon as possible, not only when all workers are busy
+    std::list<bot_output> result = take_ready();
+    if (_pending.size() == _workers.size()) {
+      result.splice(result.end(), wait_oldest());
+    }
+
+    bot_instance* instance = _instances[_next];
+    _pending.push_back(
+        _workers[_next]->submit([instance, packets = std::move(packets)]() mutable {
+          return (*instance)(packets);
+        }));
+    _next = (_next + 1) % _workers.size();
+    return result;
+  }
+
+  std::list<bot_output> operator()(nlohmann::json& msg) {
+    std::list<bot_output> result = wait_all();
+    // workers are idle, so instances are safe to use from this thread
+    for (size_t i = 0; i < _instances.size(); i++) {
+      nlohmann::json copy = msg;
+      std::list<bot_output> responses = (*_instances[i])(copy);
+      if (i == 0) {
+        result.splice(result.end(), responses);
+      }
+    }
+    return result;
+  }
+
+  std::list<bot_output> finish(bool shutdown) {
+    std::list<bot_output> result = wait_all();
+    if (shutdown) {
+      for (bot_instance* instance : _instances) {
+        result.splice(result.end(), instance->shutdown());
+      }
+    }
+    return result;
+  }
+
+ private:
+  std::list<bot_output> wait_oldest() {
+    std::list<bot_output> result = _pending.front().get();
+    _pending.pop_front();
+    return result;
+  }
+
+  std::list<bot_output> take_ready() {
+    std::list<bot_output> result;
+    while (!_pending.empty()
+           && _pending.front().wait_for(std::chrono::seconds(0))
+                  == std::future_status::ready) {
+      result.splice(result.end(), wait_oldest());
+    }
+    return result;
+  }
+
+  std::list<bot_output> wait_all() {
+    std::list<bot_output> result;
+    while (!_pending.empty()) {
+      result.splice(result.end(), wait_oldest());
+    }
+    return result;
+  }
+
+  const std::vector<bot_instance*> _instances;
+  std::vector<std::unique_ptr<bot_worker>> _workers;
+  std::deque<std::future<std::list<bot_output>>> _pending;
+  size_t _next{0};
+};
+
 }  // namespace
 
 bot_instance::bot_instance(const std::string& bot_id, const execution_mode execmode,
-                           const multiframe_bot_descriptor& descriptor)
+                           const multiframe_bot_descriptor& descriptor,
+                           const batching_policy& batching)
     : _bot_id(bot_id),
       _descriptor(descriptor),
+      _batching(batching),
       bot_context{nullptr,
                   &_image_metadata,
                   execmode,
@@ -71,52 +228,68 @@ bot_instance::bot_instance(const std::string& bot_id, const execution_mode execm
                                std::vector<double>{0,  1,   2,   5,   10,  15,  20,
                                                    25, 30,  40,  50,  60,  70,  80,
                                                    90, 100, 200, 300, 400, 500, 750}),
-                  }} {}
+                  },
+                  &_batching} {}
 
-streams::op<bot_input, bot_output> bot_instance::run_bot() {
-  return [this](streams::publisher<bot_input>&& src) {
+streams::op<bot_input, bot_output> bot_instance::run_bot(bool shutdown) {
+  return [this, shutdown](streams::publisher<bot_input>&& src) {
     auto main_stream =
         std::move(src)
         >> streams::map([this](bot_input&& p) { return boost::apply_visitor(*this, p); })
         >> streams::flatten();
+    if (!shutdown) {
+      return main_stream;
+    }
 
     // TODO: maybe initial config and shutdown message should be sent from the same place?
     auto shutdown_stream = streams::generators<bot_output>::stateful(
-        [this]() {
-          LOG(INFO) << "shutting down bot";
-          if (_descriptor.ctrl_callback) {
-            nlohmann::json cmd = build_shutdown_command();
-            nlohmann::json response = _descriptor.ctrl_callback(*this, std::move(cmd));
-            if (!response.is_null()) {
-              LOG(INFO) << "got shutdown response: " << response;
-              queue_message(bot_message_kind::DEBUG, std::move(response), frame_id{0, 0});
-            } else {
-              LOG(INFO) << "shutdown response is null";
-            }
-          }
-
-          prepare_message_buffer_for_downstream();
-
-          return nullptr;
-        },
-        [this](void*, streams::observer<bot_output>& sink) {
-          if (_message_buffer.empty()) {
-            sink.on_complete();
-            return;
-          }
-
-          LOG(INFO) << "sending shutdown";
-          struct bot_message msg = std::move(_message_buffer.front());
-          _message_buffer.pop_front();
-
-          sink.on_next(std::move(msg));
-        });
+        [this]() { return new std::list<bot_output>(shutdown()); }, &send_outputs);
 
     return streams::publishers::concat(std::move(main_stream),
                                        std::move(shutdown_stream));
   };
 }
 
+std::list<bot_output> bot_instance::shutdown() {
+  LOG(INFO) << "shutting down bot";
+  if (_descriptor.ctrl_callback) {
+    nlohmann::json cmd = build_shutdown_command();
+    nlohmann::json response = _descriptor.ctrl_callback(*this, std::move(cmd));
+    if (!response.is_null()) {
+      LOG(INFO) << "got shutdown response: " << response;
+      queue_message(bot_message_kind::DEBUG, std::move(response), frame_id{0, 0});
+    } else {
+      LOG(INFO) << "shutdown response is null";
+    }
+  }
+
+  prepare_message_buffer_for_downstream();
+
+  std::list<bot_output> result{_message_buffer.begin(), _message_buffer.end()};
+  _message_buffer.clear();
+  return result;
+}
+
+streams::op<bot_input, bot_output> run_parallel_bots(
+    const std::vector<bot_instance*>& instances, bool shutdown) {
+  CHECK(!instances.empty());
+  return [instances, shutdown](streams::publisher<bot_input>&& src) {
+    auto bots = std::make_shared<parallel_bots>(instances);
+    auto main_stream = std::move(src) >> streams::map([bots](bot_input&& p) {
+                         return bots->process(std::move(p));
+                       })
+                       >> streams::flatten();
+
+    // created when main stream completes
+    auto remaining_stream = streams::generators<bot_output>::stateful(
+        [bots, shutdown]() { return new std::list<bot_output>(bots->finish(shutdown)); },
+        &send_outputs);
+
+    return streams::publishers::concat(std::move(main_stream),
+                                       std::move(remaining_stream));
+  };
+}
+
 void bot_instance::queue_message(const bot_message_kind kind, nlohmann::json&& message,
                                  const frame_id& id) {
   CHECK(message.is_object()) << "message is not an object: " << message;
@@ -170,6 +343,26 @@ std::vector<image_frame> bot_instance::extract_frames(
   return result;
 }
 
+void bot_instance::trace_frames(std::list<bot_output>& packets,
+                                std::chrono::steady_clock::time_point callback_start,
+                                std::chrono::steady_clock::time_point callback_end) {
+  for (auto& p : packets) {
+    auto* frame = boost::get<owned_image_frame>(&p);
+    if (frame == nullptr) {
+      continue;
+    }
+
+    frame->trace.callback_start = callback_start;
+    frame->trace.callback_end = callback_end;
+    observe_frame_stages(frame->trace);
+    for (auto& msg : _message_buffer) {
+      if (msg.id == frame->id) {
+        msg.trace = frame->trace;
+      }
+    }
+  }
+}
+
 std::list<bot_output> bot_instance::operator()(std::queue<owned_image_packet>& pp) {
   stopwatch<> s;
   std::list<bot_output> result;
@@ -187,9 +380,12 @@ std::list<bot_output> bot_instance::operator()(std::queue<owned_image_packet>& p
     LOG(1) << "process " << bframes.size() << " frames " << _image_metadata.width << "x"
            << _image_metadata.height;
 
+    const auto callback_start = std::chrono::steady_clock::now();
     _descriptor.img_callback(*this, gsl::span<image_frame>(bframes));
+    const auto callback_end = std::chrono::steady_clock::now();
     frame_batch_processed_total.Increment();
 
+    trace_frames(result, callback_start, callback_end);
     prepare_message_buffer_for_downstream();
 
     std::copy(_message_buffer.begin(), _message_buffer.end(), std::back_inserter(result));
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <chrono>
 #include <json.hpp>
 #include <list>
 #include <queue>
+#include <vector>
 
 #include "bot_environment.h"
 #include "data.h"
@@ -20,15 +22,24 @@ using bot_input = boost::variant<owned_image_packets, nlohmann::json>;
 using bot_output =
     variantutils::extend_variant<owned_image_packet, struct bot_message>::type;
 
+// Which frames of a batch are passed to single frame bot callback.
+enum class frame_drop_strategy { AS_NEEDED = 1, NEVER = 2 };
+
 class bot_instance : public bot_context, boost::static_visitor<std::list<bot_output>> {
  public:
   bot_instance(const std::string& bot_id, execution_mode execmode,
-               const multiframe_bot_descriptor& descriptor);
+               const multiframe_bot_descriptor& descriptor,
+               const batching_policy& batching = batching_policy{});
   ~bot_instance() = default;
 
   void configure(const nlohmann::json& config);
 
-  streams::op<bot_input, bot_output> run_bot();
+  // If shutdown is false, the bot is not shut down when input completes,
+  // so the instance can process another input.
+  streams::op<bot_input, bot_output> run_bot(bool shutdown = true);
+
+  // Sends shutdown command to the bot, returns remaining messages.
+  std::list<bot_output> shutdown();
 
   void queue_message(bot_message_kind kind, nlohmann::json&& message, const frame_id& id);
   void set_current_frame_id(const frame_id& id);
@@ -36,17 +47,33 @@ class bot_instance : public bot_context, boost::static_visitor<std::list<bot_out
   std::list<bot_output> operator()(std::queue<owned_image_packet>& pp);
   std::list<bot_output> operator()(nlohmann::json& msg);
 
+  // Set by "configure" control messages, every instance has its own,
+  // so jobs running in one process don't affect each other.
+  frame_drop_strategy drop_strategy{frame_drop_strategy::AS_NEEDED};
+
  private:
   void prepare_message_buffer_for_downstream();
   std::vector<image_frame> extract_frames(const std::list<bot_output>& packets);
+  // Completes traces of frames and copies them to messages about these frames.
+  void trace_frames(std::list<bot_output>& packets,
+                    std::chrono::steady_clock::time_point callback_start,
+                    std::chrono::steady_clock::time_point callback_end);
 
   const std::string _bot_id;
   const multiframe_bot_descriptor _descriptor;
+  const batching_policy _batching;
 
   std::list<struct bot_message> _message_buffer;
   image_metadata _image_metadata{0, 0};
   frame_id _current_frame_id;
 };
 
+// Same as bot_instance::run_bot(), but frame batches are processed concurrently,
+// each instance on its own thread, and outputs keep input order. Control messages
+// wait for preceding batches and go to every instance, only responses of the first
+// one are passed on. Bot should have FRAME state scope.
+streams::op<bot_input, bot_output> run_parallel_bots(
+    const std::vector<bot_instance*>& instances, bool shutdown = true);
+
 }  // namespace video
 }  // namespace satori
@@ -20,8 +20,14 @@ bot_instance_builder &bot_instance_builder::set_bot_id(std::string id) {
   return *this;
 }
 
+bot_instance_builder &bot_instance_builder::set_batching_policy(
+    const batching_policy &batching) {
+  _batching = batching;
+  return *this;
+}
+
 std::unique_ptr<bot_instance> bot_instance_builder::build() {
-  auto instance = std::make_unique<bot_instance>(_id, _mode, _descriptor);
+  auto instance = std::make_unique<bot_instance>(_id, _mode, _descriptor, _batching);
   instance->configure(_config);
   return instance;
 }
@@ -13,6 +13,7 @@ struct bot_instance_builder {
   bot_instance_builder &set_execution_mode(execution_mode mode);
   bot_instance_builder &set_config(const nlohmann::json &config);
   bot_instance_builder &set_bot_id(std::string id);
+  bot_instance_builder &set_batching_policy(const batching_policy &batching);
   std::unique_ptr<bot_instance> build();
 
  private:
@@ -20,6 +21,7 @@ struct bot_instance_builder {
   execution_mode _mode;
   std::string _id;
   nlohmann::json _config;
+  batching_policy _batching;
 };
 }  // namespace video
 }  // namespace satori
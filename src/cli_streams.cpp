@@ -1,6 +1,10 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
 #include <iostream>
 
 #include "avutils.h"
+#include "binary_replay.h"
 #include "cli_streams.h"
 #include "streams/asio_streams.h"
 #include "streams/threaded_worker.h"
@@ -28,13 +32,49 @@ po::options_description file_input_options(bool enable_batch_mode) {
   file_sources.add_options()("input-video-file", po::value<std::string>(),
                              "input mp4,mkv,webm");
   file_sources.add_options()("input-replay-file", po::value<std::string>(), "input txt");
+  file_sources.add_options()(
+      "input-playlist", po::value<std::string>(),
+      "file listing input video files one per line, or a directory of video files, "
+      "played one after another as a single video");
   file_sources.add_options()("loop", "Is file looped");
+  file_sources.add_options()(
+      "start-time", po::value<double>(),
+      "(seconds) start reading --input-video-file or binary --input-replay-file from "
+      "given time, inclusive");
+  file_sources.add_options()(
+      "end-time", po::value<double>(),
+      "(seconds) stop reading --input-video-file or binary --input-replay-file at given "
+      "time, exclusive");
+  file_sources.add_options()(
+      "start-frame", po::value<uint64_t>(),
+      "(number) start reading --input-video-file or binary --input-replay-file from "
+      "given frame, counted from zero");
+  file_sources.add_options()(
+      "end-frame", po::value<uint64_t>(),
+      "(number) stop reading --input-video-file or binary --input-replay-file at given "
+      "frame, exclusive");
+  file_sources.add_options()(
+      "io-buffer-size", po::value<size_t>(),
+      "(bytes) size of --input-video-file read buffer, FFmpeg default if not set");
+  file_sources.add_options()("mmap-input",
+                             "read --input-video-file through memory mapping");
 
   if (enable_batch_mode) {
     file_sources.add_options()(
         "batch",
         "turns on batch analysis mode, where analysis of a single video frame might take "
         "longer than frame duration (file source only).");
+    file_sources.add_options()(
+        "prefetch-packets", po::value<size_t>(),
+        "(batch mode) number of packets read ahead of decoder on a separate thread, "
+        "0 disables read-ahead (default 100)");
+    file_sources.add_options()(
+        "prefetch-bytes", po::value<size_t>(),
+        "(batch mode) limits total size of packets read ahead (default 16MiB)");
+    file_sources.add_options()(
+        "input-manifest", po::value<std::string>(),
+        "(batch mode) file listing input video files one per line, or a directory "
+        "of video files");
   }
 
   return file_sources;
@@ -60,6 +100,9 @@ po::options_description generic_input_options() {
   options.add_options()("keep-proportions", po::value<bool>()->default_value(true),
                         "(bool) tells if original video stream resolution's proportion "
                         "should remain unchanged");
+  options.add_options()("low-latency",
+                        "decode live video with minimal delay, frames are not held "
+                        "for reordering");
 
   return options;
 }
@@ -95,9 +138,28 @@ po::options_description file_output_options() {
       "Typically 50000 is enough for one hour of video. "
       "For Matroska, if not specified (e.g. set to zero), "
       "cues will be written at the end of the file.");
+  output_file_options.add_options()(
+      "fragmented-output",
+      "(mp4) Writes a fragment per key frame, so files are playable while "
+      "they are written and are closed without rewriting the index");
   output_file_options.add_options()("segment-duration", po::value<int>(),
                                     "(seconds) Nearly fixed duration of output video "
                                     "file segments");
+  output_file_options.add_options()("segment-frames", po::value<uint64_t>(),
+                                    "(number) Nearly fixed number of frames in output "
+                                    "video file segments");
+  output_file_options.add_options()("segment-size", po::value<uint64_t>(),
+                                    "(bytes) Nearly fixed size of output video file "
+                                    "segments");
+  output_file_options.add_options()(
+      "write-queue-size", po::value<int>()->default_value(default_write_queue_size),
+      "(frames) Maximum number of frames waiting to be written to the file, "
+      "input is paused when the queue is full");
+  output_file_options.add_options()(
+      "file-sync", po::value<std::string>()->default_value("none"),
+      "(none|flush|fsync) none lets OS decide when data reaches the disk, "
+      "flush hands data over to OS after every batch of frames, "
+      "fsync also syncs every file to disk when it is closed");
 
   return output_file_options;
 }
@@ -121,7 +183,8 @@ bool check_rtm_args_provided(const po::variables_map &vm) {
 }
 
 bool check_file_input_args_provided(const po::variables_map &vm) {
-  return vm.count("input-video-file") > 0 || vm.count("input-replay-file") > 0;
+  return vm.count("input-video-file") > 0 || vm.count("input-replay-file") > 0
+         || vm.count("input-manifest") > 0 || vm.count("input-playlist") > 0;
 }
 
 bool check_camera_input_args_provided(const po::variables_map &vm) {
@@ -165,15 +228,157 @@ bool validate_rtm_args(const cli_options &opts, const po::variables_map &vm) {
   return true;
 }
 
+boost::optional<file_sync_policy> parse_file_sync_policy(const std::string &str) {
+  if (str == "none") {
+    return file_sync_policy::NONE;
+  }
+  if (str == "flush") {
+    return file_sync_policy::FLUSH;
+  }
+  if (str == "fsync") {
+    return file_sync_policy::FSYNC;
+  }
+  return {};
+}
+
+bool validate_output_file_args(const po::variables_map &vm) {
+  if (!parse_file_sync_policy(vm["file-sync"].as<std::string>())) {
+    std::cerr << "Unknown --file-sync value: " << vm["file-sync"].as<std::string>()
+              << "\n";
+    return false;
+  }
+  if (vm["write-queue-size"].as<int>() <= 0) {
+    std::cerr << "--write-queue-size should be positive\n";
+    return false;
+  }
+  if (vm.count("fragmented-output") > 0 && vm.count("output-video-file") > 0) {
+    const auto extension =
+        boost::filesystem::path{vm["output-video-file"].as<std::string>()}.extension();
+    if (!extension.empty() && extension != ".mp4" && extension != ".mov") {
+      std::cerr << "--fragmented-output requires .mp4 or .mov --output-video-file\n";
+      return false;
+    }
+  }
+
+  return true;
+}
+
 bool validate_input_file_args(const po::variables_map &vm) {
   if (vm.count("input-video-file") > 0 && vm.count("input-replay-file") > 9) {
     std::cerr << "--input-video-file and --input-replay-file are mutually exclusive\n";
     return false;
   }
 
+  if (vm.count("input-manifest") > 0
+      && (vm.count("input-video-file") > 0 || vm.count("input-replay-file") > 0)) {
+    std::cerr << "--input-manifest, --input-video-file and --input-replay-file are "
+                 "mutually exclusive\n";
+    return false;
+  }
+  if (vm.count("input-playlist") > 0
+      && (vm.count("input-video-file") > 0 || vm.count("input-replay-file") > 0
+          || vm.count("input-manifest") > 0)) {
+    std::cerr << "--input-playlist, --input-manifest, --input-video-file and "
+                 "--input-replay-file are mutually exclusive\n";
+    return false;
+  }
+  if (vm.count("input-manifest") > 0 && vm.count("batch") == 0) {
+    std::cerr << "--input-manifest requires --batch\n";
+    return false;
+  }
+
+  const bool has_time_range = vm.count("start-time") > 0 || vm.count("end-time") > 0;
+  const bool has_frame_range = vm.count("start-frame") > 0 || vm.count("end-frame") > 0;
+  if ((has_time_range || has_frame_range) && vm.count("input-video-file") == 0
+      && (vm.count("input-replay-file") == 0
+          || !is_binary_replay(vm["input-replay-file"].as<std::string>()))) {
+    std::cerr << "File range is supported only for --input-video-file and binary "
+                 "--input-replay-file\n";
+    return false;
+  }
+  if (has_time_range && has_frame_range) {
+    std::cerr << "Time range and frame range are mutually exclusive\n";
+    return false;
+  }
+  if ((vm.count("start-time") > 0 && vm["start-time"].as<double>() < 0)
+      || (vm.count("end-time") > 0 && vm["end-time"].as<double>() < 0)) {
+    std::cerr << "--start-time and --end-time should not be negative\n";
+    return false;
+  }
+  if (vm.count("start-time") > 0 && vm.count("end-time") > 0
+      && vm["start-time"].as<double>() >= vm["end-time"].as<double>()) {
+    std::cerr << "--start-time should be less than --end-time\n";
+    return false;
+  }
+  if (vm.count("start-frame") > 0 && vm.count("end-frame") > 0
+      && vm["start-frame"].as<uint64_t>() >= vm["end-frame"].as<uint64_t>()) {
+    std::cerr << "--start-frame should be less than --end-frame\n";
+    return false;
+  }
+
   return true;
 }
 
+boost::optional<std::chrono::milliseconds> to_milliseconds(
+    const boost::optional<double> &seconds) {
+  if (!seconds) {
+    return {};
+  }
+  return std::chrono::milliseconds{std::llround(*seconds * 1000)};
+}
+
+template <typename T>
+boost::optional<T> optional_value(const po::variables_map &vm, const std::string &name) {
+  return vm.count(name) > 0 ? vm[name].as<T>() : boost::optional<T>{};
+}
+
+template <typename T>
+boost::optional<T> optional_value(const nlohmann::json &config, const std::string &name) {
+  return config.find(name) != config.end() ? config[name].get<T>() : boost::optional<T>{};
+}
+
+file_read_options parse_file_read_options(const po::variables_map &vm) {
+  file_read_options options;
+  options.prefetch_packets =
+      optional_value<size_t>(vm, "prefetch-packets").value_or(options.prefetch_packets);
+  options.prefetch_bytes =
+      optional_value<size_t>(vm, "prefetch-bytes").value_or(options.prefetch_bytes);
+  options.io_buffer_size =
+      optional_value<size_t>(vm, "io-buffer-size").value_or(options.io_buffer_size);
+  options.mmap = vm.count("mmap-input") > 0;
+  return options;
+}
+
+file_read_options parse_file_read_options(const nlohmann::json &config) {
+  file_read_options options;
+  options.prefetch_packets = optional_value<size_t>(config, "prefetch_packets")
+                                 .value_or(options.prefetch_packets);
+  options.prefetch_bytes =
+      optional_value<size_t>(config, "prefetch_bytes").value_or(options.prefetch_bytes);
+  options.io_buffer_size =
+      optional_value<size_t>(config, "io_buffer_size").value_or(options.io_buffer_size);
+  options.mmap = config.find("mmap_input") != config.end();
+  return options;
+}
+
+file_range parse_file_range(const po::variables_map &vm) {
+  file_range range;
+  range.start_time = to_milliseconds(optional_value<double>(vm, "start-time"));
+  range.end_time = to_milliseconds(optional_value<double>(vm, "end-time"));
+  range.start_frame = optional_value<uint64_t>(vm, "start-frame");
+  range.end_frame = optional_value<uint64_t>(vm, "end-frame");
+  return range;
+}
+
+file_range parse_file_range(const nlohmann::json &config) {
+  file_range range;
+  range.start_time = to_milliseconds(optional_value<double>(config, "start_time"));
+  range.end_time = to_milliseconds(optional_value<double>(config, "end_time"));
+  range.start_frame = optional_value<uint64_t>(config, "start_frame");
+  range.end_frame = optional_value<uint64_t>(config, "end_frame");
+  return range;
+}
+
 po::options_description to_boost(const cli_options &opts) {
   po::options_description options;
 
@@ -213,10 +418,43 @@ po::options_description to_boost(const cli_options &opts) {
 }
 }  // namespace
 
+std::vector<std::string> read_input_manifest(const std::string &manifest) {
+  namespace fs = boost::filesystem;
+
+  std::vector<std::string> result;
+  if (fs::is_directory(manifest)) {
+    for (const fs::directory_entry &entry : fs::directory_iterator(manifest)) {
+      const std::string name = entry.path().filename().string();
+      if (!fs::is_regular_file(entry.status()) || name.front() == '.'
+          || entry.path().extension() == ".keyframes") {
+        continue;
+      }
+      result.push_back(entry.path().string());
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  std::ifstream input(manifest);
+  CHECK(input) << "unable to open manifest " << manifest;
+  const fs::path base = fs::path(manifest).parent_path();
+  std::string line;
+  while (std::getline(input, line)) {
+    line.erase(line.find_last_not_of(" \t\r") + 1);
+    if (line.empty() || line.front() == '#') {
+      continue;
+    }
+    const fs::path path{line};
+    result.push_back(path.is_absolute() ? line : (base / path).string());
+  }
+  return result;
+}
+
 // TODO: add --time-limit here
 streams::publisher<encoded_packet> encoded_publisher(
     boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client,
-    const input_video_config &video_cfg) {
+    const input_video_config &video_cfg,
+    const std::shared_ptr<rate_controller> &rate_controller) {
   if (video_cfg.input_channel) {
     return rtm_source(client, video_cfg.input_channel.get())
            >> report_video_metrics(video_cfg.input_channel.get())
@@ -225,15 +463,26 @@ streams::publisher<encoded_packet> encoded_publisher(
            >> streams::flatten();
   }
 
-  if (video_cfg.input_video_file || video_cfg.input_replay_file) {
+  if (video_cfg.input_video_file || video_cfg.input_replay_file
+      || video_cfg.input_playlist) {
     streams::publisher<encoded_packet> source;
-    if (video_cfg.input_video_file) {
+    if (video_cfg.input_playlist) {
+      source = playlist_source(io, read_input_manifest(video_cfg.input_playlist.get()),
+                               video_cfg.loop, video_cfg.batch, video_cfg.read_options);
+    } else if (video_cfg.input_video_file) {
       source = file_source(io, video_cfg.input_video_file.get(), video_cfg.loop,
-                           video_cfg.batch);
+                           video_cfg.batch, video_cfg.range, video_cfg.read_options);
     } else {
       auto replay_file = video_cfg.input_replay_file.get();
-      source = network_replay_source(io, replay_file, video_cfg.batch)
-               >> report_video_metrics(replay_file) >> decode_network_stream();
+      if (is_binary_replay(replay_file)) {
+        source = binary_replay_source(io, replay_file, video_cfg.batch, video_cfg.range);
+      } else {
+        if (!video_cfg.range.empty()) {
+          LOG(WARNING) << "file range is ignored for JSON-lines replay " << replay_file;
+        }
+        source = network_replay_source(io, replay_file, video_cfg.batch)
+                 >> report_video_metrics(replay_file) >> decode_network_stream();
+      }
     }
 
     if (video_cfg.batch) {
@@ -248,7 +497,8 @@ streams::publisher<encoded_packet> encoded_publisher(
     const uint8_t fps = 25;                // FIXME: hardcoded value
     const uint8_t vp9_lag_in_frames = 25;  // FIXME: hardcoded value
 
-    return camera_source(io, video_cfg.resolution, fps) >> encode_vp9(vp9_lag_in_frames);
+    return camera_source(io, video_cfg.resolution, fps)
+           >> encode_vp9(vp9_lag_in_frames, rate_controller);
   }
 
   if (video_cfg.input_url) {
@@ -262,7 +512,8 @@ streams::publisher<encoded_packet> encoded_publisher(
 
 streams::publisher<owned_image_packet> decoded_publisher(
     boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client,
-    const input_video_config &video_cfg, image_pixel_format pixel_format) {
+    const input_video_config &video_cfg, image_pixel_format pixel_format,
+    const std::shared_ptr<frame_skip_controller> &skip_controller) {
   const auto resolution =
       (video_cfg.resolution == "original")
           ? image_size{avutils::original_image_width, avutils::original_image_height}
@@ -271,7 +522,8 @@ streams::publisher<owned_image_packet> decoded_publisher(
 
   streams::publisher<owned_image_packet> source =
       encoded_publisher(io, client, video_cfg)
-      >> decode_image_frames(resolution.get(), pixel_format, video_cfg.keep_aspect_ratio);
+      >> decode_image_frames(resolution.get(), pixel_format, video_cfg.keep_aspect_ratio,
+                             video_cfg.low_latency, skip_controller);
 
   if (video_cfg.time_limit) {
     source = std::move(source) >> streams::asio::timer_breaker<owned_image_packet>(
@@ -287,9 +539,11 @@ streams::publisher<owned_image_packet> decoded_publisher(
 
 streams::subscriber<encoded_packet> &encoded_subscriber(
     boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client,
-    const output_video_config &config) {
+    const output_video_config &config,
+    const std::shared_ptr<rate_controller> &rate_controller,
+    const std::shared_ptr<file_writer_pool> &writer_pool) {
   if (config.output_channel) {
-    return rtm_sink(client, io, *config.output_channel);
+    return rtm_sink(client, io, *config.output_channel, rate_controller);
   }
 
   if (config.output_path) {
@@ -299,8 +553,14 @@ streams::subscriber<encoded_packet> &encoded_subscriber(
           std::to_string(*config.reserved_index_space);
     }
 
-    return video_file_sink(*config.output_path, config.segment_duration,
-                           std::move(format_options));
+    file_segment_limits segment_limits;
+    segment_limits.duration = config.segment_duration;
+    segment_limits.frames = config.segment_frames;
+    segment_limits.bytes = config.segment_size;
+
+    return video_file_sink(io, *config.output_path, segment_limits,
+                           std::move(format_options), config.write_queue_size,
+                           config.file_sync, writer_pool, config.fragmented);
   }
 
   ABORT() << "unreachable code in encoded_subscriber()";
@@ -375,6 +635,10 @@ bool configuration::validate() const {
     return false;
   }
 
+  if (has_output_file_args && !validate_output_file_args(_vm)) {
+    return false;
+  }
+
   if (_cli_options.enable_rtm_output || _cli_options.enable_file_output) {
     if (!has_output_rtm_args && !has_output_file_args) {
       std::cerr << "Video output should be specified\n";
@@ -443,8 +707,10 @@ bool configuration::is_batch_mode() const {
 }
 
 streams::publisher<encoded_packet> configuration::encoded_publisher(
-    boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client) const {
-  return cli_streams::encoded_publisher(io, client, input_video_config{_vm});
+    boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client,
+    const std::shared_ptr<rate_controller> &rate_controller) const {
+  return cli_streams::encoded_publisher(io, client, input_video_config{_vm},
+                                        rate_controller);
 }
 
 streams::publisher<owned_image_packet> configuration::decoded_publisher(
@@ -458,8 +724,10 @@ streams::publisher<owned_image_packet> configuration::decoded_publisher(
 }
 
 streams::subscriber<encoded_packet> &configuration::encoded_subscriber(
-    boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client) const {
-  return cli_streams::encoded_subscriber(io, client, output_video_config{_vm});
+    boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client,
+    const std::shared_ptr<rate_controller> &rate_controller) const {
+  return cli_streams::encoded_subscriber(io, client, output_video_config{_vm},
+                                         rate_controller);
 }
 
 input_video_config::input_video_config(const po::variables_map &vm)
@@ -472,12 +740,19 @@ input_video_config::input_video_config(const po::variables_map &vm)
                             ? vm["output-resolution"].as<std::string>()
                             : "original")),
       keep_aspect_ratio(vm["keep-proportions"].as<bool>()),
+      low_latency(vm.count("low-latency") > 0),
       input_video_file(vm.count("input-video-file") > 0
                            ? vm["input-video-file"].as<std::string>()
                            : boost::optional<std::string>{}),
       input_replay_file(vm.count("input-replay-file") > 0
                             ? vm["input-replay-file"].as<std::string>()
                             : boost::optional<std::string>{}),
+      input_manifest(vm.count("input-manifest") > 0
+                         ? vm["input-manifest"].as<std::string>()
+                         : boost::optional<std::string>{}),
+      input_playlist(vm.count("input-playlist") > 0
+                         ? vm["input-playlist"].as<std::string>()
+                         : boost::optional<std::string>{}),
       input_url(vm.count("input-url") > 0 ? vm["input-url"].as<std::string>()
                                           : boost::optional<std::string>{}),
       input_url_parameters{vm.count("input-url-parameters") > 0
@@ -485,6 +760,8 @@ input_video_config::input_video_config(const po::variables_map &vm)
                                : boost::optional<std::string>{}},
       input_camera(vm.count("input-camera") > 0),
       loop(vm.count("loop") > 0),
+      range(parse_file_range(vm)),
+      read_options(parse_file_read_options(vm)),
       time_limit(vm.count("time-limit") > 0 ? vm["time-limit"].as<int>()
                                             : boost::optional<int>{}),
       frames_limit(vm.count("frames-limit") > 0 ? vm["frames-limit"].as<int>()
@@ -499,12 +776,20 @@ input_video_config::input_video_config(const nlohmann::json &config)
                      ? config["resolution"].get<std::string>()
                      : "original"),
       keep_aspect_ratio(config.find("keep_proportions") != config.end()),
+      low_latency(config.find("low_latency") != config.end()
+                  && config["low_latency"].get<bool>()),
       input_video_file(config.find("input_video_file") != config.end()
                            ? config["input_video_file"].get<std::string>()
                            : boost::optional<std::string>{}),
       input_replay_file(config.find("input_replay_file") != config.end()
                             ? config["input_replay_file"].get<std::string>()
                             : boost::optional<std::string>{}),
+      input_manifest(config.find("input_manifest") != config.end()
+                         ? config["input_manifest"].get<std::string>()
+                         : boost::optional<std::string>{}),
+      input_playlist(config.find("input_playlist") != config.end()
+                         ? config["input_playlist"].get<std::string>()
+                         : boost::optional<std::string>{}),
       input_url(config.find("input_url") != config.end()
                     ? config["input_url"].get<std::string>()
                     : boost::optional<std::string>{}),
@@ -513,6 +798,8 @@ input_video_config::input_video_config(const nlohmann::json &config)
                                : boost::optional<std::string>{}},
       input_camera(config.find("input_camera") != config.end()),
       loop(config.find("loop") != config.end()),
+      range(parse_file_range(config)),
+      read_options(parse_file_read_options(config)),
       time_limit(config.find("time_limit") != config.end()
                      ? config["time_limit"].get<long>()
                      : boost::optional<long>{}),
@@ -520,6 +807,27 @@ input_video_config::input_video_config(const nlohmann::json &config)
                        ? config["frames_limit"].get<long>()
                        : boost::optional<long>{}) {}
 
+input_video_config::input_video_config(const input_video_config &other,
+                                       const std::string &input_video_file,
+                                       const file_range &range)
+    : batch(other.batch),
+      resolution(other.resolution),
+      keep_aspect_ratio(other.keep_aspect_ratio),
+      low_latency(other.low_latency),
+      input_video_file(input_video_file),
+      input_replay_file(),
+      input_manifest(),
+      input_playlist(),
+      input_url(other.input_url),
+      input_url_parameters(other.input_url_parameters),
+      input_channel(other.input_channel),
+      input_camera(other.input_camera),
+      loop(other.loop),
+      range(range),
+      read_options(other.read_options),
+      time_limit(other.time_limit),
+      frames_limit(other.frames_limit) {}
+
 output_video_config::output_video_config(const po::variables_map &vm)
     : output_channel{vm.count("output-channel") > 0
                          ? vm["output-channel"].as<std::string>()
@@ -532,9 +840,20 @@ output_video_config::output_video_config(const po::variables_map &vm)
               ? boost::optional<std::chrono::system_clock::duration>{std::chrono::seconds{
                     vm["segment-duration"].as<int>()}}
               : boost::optional<std::chrono::system_clock::duration>{}},
+      segment_frames{vm.count("segment-frames") > 0 ? vm["segment-frames"].as<uint64_t>()
+                                                    : boost::optional<uint64_t>{}},
+      segment_size{vm.count("segment-size") > 0 ? vm["segment-size"].as<uint64_t>()
+                                                : boost::optional<uint64_t>{}},
       reserved_index_space{vm.count("reserved-index-space") > 0
                                ? vm["reserved-index-space"].as<int>()
-                               : boost::optional<int>{}} {}
+                               : boost::optional<int>{}},
+      write_queue_size{vm.count("write-queue-size") > 0
+                           ? static_cast<size_t>(vm["write-queue-size"].as<int>())
+                           : default_write_queue_size},
+      file_sync{vm.count("file-sync") > 0
+                    ? parse_file_sync_policy(vm["file-sync"].as<std::string>()).get()
+                    : file_sync_policy::NONE},
+      fragmented{vm.count("fragmented-output") > 0} {}
 
 output_video_config::output_video_config(const nlohmann::json &config)
     : output_channel{config.find("output-channel") != config.end()
@@ -548,9 +867,40 @@ output_video_config::output_video_config(const nlohmann::json &config)
               ? boost::optional<std::chrono::system_clock::duration>{std::chrono::seconds{
                     config["segment-duration"].get<int>()}}
               : boost::optional<std::chrono::system_clock::duration>{}},
+      segment_frames{config.find("segment-frames") != config.end()
+                         ? config["segment-frames"].get<uint64_t>()
+                         : boost::optional<uint64_t>{}},
+      segment_size{config.find("segment-size") != config.end()
+                       ? config["segment-size"].get<uint64_t>()
+                       : boost::optional<uint64_t>{}},
       reserved_index_space{config.find("reserved-index-space") != config.end()
                                ? config["reserved-index-space"].get<int>()
-                               : boost::optional<int>{}} {}
+                               : boost::optional<int>{}},
+      write_queue_size{config.find("write-queue-size") != config.end()
+                           ? config["write-queue-size"].get<size_t>()
+                           : default_write_queue_size},
+      file_sync{config.find("file-sync") != config.end()
+                    ? parse_file_sync_policy(config["file-sync"].get<std::string>())
+                          .value_or(file_sync_policy::NONE)
+                    : file_sync_policy::NONE},
+      fragmented{config.find("fragmented-output") != config.end()} {}
+
+bool validate_output_config(const nlohmann::json &config) {
+  if (config.find("file-sync") != config.end()
+      && (!config["file-sync"].is_string()
+          || !parse_file_sync_policy(config["file-sync"].get<std::string>()))) {
+    std::cerr << "Unknown file-sync value: " << config["file-sync"] << "\n";
+    return false;
+  }
+  if (config.find("write-queue-size") != config.end()
+      && (!config["write-queue-size"].is_number_integer()
+          || config["write-queue-size"].get<int64_t>() <= 0)) {
+    std::cerr << "write-queue-size should be positive\n";
+    return false;
+  }
+
+  return true;
+}
 }  // namespace cli_streams
 }  // namespace video
 }  // namespace satori
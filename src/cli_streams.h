@@ -8,11 +8,14 @@
 #include <memory>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "data.h"
 #include "metrics.h"
+#include "rate_controller.h"
 #include "rtm_client.h"
 #include "streams/streams.h"
+#include "video_streams.h"
 
 namespace satori {
 namespace video {
@@ -36,21 +39,31 @@ struct cli_options {
 struct input_video_config {
   explicit input_video_config(const po::variables_map &vm);
   explicit input_video_config(const nlohmann::json &config);
+  // Same config, but reading only given range of given video file.
+  input_video_config(const input_video_config &other, const std::string &input_video_file,
+                     const file_range &range);
 
   const bool batch;
   const std::string resolution;
   const bool keep_aspect_ratio;
+  const bool low_latency;
   const boost::optional<std::string> input_video_file;
   const boost::optional<std::string> input_replay_file;
+  const boost::optional<std::string> input_manifest;
+  const boost::optional<std::string> input_playlist;
   const boost::optional<std::string> input_url;
   const boost::optional<std::string> input_url_parameters;
   const boost::optional<std::string> input_channel;
   const bool input_camera;
   const bool loop;
+  const file_range range;
+  const file_read_options read_options;
   const boost::optional<int> time_limit;
   const boost::optional<int> frames_limit;
 };
 
+constexpr size_t default_write_queue_size = 250;
+
 struct output_video_config {
   explicit output_video_config(const po::variables_map &vm);
   explicit output_video_config(const nlohmann::json &config);
@@ -58,20 +71,41 @@ struct output_video_config {
   const boost::optional<std::string> output_channel;
   const boost::optional<boost::filesystem::path> output_path;
   const boost::optional<std::chrono::system_clock::duration> segment_duration;
+  const boost::optional<uint64_t> segment_frames;
+  const boost::optional<uint64_t> segment_size;
   const boost::optional<int> reserved_index_space;
+  const size_t write_queue_size;
+  const file_sync_policy file_sync;
+  const bool fragmented;
 };
 
+// Checks values of a job's output config, output_video_config(json) expects
+// a valid config.
+bool validate_output_config(const nlohmann::json &config);
+
+// Returns video files listed in a manifest, one per line, relative paths are resolved
+// against manifest directory. If manifest is a directory, returns its files.
+std::vector<std::string> read_input_manifest(const std::string &manifest);
+
+// rate_controller is used by inputs which encode video, i.e. camera.
 streams::publisher<encoded_packet> encoded_publisher(
     boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client,
-    const input_video_config &video_cfg);
+    const input_video_config &video_cfg,
+    const std::shared_ptr<rate_controller> &rate_controller = nullptr);
 
+// skip_controller chooses which live frames are decoded and delivered.
 streams::publisher<owned_image_packet> decoded_publisher(
     boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client,
-    const input_video_config &video_cfg, image_pixel_format pixel_format);
+    const input_video_config &video_cfg, image_pixel_format pixel_format,
+    const std::shared_ptr<frame_skip_controller> &skip_controller = nullptr);
 
+// rate_controller is notified about backpressure of RTM output,
+// writer_pool is shared by file outputs.
 streams::subscriber<encoded_packet> &encoded_subscriber(
     boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client,
-    const output_video_config &config);
+    const output_video_config &config,
+    const std::shared_ptr<rate_controller> &rate_controller = nullptr,
+    const std::shared_ptr<file_writer_pool> &writer_pool = nullptr);
 
 struct configuration {
  public:
@@ -90,14 +124,16 @@ struct configuration {
   bool is_batch_mode() const;
 
   streams::publisher<encoded_packet> encoded_publisher(
-      boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client) const;
+      boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client,
+      const std::shared_ptr<rate_controller> &rate_controller = nullptr) const;
 
   streams::publisher<owned_image_packet> decoded_publisher(
       boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client,
       image_pixel_format pixel_format) const;
 
   streams::subscriber<encoded_packet> &encoded_subscriber(
-      boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client) const;
+      boost::asio::io_service &io, const std::shared_ptr<rtm::client> &client,
+      const std::shared_ptr<rate_controller> &rate_controller = nullptr) const;
 
   metrics_config metrics() const { return metrics_config{_vm}; }
 
@@ -38,6 +38,9 @@ po::options_description cli_options() {
       "log verbosity level (INFO, WARNING, ERROR, FATAL, OFF, 1-9)");
 
   po::options_description publisher_options("Publisher options");
+  publisher_options.add_options()(
+      "adaptive-bitrate", po::value<bool>()->default_value(true),
+      "lower quality of encoded video when RTM connection is congested");
 
   return publisher_options.add(cli_generic).add(metrics_options());
 }
@@ -45,6 +48,8 @@ po::options_description cli_options() {
 struct publisher_configuration : cli_streams::configuration {
   publisher_configuration(int argc, char* argv[])
       : configuration(argc, argv, cli_configuration(), cli_options()) {}
+
+  bool adaptive_bitrate() const { return _vm["adaptive-bitrate"].as<bool>(); }
 };
 
 }  // namespace
@@ -69,8 +74,13 @@ int main(int argc, char* argv[]) {
   }
   expose_metrics(rtm_client.get());
 
+  std::shared_ptr<rate_controller> bitrate_controller;
+  if (config.adaptive_bitrate()) {
+    bitrate_controller = std::make_shared<rate_controller>();
+  }
+
   streams::publisher<satori::video::encoded_packet> source =
-      config.encoded_publisher(io_service, rtm_client);
+      config.encoded_publisher(io_service, rtm_client, bitrate_controller);
 
   source = std::move(source) >> streams::do_finally([&io_service, &rtm_client]() {
              io_service.post([&rtm_client]() {
@@ -83,7 +93,8 @@ int main(int argc, char* argv[]) {
              });
            });
 
-  source->subscribe(config.encoded_subscriber(io_service, rtm_client));
+  source->subscribe(
+      config.encoded_subscriber(io_service, rtm_client, bitrate_controller));
 
   io_service.run();
 }
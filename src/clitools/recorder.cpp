@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/filesystem.hpp>
@@ -10,6 +11,7 @@
 
 #include "cli_streams.h"
 #include "data.h"
+#include "file_writer_pool.h"
 #include "logging_impl.h"
 #include "pool_controller.h"
 #include "rtm_client.h"
@@ -29,8 +31,6 @@ namespace recorder {
 
 namespace {
 
-constexpr int max_streams_capacity = 5;
-
 cli_streams::cli_options cli_configuration() {
   cli_streams::cli_options result;
   result.enable_file_output = true;
@@ -51,6 +51,18 @@ po::options_description cli_options() {
       ",v", po::value<std::string>(),
       "log verbosity level (INFO, WARNING, ERROR, FATAL, OFF, 1-9)");
 
+  po::options_description writer_options("Writer options");
+  writer_options.add_options()("io-threads", po::value<size_t>()->default_value(4),
+                               "number of threads writing files of all streams");
+  writer_options.add_options()(
+      "write-buffer-size", po::value<uint64_t>()->default_value(512 * 1024 * 1024),
+      "maximum size in bytes of frames waiting to be written, for all streams");
+  writer_options.add_options()(
+      "max-streams", po::value<size_t>()->default_value(500),
+      "(pool mode) maximum number of recorded streams, fewer are accepted "
+      "if writer threads can't keep up");
+
+  cli_generic.add(writer_options);
   return cli_generic;
 }
 
@@ -89,6 +101,12 @@ struct recorder_configuration : cli_streams::configuration {
   cli_streams::output_video_config as_output_config() const {
     return cli_streams::output_video_config{_vm};
   }
+
+  size_t io_threads() const { return _vm["io-threads"].as<size_t>(); }
+
+  uint64_t write_buffer_size() const { return _vm["write-buffer-size"].as<uint64_t>(); }
+
+  size_t max_streams() const { return _vm["max-streams"].as<size_t>(); }
 };
 
 using stream_done_callback_t = std::function<void(std::error_condition)>;
@@ -96,11 +114,13 @@ using stream_done_callback_t = std::function<void(std::error_condition)>;
 class video_stream : private streams::subscriber<encoded_packet> {
  public:
   video_stream(asio::io_service &io, std::shared_ptr<rtm::client> &client,
+               const std::shared_ptr<file_writer_pool> &writer_pool,
                cli_streams::input_video_config &&input_config,
                cli_streams::output_video_config &&output_config,
                const nlohmann::json &job, stream_done_callback_t &&done_callback)
       : _io{io},
         _client{client},
+        _writer_pool{writer_pool},
         _input_config{std::move(input_config)},
         _output_config{std::move(output_config)},
         _job{job},
@@ -133,8 +153,9 @@ class video_stream : private streams::subscriber<encoded_packet> {
  private:
   streams::publisher<encoded_packet> original_encoded_stream(const std::string &channel) {
     LOG(INFO) << "using original encoded stream";
-    return cli_streams::encoded_publisher(_io, _client, _input_config)
-           >> streams::threaded_worker("in_" + channel) >> streams::flatten();
+    // frames are only remuxed, file writes are offloaded to the writer pool,
+    // so there is no need for a thread per stream
+    return cli_streams::encoded_publisher(_io, _client, _input_config);
   }
 
   streams::publisher<encoded_packet> transcoded_stream(const std::string &channel) {
@@ -158,7 +179,8 @@ class video_stream : private streams::subscriber<encoded_packet> {
                          ? original_encoded_stream(channel)
                          : transcoded_stream(channel);
 
-    _sink = cli_streams::encoded_subscriber(_io, _client, _output_config);
+    _sink = cli_streams::encoded_subscriber(_io, _client, _output_config, nullptr,
+                                            _writer_pool);
 
     publisher->subscribe(*this);
   }
@@ -196,6 +218,7 @@ class video_stream : private streams::subscriber<encoded_packet> {
  private:
   asio::io_service &_io;
   const std::shared_ptr<rtm::client> _client;
+  const std::shared_ptr<file_writer_pool> _writer_pool;
   const cli_streams::input_video_config _input_config;
   const cli_streams::output_video_config _output_config;
   const nlohmann::json _job{nullptr};
@@ -207,8 +230,9 @@ class video_stream : private streams::subscriber<encoded_packet> {
 class recorder_job_controller : public job_controller {
  public:
   recorder_job_controller(asio::io_service &io, std::shared_ptr<rtm::client> &client,
+                          const std::shared_ptr<file_writer_pool> &writer_pool,
                           const recorder_configuration &config)
-      : _io{io}, _client{client}, _config{config} {}
+      : _io{io}, _client{client}, _writer_pool{writer_pool}, _config{config} {}
 
  private:
   /**
@@ -216,8 +240,12 @@ class recorder_job_controller : public job_controller {
    * {
    *   "channel": <string>,
    *   "segment-duration": <number> [OPTIONAL],
+   *   "segment-frames": <number> [OPTIONAL],
+   *   "segment-size": <number> [OPTIONAL],
    *   "resolution": <string> [OPTIONAL],
-   *   "reserved-index-space": <number> [OPTIONAL]
+   *   "reserved-index-space": <number> [OPTIONAL],
+   *   "fragmented-output": <any> [OPTIONAL],
+   *   "file-sync": "none" | "flush" | "fsync" [OPTIONAL]
    * }
    */
   void add_job(const nlohmann::json &job) override {
@@ -229,15 +257,27 @@ class recorder_job_controller : public job_controller {
 
     LOG(INFO) << "channel name: " << escape_slashes(*input_config.input_channel);
     // TODO: ugly hack to make output path to be channel name
-    const fs::path output_path = *_config.as_output_config().output_path
-                                 / (escape_slashes(*input_config.input_channel) + ".mkv");
+    const cli_streams::output_video_config pool_output_config =
+        _config.as_output_config();
+    const bool fragmented =
+        pool_output_config.fragmented || job.find("fragmented-output") != job.end();
+    const fs::path output_path =
+        *pool_output_config.output_path
+        / (escape_slashes(*input_config.input_channel) + (fragmented ? ".mp4" : ".mkv"));
     LOG(INFO) << "output path: " << output_path;
     nlohmann::json job_copy{job};
     job_copy["output-video-file"] = output_path.string();
+    if (fragmented) {
+      job_copy["fragmented-output"] = true;
+    }
+    if (!cli_streams::validate_output_config(job_copy)) {
+      LOG(ERROR) << "rejecting job with invalid output config: " << job;
+      return;
+    }
     cli_streams::output_video_config output_config{job_copy};
 
-    _streams.emplace_back(_io, _client, std::move(input_config), std::move(output_config),
-                          job, [](std::error_condition) {});
+    _streams.emplace_back(_io, _client, _writer_pool, std::move(input_config),
+                          std::move(output_config), job, [](std::error_condition) {});
   }
 
   void remove_job(const nlohmann::json &job) override {
@@ -258,6 +298,7 @@ class recorder_job_controller : public job_controller {
   const recorder_configuration &_config;
   asio::io_service &_io;
   std::shared_ptr<rtm::client> _client;
+  const std::shared_ptr<file_writer_pool> _writer_pool;
   std::list<video_stream> _streams;
 };
 
@@ -275,9 +316,11 @@ void request_rtm_client_stop(asio::io_service &io, std::shared_ptr<rtm::client>
 }
 
 void run_standalone(asio::io_service &io, std::shared_ptr<rtm::client> &client,
+                    const std::shared_ptr<file_writer_pool> &writer_pool,
                     const recorder_configuration &config) {
   video_stream recorded_stream{io,
                                client,
+                               writer_pool,
                                config.as_input_config(),
                                config.as_output_config(),
                                nullptr,
@@ -304,11 +347,23 @@ void run_standalone(asio::io_service &io, std::shared_ptr<rtm::client> &client,
 }
 
 void run_pool(asio::io_service &io, std::shared_ptr<rtm::client> &client,
+              const std::shared_ptr<file_writer_pool> &writer_pool,
               const recorder_configuration &config) {
-  recorder_job_controller recorder_controller{io, client, config};
-  pool_job_controller job_controller{
-      io,     config.pool().get(), config.pool_job_type(), max_streams_capacity,
-      client, recorder_controller};
+  recorder_job_controller recorder_controller{io, client, writer_pool, config};
+
+  // until writer threads are measured, capacity is the configured maximum
+  const size_t max_streams = config.max_streams();
+  auto streams_capacity = [writer_pool, max_streams]() {
+    const auto estimated_capacity = writer_pool->estimate_capacity();
+    return estimated_capacity ? std::min(max_streams, *estimated_capacity)
+                              : max_streams;
+  };
+  pool_job_controller job_controller{io,
+                                     config.pool().get(),
+                                     config.pool_job_type(),
+                                     std::move(streams_capacity),
+                                     client,
+                                     recorder_controller};
 
   // Kubernetes sends SIGTERM, and then SIGKILL after 30 seconds
   // https://kubernetes.io/docs/concepts/workloads/pods/pod/#termination-of-pods
@@ -344,12 +399,15 @@ void recorder_main(int argc, char *argv[]) {
     }
   }
 
+  auto writer_pool =
+      std::make_shared<file_writer_pool>(config.io_threads(), config.write_buffer_size());
+
   if (config.pool()) {
     LOG(INFO) << "running recorder in pool mode";
-    run_pool(io, client, config);
+    run_pool(io, client, writer_pool, config);
   } else {
     LOG(INFO) << "running standalone recorder";
-    run_standalone(io, client, config);
+    run_standalone(io, client, writer_pool, config);
   }
 }
 
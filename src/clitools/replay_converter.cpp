@@ -0,0 +1,58 @@
+#include <boost/program_options.hpp>
+#include <iostream>
+
+#include "binary_replay.h"
+#include "logging_impl.h"
+#include "tcmalloc.h"
+
+using namespace satori::video;
+
+namespace {
+
+namespace po = boost::program_options;
+
+po::options_description cli_options() {
+  po::options_description cli_generic("Generic options");
+  cli_generic.add_options()("help", "produce help message");
+  cli_generic.add_options()(
+      ",v", po::value<std::string>(),
+      "log verbosity level (INFO, WARNING, ERROR, FATAL, OFF, 1-9)");
+
+  po::options_description converter_options("Converter options");
+  converter_options.add_options()(
+      "input-replay-file", po::value<std::string>()->required(),
+      "JSON-lines replay file, its metadata is read from <file>.metadata");
+  converter_options.add_options()("output-replay-file",
+                                  po::value<std::string>()->required(),
+                                  "binary replay file to write");
+
+  return converter_options.add(cli_generic);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  init_tcmalloc();
+  init_logging(argc, argv);
+
+  const po::options_description options = cli_options();
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, options), vm);
+    if (argc == 1 || vm.count("help") > 0) {
+      std::cerr << options << std::endl;
+      return 1;
+    }
+    po::notify(vm);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl << options << std::endl;
+    return 1;
+  }
+
+  const auto input = vm["input-replay-file"].as<std::string>();
+  const auto output = vm["output-replay-file"].as<std::string>();
+  LOG(INFO) << "Converting " << input << " to " << output;
+  convert_network_replay(input, output);
+
+  return 0;
+}
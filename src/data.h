@@ -89,6 +89,9 @@ struct encoded_frame {
   // time when frame was generated by source (for example, network, encoder or file)
   std::chrono::system_clock::time_point creation_time;
 
+  // frame is only needed to decode following frames, its image is not delivered
+  bool decode_only{false};
+
   std::vector<network_frame> to_network() const;
 };
 
@@ -98,6 +101,18 @@ using encoded_packet = boost::variant<encoded_metadata, encoded_frame>;
 // TODO: may contain some data like FPS, etc.
 struct owned_image_metadata {};
 
+// Times a frame passed pipeline stages, to break its latency down.
+// Stages which weren't passed are left default constructed.
+struct frame_trace {
+  // frame came from source, see encoded_frame::creation_time
+  std::chrono::steady_clock::time_point arrival;
+  std::chrono::steady_clock::time_point decode_start;
+  // decoded image is delivered
+  std::chrono::steady_clock::time_point decode_end;
+  std::chrono::steady_clock::time_point callback_start;
+  std::chrono::steady_clock::time_point callback_end;
+};
+
 // If an image uses packed pixel format like packed RGB or packed YUV,
 // then it has only a single plane, e.g. all it's data is within plane_data[0].
 // If an image uses planar pixel format like planar YUV or HSV,
@@ -116,6 +131,8 @@ struct owned_image_frame {
 
   std::string plane_data[max_image_planes];
   uint32_t plane_strides[max_image_planes];
+
+  frame_trace trace;
 };
 
 // algebraic type to support flow of image data using streams API
@@ -4,6 +4,7 @@
 
 #include "av_filter.h"
 #include "avutils.h"
+#include "frame_trace.h"
 #include "metrics.h"
 #include "stopwatch.h"
 #include "video_error.h"
@@ -43,16 +44,26 @@ auto &receive_frame_millis =
         .Add({}, std::vector<double>{0, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 1, 2,
                                      5, 10, 20, 50, 100});
 
+auto &decode_latency_millis =
+    prometheus::BuildHistogram()
+        .Name("decoder_latency_millis")
+        .Register(metrics_registry())
+        .Add({}, std::vector<double>{0,  1,  2,  3,  4,   5,   6,   7,   8,   9,    10,
+                                     15, 20, 30, 40, 50, 100, 200, 300, 500, 1000, 2000});
+
 auto &decoder_errors =
     prometheus::BuildCounter().Name("decoder_errors_total").Register(metrics_registry());
 
 class image_decoder_op {
  public:
   image_decoder_op(const image_size &bounding_size, image_pixel_format pixel_format,
-                   bool keep_aspect_ratio)
+                   bool keep_aspect_ratio, bool low_latency,
+                   const std::shared_ptr<frame_skip_controller> &skip_controller)
       : _bounding_size{bounding_size},
         _pixel_format{pixel_format},
-        _keep_aspect_ratio{keep_aspect_ratio} {}
+        _keep_aspect_ratio{keep_aspect_ratio},
+        _low_latency{low_latency},
+        _skip_controller{skip_controller} {}
 
   template <typename T>
   class instance : public streams::subscriber<encoded_packet>,
@@ -73,7 +84,9 @@ class image_decoder_op {
         : streams::impl::drain_source_impl<owned_image_packet>(sink),
           _bounding_size{op._bounding_size},
           _pixel_format{op._pixel_format},
-          _keep_aspect_ratio{op._keep_aspect_ratio} {}
+          _keep_aspect_ratio{op._keep_aspect_ratio},
+          _low_latency{op._low_latency},
+          _skip_controller{op._skip_controller} {}
 
     ~instance() override {
       if (_source) {
@@ -126,18 +139,21 @@ class image_decoder_op {
         return;
       }
 
-      _current_metadata_frames_counter = 0;
-      _metadata = m;
-      _context = avutils::decoder_context(m.codec_name, m.codec_data);
-      _packet = avutils::av_packet();
-      _frame = avutils::av_frame();
-      _filtered_frame = avutils::av_frame();
-      if (!_context || !_packet || !_frame || !_filtered_frame) {
-        deliver_on_error(video_error::STREAM_INITIALIZATION_ERROR);
-        return;
+      if (_context) {
+        // frames held by the decoder belong to the previous stream, the new
+        // decoder is created when they are drained
+        LOG(INFO) << this << " flushing decoder before codec parameters change";
+        int err = avcodec_send_packet(_context.get(), nullptr);
+        if (err >= 0) {
+          _next_metadata = m;
+          return;
+        }
+        LOG(ERROR) << "avcodec_send_packet flush error: " << avutils::error_msg(err);
+        decoder_errors
+            .Add({{"err", std::to_string(err)}, {"call", "avcodec_send_packet"}})
+            .Increment();
       }
-
-      LOG(INFO) << _metadata.codec_name << " video decoder initialized";
+      init_decoder(m);
     }
 
     void operator()(const encoded_frame &f) {
@@ -151,10 +167,22 @@ class image_decoder_op {
         return;
       }
 
+      bool decode_only = f.decode_only;
+      if (!decode_only && _skip_controller && !_skip_controller->on_input_frame()) {
+        if (_intra_only) {
+          // no other frame depends on it
+          LOG(4) << this << " skipping frame " << f.id;
+          return;
+        }
+        // later frames may refer to it, so it's decoded but not delivered
+        decode_only = true;
+      }
+
       {
         stopwatch<> s;
         av_init_packet(_packet.get());
-        _ids.push(f.id);
+        _ids.push({f.id, steady_time(f.creation_time), std::chrono::steady_clock::now(),
+                   decode_only});
         _packet->flags |= f.key_frame ? AV_PKT_FLAG_KEY : 0;
         _packet->data = (uint8_t *)f.data.data();
         _packet->size = static_cast<int>(f.data.size());
@@ -185,6 +213,28 @@ class image_decoder_op {
     }
 
    private:
+    bool init_decoder(const encoded_metadata &m) {
+      _current_metadata_frames_counter = 0;
+      _metadata = m;
+      _context = avutils::decoder_context(m.codec_name, m.codec_data, _low_latency);
+      _packet = avutils::av_packet();
+      _frame = avutils::av_frame();
+      _filtered_frame = avutils::av_frame();
+      // frame size and rotation may change
+      _filter.reset();
+      _ids = std::queue<pending_packet>{};
+      if (!_context || !_packet || !_frame || !_filtered_frame) {
+        deliver_on_error(video_error::STREAM_INITIALIZATION_ERROR);
+        return false;
+      }
+      const AVCodecDescriptor *descriptor = avcodec_descriptor_get(_context->codec_id);
+      _intra_only =
+          descriptor != nullptr && (descriptor->props & AV_CODEC_PROP_INTRA_ONLY) != 0;
+
+      LOG(INFO) << _metadata.codec_name << " video decoder initialized";
+      return true;
+    }
+
     bool drain_impl() override {
       LOG(4) << this << " drain_impl needs=" << needs();
       if (!_context) {
@@ -219,6 +269,12 @@ class image_decoder_op {
             return video_error::FRAME_NOT_READY_ERROR;
           case AVERROR_EOF:
             LOG(4) << this << " eof";
+            if (_next_metadata) {
+              const encoded_metadata m = std::move(*_next_metadata);
+              _next_metadata.reset();
+              return init_decoder(m) ? video_error::FRAME_NOT_READY_ERROR
+                                     : video_error::STREAM_INITIALIZATION_ERROR;
+            }
             deliver_on_complete();
             return video_error::END_OF_STREAM_ERROR;
           default:
@@ -236,18 +292,31 @@ class image_decoder_op {
     }
 
     void deliver_frame() {
+      frames_received.Increment();
+      if (!_ids.empty() && _ids.front().decode_only
+          && _frame->pkt_pos == _ids.front().id.i1) {
+        // not delivered, so not filtered either
+        LOG(4) << this << " skipping decode-only frame " << _ids.front().id;
+        _ids.pop();
+        return;
+      }
+
       if (!_filter) {
         init_filter();
       }
 
       _filter->feed(*_frame);
-      frames_received.Increment();
 
       while (_filter->try_retrieve(*_filtered_frame)) {
         owned_image_frame frame = avutils::to_image_frame(*_filtered_frame);
 
+        boost::optional<std::chrono::steady_clock::time_point> arrival_time;
+        bool decode_only{false};
         if (!_ids.empty()) {
-          frame.id = _ids.front();
+          frame.id = _ids.front().id;
+          frame.trace.arrival = _ids.front().source_time;
+          arrival_time = _ids.front().arrival_time;
+          decode_only = _ids.front().decode_only;
           _ids.pop();
         } else {
           LOG(ERROR) << this << "id queue is empty";
@@ -257,11 +326,28 @@ class image_decoder_op {
 
         while (_filtered_frame->key_frame != 0 && _filtered_frame->pkt_pos != frame.id.i1
                && !_ids.empty()) {
-          frame.id = _ids.front();
+          frame.id = _ids.front().id;
+          frame.trace.arrival = _ids.front().source_time;
+          arrival_time = _ids.front().arrival_time;
+          decode_only = _ids.front().decode_only;
           _ids.pop();
         }
 
         av_frame_unref(_filtered_frame.get());
+        if (decode_only) {
+          LOG(4) << this << " skipping decode-only frame " << frame.id;
+          continue;
+        }
+
+        if (arrival_time) {
+          frame.trace.decode_start = *arrival_time;
+          frame.trace.decode_end = std::chrono::steady_clock::now();
+          decode_latency_millis.Observe(
+              std::chrono::duration<double, std::milli>(frame.trace.decode_end
+                                                        - frame.trace.decode_start)
+                  .count());
+        }
+
         deliver_on_next(owned_image_packet{std::move(frame)});
       }
     }
@@ -307,34 +393,51 @@ class image_decoder_op {
     const image_size _bounding_size;
     const image_pixel_format _pixel_format;
     const bool _keep_aspect_ratio;
+    const bool _low_latency;
+    const std::shared_ptr<frame_skip_controller> _skip_controller;
+    bool _intra_only{false};
     streams::subscription *_source{nullptr};
     uint64_t _current_metadata_frames_counter{0};
     encoded_metadata _metadata;
+    // set while the decoder is flushed before switching to it
+    boost::optional<encoded_metadata> _next_metadata;
     std::shared_ptr<AVCodecContext> _context;
     std::shared_ptr<AVPacket> _packet;
     std::shared_ptr<AVFrame> _frame;
     std::shared_ptr<AVFrame> _filtered_frame;
     std::unique_ptr<av_filter> _filter;
-    std::queue<frame_id> _ids;
+    // ids of packets sent to decoder, in order
+    struct pending_packet {
+      frame_id id;
+      // see frame_trace::arrival
+      std::chrono::steady_clock::time_point source_time;
+      std::chrono::steady_clock::time_point arrival_time;
+      bool decode_only;
+    };
+    std::queue<pending_packet> _ids;
   };
 
  private:
   const image_size _bounding_size;
   const image_pixel_format _pixel_format;
   const bool _keep_aspect_ratio;
+  const bool _low_latency;
+  const std::shared_ptr<frame_skip_controller> _skip_controller;
 };
 
 }  // namespace
 
 streams::op<encoded_packet, owned_image_packet> decode_image_frames(
     const image_size &bounding_size, image_pixel_format pixel_format,
-    bool keep_aspect_ratio) {
+    bool keep_aspect_ratio, bool low_latency,
+    const std::shared_ptr<frame_skip_controller> &skip_controller) {
   avutils::init();
 
-  return [bounding_size, pixel_format,
-          keep_aspect_ratio](streams::publisher<encoded_packet> &&src) {
-    return std::move(src)
-           >> image_decoder_op(bounding_size, pixel_format, keep_aspect_ratio);
+  return [bounding_size, pixel_format, keep_aspect_ratio, low_latency,
+          skip_controller](streams::publisher<encoded_packet> &&src) {
+    return std::move(src) >> image_decoder_op(bounding_size, pixel_format,
+                                              keep_aspect_ratio, low_latency,
+                                              skip_controller);
   };
 }
 
@@ -1,17 +1,24 @@
+#include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <gsl/gsl>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 
 extern "C" {
 #include <libavutil/display.h>
 #include <libavutil/error.h>
+#include <libavutil/mathematics.h>
 }
 
 #include "avutils.h"
+#include "keyframe_index.h"
 #include "logging.h"
+#include "metrics.h"
 #include "streams/asio_streams.h"
+#include "threadutils.h"
 #include "video_error.h"
 #include "video_streams.h"
 
@@ -19,15 +26,169 @@ namespace satori {
 namespace video {
 namespace {
 
+auto &prefetch_waits = prometheus::BuildCounter()
+                           .Name("file_source_prefetch_waits_total")
+                           .Register(metrics_registry())
+                           .Add({});
+
+auto &prefetch_queue_bytes = prometheus::BuildHistogram()
+                                 .Name("file_source_prefetch_queue_bytes")
+                                 .Register(metrics_registry())
+                                 .Add({}, std::vector<double>{0, 1e4, 1e5, 1e6, 2e6, 4e6,
+                                                              8e6, 16e6, 32e6, 64e6});
+
+// Reads packets of a stream on a separate thread into a bounded queue.
+class packet_prefetcher {
+ public:
+  packet_prefetcher(const std::shared_ptr<AVFormatContext> &fmt_ctx, int stream_idx,
+                    size_t max_packets, size_t max_bytes)
+      : _fmt_ctx(fmt_ctx),
+        _stream_idx(stream_idx),
+        _max_packets(max_packets),
+        _max_bytes(max_bytes),
+        _thread([this]() { run(); }) {}
+
+  ~packet_prefetcher() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopped = true;
+    }
+    _cv.notify_all();
+    _thread.join();
+  }
+
+  // Same as av_read_frame(), but returns packets of the stream only.
+  int read(AVPacket *pkt) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_queue.empty()) {
+      prefetch_waits.Increment();
+      _cv.wait(lock, [this]() { return !_queue.empty(); });
+    }
+    prefetch_queue_bytes.Observe(_queued_bytes);
+
+    entry &e = _queue.front();
+    if (e.ret < 0) {
+      // stays in the queue until seek
+      return e.ret;
+    }
+    _queued_bytes -= e.packet->size;
+    av_packet_move_ref(pkt, e.packet.get());
+    _queue.pop_front();
+    _cv.notify_all();
+    return 0;
+  }
+
+  // Same as av_seek_frame(), drops packets read ahead.
+  int seek(int64_t timestamp, int flags) {
+    std::lock_guard<std::mutex> io_lock(_io_mutex);
+    const int ret = av_seek_frame(_fmt_ctx.get(), _stream_idx, timestamp, flags);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _generation++;
+    _queue.clear();
+    _queued_bytes = 0;
+    _cv.notify_all();
+    return ret;
+  }
+
+ private:
+  struct entry {
+    std::shared_ptr<AVPacket> packet;
+    int ret;
+  };
+
+  bool can_read() const {
+    if (_queue.empty()) {
+      return true;
+    }
+    return _queue.back().ret >= 0 && _queue.size() < _max_packets
+           && _queued_bytes < _max_bytes;
+  }
+
+  void run() {
+    threadutils::set_current_thread_name("file_prefetch");
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this]() { return _stopped || can_read(); });
+        if (_stopped) {
+          return;
+        }
+      }
+
+      std::shared_ptr<AVPacket> packet = avutils::av_packet();
+      CHECK(packet) << "failed to allocate packet";
+      int ret;
+      uint64_t generation;
+      {
+        std::lock_guard<std::mutex> io_lock(_io_mutex);
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          generation = _generation;
+        }
+        ret = av_read_frame(_fmt_ctx.get(), packet.get());
+      }
+
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (generation != _generation) {
+        // file was seeked while reading
+        continue;
+      }
+      if (ret >= 0 && packet->stream_index != _stream_idx) {
+        continue;
+      }
+      if (ret >= 0) {
+        _queued_bytes += packet->size;
+        _queue.push_back(entry{std::move(packet), ret});
+      } else {
+        _queue.push_back(entry{nullptr, ret});
+      }
+      _cv.notify_all();
+    }
+  }
+
+  const std::shared_ptr<AVFormatContext> _fmt_ctx;
+  const int _stream_idx;
+  const size_t _max_packets;
+  const size_t _max_bytes;
+
+  // guards format context
+  std::mutex _io_mutex;
+  // guards the rest
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<entry> _queue;
+  size_t _queued_bytes{0};
+  uint64_t _generation{0};
+  bool _stopped{false};
+
+  std::thread _thread;
+};
+
 class file_source_impl {
  public:
-  file_source_impl(const std::string &filename, const bool loop)
-      : _filename(filename), _loop(loop), _start(std::chrono::system_clock::now()) {}
+  file_source_impl(const std::string &filename, const bool loop, const bool batch,
+                   const file_range &range, const file_read_options &read_options)
+      : _filename(filename),
+        _loop(loop),
+        _batch(batch),
+        _range(range),
+        _read_options(read_options),
+        _start(std::chrono::system_clock::now()) {}
 
   std::error_condition init() {
     LOG(1) << "Opening file " << _filename;
 
-    _fmt_ctx = avutils::open_input_format_context(_filename);
+    if (_read_options.mmap) {
+      _fmt_ctx = avutils::open_input_mapped_file_context(
+          _filename, _read_options.io_buffer_size > 0 ? _read_options.io_buffer_size
+                                                      : avutils::default_io_buffer_size);
+    } else if (_read_options.io_buffer_size > 0) {
+      _fmt_ctx =
+          avutils::open_input_file_context(_filename, _read_options.io_buffer_size);
+    } else {
+      _fmt_ctx = avutils::open_input_format_context(_filename);
+    }
     if (!_fmt_ctx) {
       return video_error::STREAM_INITIALIZATION_ERROR;
     }
@@ -67,6 +228,53 @@ class file_source_impl {
       return video_error::STREAM_INITIALIZATION_ERROR;
     }
     LOG(1) << "Video codec is open";
+
+    if (!_range.empty()) {
+      if (auto err = init_range()) {
+        return err;
+      }
+    }
+
+    if (_batch && _read_options.prefetch_packets > 0) {
+      LOG(1) << "Reading " << _filename << " ahead up to "
+             << _read_options.prefetch_packets << " packets or "
+             << _read_options.prefetch_bytes << " bytes";
+      _prefetcher = std::make_unique<packet_prefetcher>(
+          _fmt_ctx, _stream_idx, _read_options.prefetch_packets,
+          _read_options.prefetch_bytes);
+    }
+    return {};
+  }
+
+  int read_packet() {
+    return _prefetcher ? _prefetcher->read(&_pkt) : av_read_frame(_fmt_ctx.get(), &_pkt);
+  }
+
+  int seek(int64_t timestamp, int flags) {
+    return _prefetcher ? _prefetcher->seek(timestamp, flags)
+                       : av_seek_frame(_fmt_ctx.get(), _stream_idx, timestamp, flags);
+  }
+
+  std::error_condition init_range() {
+    auto index = load_keyframe_index(_filename);
+    if (!index.ok()) {
+      return index.error_condition();
+    }
+    _index = index.move();
+    if (_index->stream_index != _stream_idx) {
+      LOG(ERROR) << "keyframe index of " << _filename << " is built for stream "
+                 << _index->stream_index << ", expected " << _stream_idx;
+      return video_error::STREAM_INITIALIZATION_ERROR;
+    }
+
+    if (_range.start_time) {
+      _start_pts = to_stream_timestamp(*_range.start_time);
+    }
+    if (_range.end_time) {
+      _end_pts = to_stream_timestamp(*_range.end_time);
+    }
+
+    seek_to_range_start();
     return {};
   }
 
@@ -90,13 +298,17 @@ class file_source_impl {
     av_init_packet(&_pkt);
     auto release = gsl::finally([this]() { av_packet_unref(&_pkt); });
 
-    int ret = av_read_frame(_fmt_ctx.get(), &_pkt);
+    int ret = read_packet();
     if (ret < 0) {
       if (ret == AVERROR_EOF) {
+        if (_loop && _index) {
+          LOG(4) << "restarting range of " << _filename;
+          seek_to_range_start();
+          return;
+        }
         if (_loop) {
           LOG(4) << "restarting " << _filename;
-          av_seek_frame(_fmt_ctx.get(), _stream_idx, _fmt_ctx->start_time,
-                        AVSEEK_FLAG_BACKWARD);
+          seek(_fmt_ctx->start_time, AVSEEK_FLAG_BACKWARD);
           return;
         }
 
@@ -109,18 +321,93 @@ class file_source_impl {
       return;
     }
 
-    if (_pkt.stream_index == _stream_idx) {
-      LOG(4) << "packet from file " << _filename;
-      encoded_frame frame;
-      frame.data = std::string{_pkt.data, _pkt.data + _pkt.size};
-      _last_pos++;
-      frame.id = {_last_pos, _last_pos};
-      auto ts = 1000 * _pkt.pts * _stream->time_base.num / _stream->time_base.den;
-      frame.timestamp = _start + std::chrono::milliseconds(ts);
-      frame.creation_time = std::chrono::system_clock::now();
-      frame.key_frame = static_cast<bool>(_pkt.flags & AV_PKT_FLAG_KEY);
-      observer.on_next(frame);
+    if (_pkt.stream_index != _stream_idx) {
+      return;
+    }
+
+    encoded_frame frame;
+    if (_index) {
+      const int64_t ts = _pkt.pts != AV_NOPTS_VALUE ? _pkt.pts : _pkt.dts;
+      const int64_t dts = _pkt.dts != AV_NOPTS_VALUE ? _pkt.dts : ts;
+      if (!skip_to_key_frame(ts, dts)) {
+        return;
+      }
+
+      const uint64_t frame_number = static_cast<uint64_t>(_last_pos);
+      if ((_range.end_frame && frame_number >= *_range.end_frame)
+          || (_end_pts && dts >= *_end_pts)) {
+        if (_loop) {
+          LOG(4) << "restarting range of " << _filename;
+          seek_to_range_start();
+          return;
+        }
+        LOG(4) << "end of range in " << _filename;
+        observer.on_complete();
+        return;
+      }
+
+      frame.decode_only = (_range.start_frame && frame_number < *_range.start_frame)
+                          || (_start_pts && ts < *_start_pts)
+                          || (_end_pts && ts >= *_end_pts);
+    }
+
+    LOG(4) << "packet from file " << _filename;
+    frame.data = std::string{_pkt.data, _pkt.data + _pkt.size};
+    _last_pos++;
+    frame.id = {_last_pos, _last_pos};
+    auto ts = 1000 * _pkt.pts * _stream->time_base.num / _stream->time_base.den;
+    frame.timestamp = _start + std::chrono::milliseconds(ts);
+    frame.creation_time = std::chrono::system_clock::now();
+    frame.key_frame = static_cast<bool>(_pkt.flags & AV_PKT_FLAG_KEY);
+    observer.on_next(frame);
+  }
+
+  // Returns false while packets before the key frame we seeked to are read.
+  bool skip_to_key_frame(int64_t ts, int64_t dts) {
+    if (!_seek_timestamp) {
+      return true;
+    }
+    if ((_pkt.flags & AV_PKT_FLAG_KEY) != 0 && ts == *_seek_timestamp) {
+      _seek_timestamp.reset();
+      return true;
+    }
+    if (dts != AV_NOPTS_VALUE && dts > *_seek_timestamp) {
+      LOG(WARNING) << "seek in " << _filename << " missed key frame " << *_seek_timestamp
+                   << ", reading from the beginning";
+      rewind();
+    }
+    return false;
+  }
+
+  void seek_to_range_start() {
+    const keyframe_index::key_frame &kf =
+        _range.start_frame ? _index->key_frame_for_frame(*_range.start_frame)
+                           : _start_pts ? _index->key_frame_for_timestamp(*_start_pts)
+                                        : _index->key_frames.front();
+    LOG(1) << "seeking " << _filename << " to key frame " << kf.frame_number;
+
+    const int ret = seek(kf.timestamp, AVSEEK_FLAG_BACKWARD);
+    if (ret < 0) {
+      LOG(WARNING) << "failed to seek " << _filename << ": " << avutils::error_msg(ret)
+                   << ", reading from the beginning";
+      rewind();
+      return;
     }
+    _last_pos = kf.frame_number;
+    _seek_timestamp = kf.timestamp;
+  }
+
+  void rewind() {
+    const int ret = seek(_index->start_timestamp, AVSEEK_FLAG_BACKWARD);
+    CHECK_GE(ret, 0) << "failed to rewind " << _filename << ": "
+                     << avutils::error_msg(ret);
+    _last_pos = 0;
+    _seek_timestamp.reset();
+  }
+
+  int64_t to_stream_timestamp(std::chrono::milliseconds time) const {
+    return _index->start_timestamp
+           + av_rescale_q(time.count(), AVRational{1, 1000}, _stream->time_base);
   }
 
   void send_metadata(streams::observer<encoded_packet> &observer) {
@@ -159,6 +446,9 @@ class file_source_impl {
 
   const std::string _filename;
   const bool _loop{false};
+  const bool _batch{false};
+  const file_range _range;
+  const file_read_options _read_options;
 
   std::chrono::system_clock::time_point _start;
   std::shared_ptr<AVFormatContext> _fmt_ctx;
@@ -169,6 +459,16 @@ class file_source_impl {
   AVPacket _pkt{nullptr};
   int64_t _last_pos{0};
   bool _metadata_sent{false};
+
+  // set only if range is not empty
+  boost::optional<keyframe_index> _index;
+  boost::optional<int64_t> _start_pts;
+  boost::optional<int64_t> _end_pts;
+  // key frame to wait for after seek
+  boost::optional<int64_t> _seek_timestamp;
+
+  // reads from _fmt_ctx, so it's destroyed first
+  std::unique_ptr<packet_prefetcher> _prefetcher;
 };
 
 double get_fps(const std::string &filename) {
@@ -192,15 +492,48 @@ double get_fps(const std::string &filename) {
   return fps;
 }
 
+// Same as streams::asio::interval(), but decode only frames aren't delayed,
+// so reading pre-roll of the range doesn't take real time.
+streams::op<encoded_packet, encoded_packet> frame_interval(
+    boost::asio::io_service &io, std::chrono::milliseconds period) {
+  return [&io, period](streams::publisher<encoded_packet> &&src) {
+    auto last_frame = std::make_shared<std::chrono::system_clock::time_point>();
+    auto frame_delay = [last_frame, period](const encoded_packet &packet) {
+      const encoded_frame *frame = boost::get<encoded_frame>(&packet);
+      if (frame != nullptr && frame->decode_only) {
+        return std::chrono::milliseconds(0);
+      }
+
+      const auto now = std::chrono::system_clock::now();
+      if (!last_frame->time_since_epoch().count()) {
+        *last_frame = now;
+        return std::chrono::milliseconds(0);
+      }
+
+      const auto this_frame_time = *last_frame + period;
+      *last_frame = this_frame_time;
+      if (this_frame_time < now) {
+        LOG(WARNING) << "late frame in interval";
+        return std::chrono::milliseconds(0);
+      }
+      return std::chrono::duration_cast<std::chrono::milliseconds>(this_frame_time - now);
+    };
+    return std::move(src) >> streams::asio::delay(io, std::move(frame_delay));
+  };
+}
+
 }  // namespace
 
 streams::publisher<encoded_packet> file_source(boost::asio::io_service &io,
                                                const std::string &filename, bool loop,
-                                               bool batch) {
+                                               bool batch, const file_range &range,
+                                               const file_read_options &read_options) {
   avutils::init();
   streams::publisher<encoded_packet> result =
       streams::generators<encoded_packet>::stateful(
-          [filename, loop]() { return new file_source_impl(filename, loop); },
+          [filename, loop, batch, range, read_options]() {
+            return new file_source_impl(filename, loop, batch, range, read_options);
+          },
           [](file_source_impl *impl, streams::observer<encoded_packet> &sink) {
             impl->generate_one(sink);
           });
@@ -208,8 +541,8 @@ streams::publisher<encoded_packet> file_source(boost::asio::io_service &io,
   if (!batch) {
     const double fps = get_fps(filename);
     result = std::move(result)
-             >> streams::asio::interval<encoded_packet>(
-                    io, std::chrono::milliseconds(static_cast<long>(1000 / fps)));
+             >> frame_interval(io,
+                               std::chrono::milliseconds(static_cast<long>(1000 / fps)));
   }
 
   return std::move(result) >> repeat_metadata();
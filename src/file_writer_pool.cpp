@@ -0,0 +1,234 @@
+#include "file_writer_pool.h"
+
+#include <string>
+
+#include "logging.h"
+#include "metrics.h"
+#include "threadutils.h"
+
+namespace satori {
+namespace video {
+
+namespace {
+
+// part of the pool time which may be spent writing,
+// the rest absorbs bursts and key frames
+constexpr double capacity_headroom = 0.7;
+
+// weight of the latest measurement in capacity estimate
+constexpr double capacity_smoothing = 0.2;
+
+auto &buffered_bytes = prometheus::BuildGauge()
+                           .Name("file_writer_pool_buffered_bytes")
+                           .Register(metrics_registry())
+                           .Add({});
+
+auto &queued_tasks = prometheus::BuildGauge()
+                         .Name("file_writer_pool_queued_tasks")
+                         .Register(metrics_registry())
+                         .Add({});
+
+auto &batch_size = prometheus::BuildHistogram()
+                       .Name("file_writer_pool_batch_size")
+                       .Register(metrics_registry())
+                       .Add({}, std::vector<double>{0, 1, 2, 3, 4, 5, 10, 20, 50, 100,
+                                                    200, 500, 1000});
+
+}  // namespace
+
+class file_writer_pool::queue {
+ public:
+  queue(size_t max_queued_tasks, std::function<void()> &&after_batch)
+      : max_queued_tasks{max_queued_tasks}, after_batch{std::move(after_batch)} {}
+
+ private:
+  friend class file_writer_pool;
+
+  struct task {
+    std::function<void()> run;
+    uint64_t bytes;
+  };
+
+  const size_t max_queued_tasks;
+  const std::function<void()> after_batch;
+  std::deque<task> tasks;
+  // queue either waits for a thread or is being executed
+  bool scheduled{false};
+  // task of try_push() which didn't fit yet
+  boost::optional<task> waiting;
+  std::function<void()> on_accepted;
+};
+
+file_writer_pool::file_writer_pool(size_t threads_count, uint64_t max_buffered_bytes)
+    : _max_buffered_bytes{max_buffered_bytes},
+      _estimated_at{std::chrono::steady_clock::now()} {
+  CHECK_GT(threads_count, 0);
+  CHECK_GT(max_buffered_bytes, 0);
+  for (size_t i = 0; i < threads_count; i++) {
+    _threads.emplace_back(&file_writer_pool::worker_thread_loop, this, i);
+  }
+}
+
+file_writer_pool::~file_writer_pool() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopped = true;
+  }
+  _on_ready.notify_all();
+  for (auto &t : _threads) {
+    t.join();
+  }
+  CHECK_EQ(0, _queues_count) << "queues outlived file writer pool";
+}
+
+std::shared_ptr<file_writer_pool::queue> file_writer_pool::make_queue(
+    size_t max_queued_tasks, std::function<void()> &&after_batch) {
+  CHECK_GT(max_queued_tasks, 0);
+  _queues_count++;
+  return std::shared_ptr<queue>(new queue{max_queued_tasks, std::move(after_batch)},
+                                [this](queue *q) {
+                                  delete q;
+                                  _queues_count--;
+                                });
+}
+
+void file_writer_pool::push(const std::shared_ptr<queue> &q,
+                            std::function<void()> &&task, uint64_t bytes) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  // waiting tasks go first, so tasks of a queue stay in order
+  _on_done.wait(lock,
+                [this, &q, bytes]() { return _waiting.empty() && fits(*q, bytes); });
+  enqueue(q, std::move(task), bytes);
+}
+
+bool file_writer_pool::try_push(const std::shared_ptr<queue> &q,
+                                std::function<void()> &&task, uint64_t bytes,
+                                std::function<void()> &&on_accepted) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  CHECK(!q->waiting) << "queue already has a waiting task";
+  if (_waiting.empty() && fits(*q, bytes)) {
+    enqueue(q, std::move(task), bytes);
+    return true;
+  }
+
+  q->waiting = queue::task{std::move(task), bytes};
+  q->on_accepted = std::move(on_accepted);
+  _waiting.push_back(q);
+  return false;
+}
+
+bool file_writer_pool::fits(const queue &q, uint64_t bytes) const {
+  // a single task larger than the budget is let through when nothing else is buffered
+  return q.tasks.size() < q.max_queued_tasks
+         && (_buffered_bytes == 0 || _buffered_bytes + bytes <= _max_buffered_bytes);
+}
+
+void file_writer_pool::enqueue(const std::shared_ptr<queue> &q,
+                               std::function<void()> &&task, uint64_t bytes) {
+  q->tasks.push_back(queue::task{std::move(task), bytes});
+  _buffered_bytes += bytes;
+  buffered_bytes.Set(_buffered_bytes);
+  queued_tasks.Increment();
+
+  if (!q->scheduled) {
+    q->scheduled = true;
+    _ready.push_back(q);
+    _on_ready.notify_one();
+  }
+}
+
+void file_writer_pool::drain(const std::shared_ptr<queue> &q) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _on_done.wait(lock, [&q]() { return !q->scheduled && !q->waiting; });
+}
+
+boost::optional<size_t> file_writer_pool::estimate_capacity() {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  const auto now = std::chrono::steady_clock::now();
+  const auto wall_time = (now - _estimated_at) * _threads.size();
+  const auto busy_time = _busy_time - _estimated_busy_time;
+  _estimated_at = now;
+  _estimated_busy_time = _busy_time;
+
+  const size_t queues_count = _queues_count;
+  if (busy_time.count() > 0 && wall_time.count() > 0 && queues_count > 0) {
+    const double utilization = static_cast<double>(busy_time.count()) / wall_time.count();
+    const double capacity = queues_count * capacity_headroom / utilization;
+    _capacity = _capacity ? (1 - capacity_smoothing) * *_capacity
+                                + capacity_smoothing * capacity
+                          : capacity;
+    LOG(2) << "file writer pool utilization " << utilization << ", " << queues_count
+           << " queues, estimated capacity " << *_capacity;
+  }
+
+  return _capacity ? static_cast<size_t>(*_capacity) : boost::optional<size_t>{};
+}
+
+void file_writer_pool::worker_thread_loop(size_t index) {
+  threadutils::set_current_thread_name("file-writer-" + std::to_string(index));
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (true) {
+    _on_ready.wait(lock, [this]() { return _stopped || !_ready.empty(); });
+    if (_ready.empty()) {
+      return;
+    }
+    std::shared_ptr<queue> q = std::move(_ready.front());
+    _ready.pop_front();
+    std::deque<queue::task> batch;
+    batch.swap(q->tasks);
+    lock.unlock();
+    _on_done.notify_all();
+
+    const auto start = std::chrono::steady_clock::now();
+    uint64_t bytes{0};
+    for (auto &t : batch) {
+      t.run();
+      bytes += t.bytes;
+    }
+    if (q->after_batch) {
+      q->after_batch();
+    }
+    const auto busy_time = std::chrono::steady_clock::now() - start;
+    batch_size.Observe(batch.size());
+    queued_tasks.Decrement(batch.size());
+    batch.clear();
+
+    lock.lock();
+    _busy_time += busy_time;
+    _buffered_bytes -= bytes;
+    buffered_bytes.Set(_buffered_bytes);
+    if (q->tasks.empty()) {
+      q->scheduled = false;
+    } else {
+      // goes to the end of the line, so busy queues don't starve others
+      _ready.push_back(std::move(q));
+    }
+
+    std::vector<std::function<void()>> accepted;
+    // waiting tasks are accepted in order of arrival, as budget frees up
+    while (!_waiting.empty()) {
+      std::shared_ptr<queue> w = _waiting.front();
+      if (!fits(*w, w->waiting->bytes)) {
+        break;
+      }
+      _waiting.pop_front();
+      enqueue(w, std::move(w->waiting->run), w->waiting->bytes);
+      w->waiting.reset();
+      accepted.push_back(std::move(w->on_accepted));
+    }
+    if (!accepted.empty()) {
+      lock.unlock();
+      for (auto &on_accepted : accepted) {
+        on_accepted();
+      }
+      accepted.clear();
+      lock.lock();
+    }
+    _on_done.notify_all();
+  }
+}
+
+}  // namespace video
+}  // namespace satori
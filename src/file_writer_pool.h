@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <boost/optional.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace satori {
+namespace video {
+
+// Runs file operations of many video files on a fixed set of threads,
+// so a slow disk doesn't stall the streams and the number of threads
+// doesn't grow with the number of files.
+// Operations pushed to the same queue run in order and never concurrently.
+// Everything a queue has accumulated is executed as one batch.
+class file_writer_pool {
+ public:
+  class queue;
+
+  // Callers of push() block while operations holding more than
+  // max_buffered_bytes are waiting to be executed.
+  file_writer_pool(size_t threads_count, uint64_t max_buffered_bytes);
+
+  // Waits for queued operations to finish.
+  ~file_writer_pool();
+
+  // At most max_queued_tasks operations may wait in the queue,
+  // after_batch is called on a pool thread after every batch.
+  std::shared_ptr<queue> make_queue(size_t max_queued_tasks,
+                                    std::function<void()> &&after_batch = nullptr);
+
+  // bytes is the amount of memory held by the task until it's executed.
+  void push(const std::shared_ptr<queue> &q, std::function<void()> &&task,
+            uint64_t bytes = 0);
+
+  // Same as push(), but never blocks. Returns true if the task is queued,
+  // otherwise the task waits outside of the queue without counting against
+  // the budget, and on_accepted is called on a pool thread once it's queued.
+  // At most one task of a queue may wait.
+  bool try_push(const std::shared_ptr<queue> &q, std::function<void()> &&task,
+                uint64_t bytes, std::function<void()> &&on_accepted);
+
+  // Waits for operations of the queue to finish.
+  void drain(const std::shared_ptr<queue> &q);
+
+  // Number of queues like the existing ones the pool can serve, extrapolated
+  // from the time threads spent writing since the previous call.
+  // Returns none until something is written.
+  boost::optional<size_t> estimate_capacity();
+
+ private:
+  void worker_thread_loop(size_t index);
+
+  // must be called with _mutex held
+  bool fits(const queue &q, uint64_t bytes) const;
+  void enqueue(const std::shared_ptr<queue> &q, std::function<void()> &&task,
+               uint64_t bytes);
+
+  const uint64_t _max_buffered_bytes;
+  std::vector<std::thread> _threads;
+  std::atomic<size_t> _queues_count{0};
+
+  std::mutex _mutex;
+  std::condition_variable _on_ready;
+  std::condition_variable _on_done;
+  std::deque<std::shared_ptr<queue>> _ready;
+  // queues with a task waiting for the budget, in order of arrival
+  std::deque<std::shared_ptr<queue>> _waiting;
+  uint64_t _buffered_bytes{0};
+  bool _stopped{false};
+
+  std::chrono::steady_clock::duration _busy_time{0};
+  std::chrono::steady_clock::duration _estimated_busy_time{0};
+  std::chrono::steady_clock::time_point _estimated_at;
+  boost::optional<double> _capacity;
+};
+
+}  // namespace video
+}  // namespace satori
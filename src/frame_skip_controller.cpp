@@ -0,0 +1,110 @@
+#include "frame_skip_controller.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "logging.h"
+#include "metrics.h"
+
+namespace satori {
+namespace video {
+
+namespace {
+
+auto &live_delivery_ratio = prometheus::BuildGauge()
+                                .Name("live_delivery_ratio")
+                                .Register(metrics_registry())
+                                .Add({});
+
+auto &live_effective_fps = prometheus::BuildGauge()
+                               .Name("live_effective_fps")
+                               .Register(metrics_registry())
+                               .Add({});
+
+auto &live_frames_skipped_total = prometheus::BuildCounter()
+                                      .Name("live_frames_skipped_total")
+                                      .Register(metrics_registry())
+                                      .Add({});
+
+double seconds(std::chrono::microseconds d) {
+  return std::chrono::duration<double>(d).count();
+}
+
+double moving_average(double average, double sample, double smoothing) {
+  return average == 0 ? sample : average + smoothing * (sample - average);
+}
+
+}  // namespace
+
+frame_skip_controller::frame_skip_controller()
+    : frame_skip_controller(settings{}) {}
+
+frame_skip_controller::frame_skip_controller(const settings &s) : _settings(s) {
+  CHECK_GT(_settings.target_latency.count(), 0);
+  CHECK(_settings.min_ratio > 0 && _settings.min_ratio <= 1);
+}
+
+bool frame_skip_controller::on_input_frame(std::chrono::steady_clock::time_point now) {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  if (_has_input && now > _last_input) {
+    const double interval = std::chrono::duration<double>(now - _last_input).count();
+    _input_interval = moving_average(_input_interval, interval, _settings.smoothing);
+  }
+  _has_input = true;
+  _last_input = now;
+
+  // uniform subsampling: every frame adds ratio to the credit,
+  // a frame is delivered when a whole one is accumulated
+  // epsilon keeps rounding errors from skipping an extra frame
+  _credit = std::min(_credit + _ratio, 1.0);
+  if (_credit >= 1.0 - 1e-9) {
+    _credit -= 1.0;
+    return true;
+  }
+  live_frames_skipped_total.Increment();
+  return false;
+}
+
+void frame_skip_controller::on_processed(size_t frames,
+                                         std::chrono::microseconds processing_time,
+                                         std::chrono::microseconds latency) {
+  if (frames == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(_mutex);
+  _frame_processing_time = moving_average(
+      _frame_processing_time, seconds(processing_time) / frames, _settings.smoothing);
+  update_ratio(latency);
+}
+
+double frame_skip_controller::effective_fps() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _input_interval > 0 ? _ratio / _input_interval : 0;
+}
+
+void frame_skip_controller::update_ratio(std::chrono::microseconds latency) {
+  double ratio = 1.0;
+  if (_input_interval > 0 && _frame_processing_time > 0) {
+    // share of input frames the bot keeps up with
+    ratio = _input_interval / _frame_processing_time;
+  }
+  if (latency > _settings.target_latency) {
+    // frames are already queued, deliver less than the bot can take
+    // until the queue is drained
+    ratio *= seconds(_settings.target_latency) / seconds(latency);
+  }
+  ratio = std::max(_settings.min_ratio, std::min(ratio, 1.0));
+
+  if (std::abs(ratio - _ratio) >= 0.05) {
+    LOG(INFO) << "Changing live frames delivery ratio " << _ratio << " -> " << ratio;
+  }
+  _ratio = ratio;
+  live_delivery_ratio.Set(ratio);
+  if (_input_interval > 0) {
+    live_effective_fps.Set(ratio / _input_interval);
+  }
+}
+
+}  // namespace video
+}  // namespace satori
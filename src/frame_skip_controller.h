@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+namespace satori {
+namespace video {
+
+// Chooses which live frames are decoded and passed to the bot, so that frames
+// wait for the bot no longer than target_latency. Bot capacity is estimated from
+// processing time per frame and compared to input frame rate, delivered frames
+// are uniformly subsampled from the input.
+class frame_skip_controller {
+ public:
+  struct settings {
+    std::chrono::milliseconds target_latency{500};
+    // weight of a new sample in moving averages
+    double smoothing{0.1};
+    // smallest share of input frames that is still delivered
+    double min_ratio{0.05};
+  };
+
+  frame_skip_controller();
+  explicit frame_skip_controller(const settings &s);
+
+  // Called by decoder for every input frame, returns false if the frame should be
+  // skipped.
+  bool on_input_frame(
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+  // Called after the bot has processed a batch of frames, latency is the time from
+  // the first frame of the batch being queued until the batch is processed.
+  void on_processed(size_t frames, std::chrono::microseconds processing_time,
+                    std::chrono::microseconds latency);
+
+  // Share of input frames that is delivered.
+  double ratio() const { return _ratio; }
+
+  double effective_fps() const;
+
+ private:
+  void update_ratio(std::chrono::microseconds latency);
+
+  const settings _settings;
+  std::atomic<double> _ratio{1.0};
+
+  mutable std::mutex _mutex;
+  bool _has_input{false};
+  std::chrono::steady_clock::time_point _last_input;
+  // moving averages, in seconds
+  double _input_interval{0};
+  double _frame_processing_time{0};
+  double _credit{0};
+};
+
+}  // namespace video
+}  // namespace satori
@@ -0,0 +1,90 @@
+#include "frame_trace.h"
+
+#include "metrics.h"
+
+namespace satori {
+namespace video {
+
+namespace {
+
+using time_point = std::chrono::steady_clock::time_point;
+
+constexpr std::initializer_list<double> stage_buckets = {
+    0,   0.5, 1,   2,   3,   4,   5,    6,    7,    8,    9,    10,   15,   20,
+    25,  30,  40,  50,  60,  70,  80,   90,   100,  150,  200,  250,  300,  400,
+    500, 600, 700, 800, 900, 1000, 2000, 3000, 4000, 5000, 10000, 30000, 60000};
+
+auto &frame_latency_millis_family = prometheus::BuildHistogram()
+                                        .Name("frame_latency_breakdown_millis")
+                                        .Register(metrics_registry());
+
+auto &receive_millis = frame_latency_millis_family.Add(
+    {{"stage", "receive"}}, std::vector<double>(stage_buckets));
+auto &decode_millis = frame_latency_millis_family.Add(
+    {{"stage", "decode"}}, std::vector<double>(stage_buckets));
+auto &queue_millis = frame_latency_millis_family.Add({{"stage", "queue"}},
+                                                     std::vector<double>(stage_buckets));
+auto &callback_millis = frame_latency_millis_family.Add(
+    {{"stage", "callback"}}, std::vector<double>(stage_buckets));
+auto &publish_millis = frame_latency_millis_family.Add(
+    {{"stage", "publish"}}, std::vector<double>(stage_buckets));
+auto &total_millis = frame_latency_millis_family.Add({{"stage", "total"}},
+                                                     std::vector<double>(stage_buckets));
+
+// stage times from another clock may be out of order
+bool passed(time_point from, time_point to) {
+  return from != time_point{} && to != time_point{} && to >= from;
+}
+
+double millis(time_point from, time_point to) {
+  return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+void observe(prometheus::Histogram &histogram, time_point from, time_point to) {
+  if (passed(from, to)) {
+    histogram.Observe(millis(from, to));
+  }
+}
+
+}  // namespace
+
+std::chrono::steady_clock::time_point steady_time(
+    std::chrono::system_clock::time_point t) {
+  if (t == std::chrono::system_clock::time_point{}) {
+    return {};
+  }
+  return std::chrono::steady_clock::now()
+         - std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+               std::chrono::system_clock::now() - t);
+}
+
+void observe_frame_stages(const frame_trace &trace) {
+  observe(receive_millis, trace.arrival, trace.decode_start);
+  observe(decode_millis, trace.decode_start, trace.decode_end);
+  observe(queue_millis, trace.decode_end, trace.callback_start);
+  observe(callback_millis, trace.callback_start, trace.callback_end);
+}
+
+void observe_message_stages(const frame_trace &trace, time_point published) {
+  observe(publish_millis, trace.callback_end, published);
+  observe(total_millis, trace.arrival, published);
+}
+
+nlohmann::json frame_trace_to_json(const frame_trace &trace, time_point published) {
+  nlohmann::json stages = nlohmann::json::object();
+  auto add = [&stages](const char *name, time_point from, time_point to) {
+    if (passed(from, to)) {
+      stages[name] = millis(from, to);
+    }
+  };
+  add("receive", trace.arrival, trace.decode_start);
+  add("decode", trace.decode_start, trace.decode_end);
+  add("queue", trace.decode_end, trace.callback_start);
+  add("callback", trace.callback_start, trace.callback_end);
+  add("publish", trace.callback_end, published);
+  add("total", trace.arrival, published);
+  return stages;
+}
+
+}  // namespace video
+}  // namespace satori
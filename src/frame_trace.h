@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+#include <json.hpp>
+
+#include "data.h"
+
+namespace satori {
+namespace video {
+
+// Converts source time like encoded_frame::creation_time to steady clock,
+// default constructed time stays unset.
+std::chrono::steady_clock::time_point steady_time(
+    std::chrono::system_clock::time_point t);
+
+// Observes time a frame spent in every stage up to the end of bot callback:
+// receive (source to decoder), decode, queue (waiting for bot) and callback.
+void observe_frame_stages(const frame_trace &trace);
+
+// Observes publish stage (end of callback to the time message is published)
+// and the total time from frame arrival until the message is published.
+void observe_message_stages(const frame_trace &trace,
+                            std::chrono::steady_clock::time_point published);
+
+// Durations of passed stages in milliseconds, for example
+// {"receive": 1.2, "decode": 4.5, "queue": 20.1, "callback": 15.3, ...}
+nlohmann::json frame_trace_to_json(const frame_trace &trace,
+                                   std::chrono::steady_clock::time_point published);
+
+}  // namespace video
+}  // namespace satori
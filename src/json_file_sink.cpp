@@ -0,0 +1,153 @@
+#include "json_file_sink.h"
+
+#include <boost/iostreams/device/file.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <limits>
+
+#include "logging.h"
+#include "metrics.h"
+
+namespace satori {
+namespace video {
+namespace streams {
+
+namespace {
+
+namespace fs = boost::filesystem;
+namespace io = boost::iostreams;
+
+auto &written_bytes = prometheus::BuildCounter()
+                          .Name("json_file_sink_written_bytes_total")
+                          .Register(metrics_registry())
+                          .Add({});
+
+auto &rotated_files = prometheus::BuildCounter()
+                          .Name("json_file_sink_rotated_files_total")
+                          .Register(metrics_registry())
+                          .Add({});
+
+fs::path rotated_path(const fs::path &path, size_t index) {
+  if (index == 0) {
+    return path;
+  }
+  return path.parent_path()
+         / (path.stem().string() + "." + std::to_string(index)
+            + path.extension().string());
+}
+
+class json_file_observer : public streams::observer<nlohmann::json> {
+ public:
+  json_file_observer(const fs::path &path, const json_file_options &options,
+                     const std::shared_ptr<file_writer_pool> &writer_pool)
+      : _path{path},
+        _options{options},
+        _writer_pool{writer_pool ? writer_pool
+                                 : std::make_shared<file_writer_pool>(
+                                       1, std::numeric_limits<uint64_t>::max())} {
+    _write_queue = _writer_pool->make_queue(_options.max_queued_messages,
+                                            [this]() { write_buffer(); });
+  }
+
+ private:
+  void on_next(nlohmann::json &&t) override {
+    _writer_pool->push(_write_queue, [ this, t = std::move(t) ]() {
+      _buffer += t.dump();
+      _buffer += '\n';
+    });
+  }
+
+  void on_error(std::error_condition ec) override {
+    LOG(ERROR) << "ERROR: " << ec.message();
+    close();
+  }
+
+  void on_complete() override { close(); }
+
+  void close() {
+    _writer_pool->push(_write_queue, [this]() {
+      write_buffer();
+      if (!_out && _file_index == 0) {
+        // the file exists even if there were no messages
+        open_file();
+      }
+      close_file();
+    });
+    // pending file operations refer to this sink
+    _writer_pool->drain(_write_queue);
+    delete this;
+  }
+
+  // Runs on a pool thread after every batch of messages.
+  void write_buffer() {
+    if (_buffer.empty()) {
+      return;
+    }
+    if (!_out) {
+      open_file();
+    }
+    _out->write(_buffer.data(), _buffer.size());
+    _out->flush();
+    CHECK(_out->good()) << "failed to write " << rotated_path(_path, _file_index);
+    written_bytes.Increment(_buffer.size());
+    _file_bytes += _buffer.size();
+    _buffer.clear();
+
+    if (_options.max_file_bytes > 0 && _file_bytes >= _options.max_file_bytes) {
+      close_file();
+      _file_index++;
+      rotated_files.Increment();
+    }
+  }
+
+  void open_file() {
+    const fs::path path = rotated_path(_path, _file_index);
+    io::file_sink file{path.string(), std::ios::out | std::ios::binary | std::ios::trunc};
+    CHECK(file.is_open()) << "failed to open " << path;
+    LOG(INFO) << "writing messages to " << path;
+
+    _out = std::make_unique<io::filtering_ostream>();
+    if (_options.compression == json_file_compression::GZIP) {
+      _out->push(io::gzip_compressor{});
+    }
+    _out->push(file);
+    _file_bytes = 0;
+  }
+
+  // Closing the chain writes compression trailer.
+  void close_file() { _out.reset(); }
+
+  const fs::path _path;
+  const json_file_options _options;
+  const std::shared_ptr<file_writer_pool> _writer_pool;
+  std::shared_ptr<file_writer_pool::queue> _write_queue;
+
+  // accessed only by pool threads
+  std::string _buffer;
+  std::unique_ptr<io::filtering_ostream> _out;
+  uint64_t _file_bytes{0};
+  size_t _file_index{0};
+};
+
+}  // namespace
+
+boost::optional<json_file_compression> parse_json_file_compression(
+    const std::string &name) {
+  if (name == "none") {
+    return json_file_compression::NONE;
+  }
+  if (name == "gzip") {
+    return json_file_compression::GZIP;
+  }
+  return boost::none;
+}
+
+streams::observer<nlohmann::json> &json_file_sink(
+    const boost::filesystem::path &path, const json_file_options &options,
+    const std::shared_ptr<file_writer_pool> &writer_pool) {
+  return *(new json_file_observer(path, options, writer_pool));
+}
+
+}  // namespace streams
+}  // namespace video
+}  // namespace satori
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+#include <cstdint>
+#include <json.hpp>
+#include <memory>
+#include <string>
+
+#include "file_writer_pool.h"
+#include "streams/streams.h"
+
+namespace satori {
+namespace video {
+namespace streams {
+
+enum class json_file_compression { NONE = 1, GZIP = 2 };
+
+// Returns none for unknown names, known names are "none" and "gzip".
+boost::optional<json_file_compression> parse_json_file_compression(
+    const std::string &name);
+
+struct json_file_options {
+  json_file_compression compression{json_file_compression::NONE};
+
+  // When a file has received this many bytes of uncompressed output, the next
+  // messages go to <stem>.1<extension>, <stem>.2<extension> and so on.
+  // Files are switched between write batches, 0 disables rotation.
+  uint64_t max_file_bytes{0};
+
+  // Callers of on_next() block while the file is this many messages behind.
+  size_t max_queued_messages{100000};
+};
+
+// Writes messages as lines of JSON. Messages are serialized and written on
+// a pool thread, everything queued since the previous write goes to the file
+// in one call. Completion waits until all messages are written and the file
+// is closed. If writer_pool is null, the sink starts its own thread.
+streams::observer<nlohmann::json> &json_file_sink(
+    const boost::filesystem::path &path, const json_file_options &options = {},
+    const std::shared_ptr<file_writer_pool> &writer_pool = nullptr);
+
+}  // namespace streams
+}  // namespace video
+}  // namespace satori
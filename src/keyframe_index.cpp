@@ -0,0 +1,213 @@
+#include "keyframe_index.h"
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+#include <fstream>
+#include <gsl/gsl>
+#include <json.hpp>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "avutils.h"
+#include "logging.h"
+#include "stopwatch.h"
+#include "video_error.h"
+
+namespace satori {
+namespace video {
+
+namespace {
+
+namespace fs = boost::filesystem;
+
+constexpr int cache_version = 1;
+
+// tells if cached index belongs to the current version of the file
+nlohmann::json file_signature(const std::string &filename) {
+  boost::system::error_code ec;
+  nlohmann::json result = nlohmann::json::object();
+  result["version"] = cache_version;
+  result["size"] = fs::file_size(filename, ec);
+  result["mtime"] = static_cast<int64_t>(fs::last_write_time(filename, ec));
+  return result;
+}
+
+boost::optional<keyframe_index> read_cache(const std::string &cache_filename,
+                                           const nlohmann::json &signature) {
+  std::ifstream input(cache_filename);
+  if (!input) {
+    return {};
+  }
+
+  try {
+    nlohmann::json cache = nlohmann::json::parse(input);
+    if (cache["signature"] != signature) {
+      LOG(INFO) << "keyframe index " << cache_filename << " is stale";
+      return {};
+    }
+
+    keyframe_index index;
+    index.stream_index = cache["stream_index"];
+    index.time_base_num = cache["time_base"][0];
+    index.time_base_den = cache["time_base"][1];
+    index.start_timestamp = cache["start_timestamp"];
+    index.frames_count = cache["frames_count"];
+    for (const auto &kf : cache["key_frames"]) {
+      index.key_frames.push_back(
+          keyframe_index::key_frame{kf[0].get<uint64_t>(), kf[1].get<int64_t>()});
+    }
+    if (index.key_frames.empty()) {
+      return {};
+    }
+    return index;
+  } catch (const std::exception &e) {
+    LOG(WARNING) << "failed to read keyframe index " << cache_filename << ": "
+                 << e.what();
+    return {};
+  }
+}
+
+void write_cache(const std::string &cache_filename, const nlohmann::json &signature,
+                 const keyframe_index &index) {
+  nlohmann::json cache = nlohmann::json::object();
+  cache["signature"] = signature;
+  cache["stream_index"] = index.stream_index;
+  cache["time_base"] = {index.time_base_num, index.time_base_den};
+  cache["start_timestamp"] = index.start_timestamp;
+  cache["frames_count"] = index.frames_count;
+  cache["key_frames"] = nlohmann::json::array();
+  for (const auto &kf : index.key_frames) {
+    cache["key_frames"].push_back({kf.frame_number, kf.timestamp});
+  }
+
+  // cache is written next to the file, archives may be read-only
+  const std::string temp_filename = cache_filename + ".tmp";
+  std::ofstream output(temp_filename);
+  output << cache;
+  output.close();
+  boost::system::error_code ec;
+  if (output) {
+    fs::rename(temp_filename, cache_filename, ec);
+  }
+  if (!output || ec.value() != 0) {
+    LOG(WARNING) << "failed to write keyframe index " << cache_filename;
+    fs::remove(temp_filename, ec);
+  }
+}
+
+streams::error_or<keyframe_index> build_index(const std::string &filename) {
+  LOG(INFO) << "Building keyframe index of " << filename;
+  stopwatch<> s;
+
+  std::shared_ptr<AVFormatContext> fmt_ctx = avutils::open_input_format_context(filename);
+  if (!fmt_ctx) {
+    return std::error_condition{video_error::STREAM_INITIALIZATION_ERROR};
+  }
+  const int stream_index = avutils::find_best_video_stream(fmt_ctx.get(), nullptr);
+  if (stream_index < 0) {
+    return std::error_condition{video_error::STREAM_INITIALIZATION_ERROR};
+  }
+  const AVStream *stream = fmt_ctx->streams[stream_index];
+
+  keyframe_index index;
+  index.stream_index = stream_index;
+  index.time_base_num = stream->time_base.num;
+  index.time_base_den = stream->time_base.den;
+  index.start_timestamp = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+  index.frames_count = 0;
+
+  AVPacket pkt;
+  av_init_packet(&pkt);
+  pkt.data = nullptr;
+  pkt.size = 0;
+  int ret;
+  while ((ret = av_read_frame(fmt_ctx.get(), &pkt)) >= 0) {
+    auto release = gsl::finally([&pkt]() { av_packet_unref(&pkt); });
+    if (pkt.stream_index != stream_index) {
+      continue;
+    }
+    const int64_t timestamp = pkt.pts != AV_NOPTS_VALUE ? pkt.pts : pkt.dts;
+    if ((pkt.flags & AV_PKT_FLAG_KEY) != 0 || index.key_frames.empty()) {
+      index.key_frames.push_back(
+          keyframe_index::key_frame{index.frames_count, timestamp});
+    }
+    index.frames_count++;
+  }
+  if (ret != AVERROR_EOF) {
+    LOG(ERROR) << "failed to read " << filename << ": " << avutils::error_msg(ret);
+    return std::error_condition{video_error::FRAME_GENERATION_ERROR};
+  }
+  if (index.frames_count == 0) {
+    LOG(ERROR) << "no video frames in " << filename;
+    return std::error_condition{video_error::END_OF_STREAM_ERROR};
+  }
+
+  LOG(INFO) << "Keyframe index of " << filename << " has " << index.key_frames.size()
+            << " key frames out of " << index.frames_count << ", built in " << s.millis()
+            << "ms";
+  return index;
+}
+
+}  // namespace
+
+const keyframe_index::key_frame &keyframe_index::key_frame_for_frame(
+    uint64_t frame_number) const {
+  CHECK(!key_frames.empty());
+  auto it = std::upper_bound(
+      key_frames.begin(), key_frames.end(), frame_number,
+      [](uint64_t n, const key_frame &kf) { return n < kf.frame_number; });
+  return it == key_frames.begin() ? *it : *(it - 1);
+}
+
+const keyframe_index::key_frame &keyframe_index::key_frame_for_timestamp(
+    int64_t timestamp) const {
+  CHECK(!key_frames.empty());
+  auto it =
+      std::upper_bound(key_frames.begin(), key_frames.end(), timestamp,
+                       [](int64_t t, const key_frame &kf) { return t < kf.timestamp; });
+  return it == key_frames.begin() ? *it : *(it - 1);
+}
+
+std::vector<file_range> keyframe_index::split(size_t segments_count) const {
+  CHECK_GT(segments_count, 0);
+
+  std::vector<uint64_t> starts;
+  for (size_t i = 0; i < segments_count; i++) {
+    const uint64_t target = frames_count * i / segments_count;
+    const uint64_t start = key_frame_for_frame(target).frame_number;
+    if (starts.empty() || start > starts.back()) {
+      starts.push_back(start);
+    }
+  }
+
+  std::vector<file_range> result(starts.size());
+  for (size_t i = 0; i < starts.size(); i++) {
+    result[i].start_frame = starts[i];
+    if (i + 1 < starts.size()) {
+      result[i].end_frame = starts[i + 1];
+    }
+  }
+  return result;
+}
+
+streams::error_or<keyframe_index> load_keyframe_index(const std::string &filename) {
+  const std::string cache_filename = filename + ".keyframes";
+  const nlohmann::json signature = file_signature(filename);
+
+  if (auto cached = read_cache(cache_filename, signature)) {
+    LOG(1) << "Using cached keyframe index " << cache_filename;
+    return *cached;
+  }
+
+  auto index = build_index(filename);
+  if (index.ok()) {
+    write_cache(cache_filename, signature, index.get());
+  }
+  return index;
+}
+
+}  // namespace video
+}  // namespace satori
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "streams/error_or.h"
+#include "video_streams.h"
+
+namespace satori {
+namespace video {
+
+// Positions of key frames of the best video stream of a file.
+// Frames are numbered from zero in decoding order,
+// timestamps are in stream time base.
+struct keyframe_index {
+  struct key_frame {
+    uint64_t frame_number;
+    int64_t timestamp;
+  };
+
+  int stream_index;
+  int time_base_num;
+  int time_base_den;
+  int64_t start_timestamp;
+  uint64_t frames_count;
+  std::vector<key_frame> key_frames;
+
+  // Returns the last key frame at or before given frame, or the first key frame.
+  const key_frame &key_frame_for_frame(uint64_t frame_number) const;
+
+  // Returns the last key frame at or before given timestamp, or the first key frame.
+  const key_frame &key_frame_for_timestamp(int64_t timestamp) const;
+
+  // Splits the file into at most segments_count frame ranges of similar length,
+  // each starting at a key frame. The last range is open-ended.
+  std::vector<file_range> split(size_t segments_count) const;
+};
+
+// Index is built by demuxing the whole file and is cached in <filename>.keyframes,
+// so next calls for the same unchanged file are fast.
+streams::error_or<keyframe_index> load_keyframe_index(const std::string &filename);
+
+}  // namespace video
+}  // namespace satori
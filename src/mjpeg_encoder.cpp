@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+#include "avutils.h"
+#include "logging.h"
+#include "metrics.h"
+#include "stopwatch.h"
+#include "streams/error_or.h"
+#include "threadutils.h"
+#include "video_error.h"
+#include "video_streams.h"
+
+namespace satori {
+namespace video {
+
+namespace {
+
+auto &encode_frame_millis =
+    prometheus::BuildHistogram()
+        .Name("mjpeg_encoder_encode_frame_millis")
+        .Register(metrics_registry())
+        .Add({}, std::vector<double>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 15, 20, 25, 30,
+                                     40, 50, 75, 100, 200, 500});
+
+auto &frames_in_flight = prometheus::BuildGauge()
+                             .Name("mjpeg_encoder_frames_in_flight")
+                             .Register(metrics_registry())
+                             .Add({});
+
+// MJPEG frames are independent from each other, so every worker thread owns
+// its own encoder context and frames can be encoded in any order.
+class mjpeg_thread_encoder {
+ public:
+  streams::error_or<encoded_frame> encode(const owned_image_frame &f) {
+    if (!_encoder_context || f.width != _encoder_context->width
+        || f.height != _encoder_context->height || f.pixel_format != _pixel_format) {
+      if (auto ec = init(f)) {
+        return ec;
+      }
+    }
+
+    stopwatch<> s;
+    // single pass conversion straight from image planes
+    avutils::sws_scale(_sws_context, f, _frame);
+    _frame->pts = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      f.timestamp.time_since_epoch())
+                      .count();
+
+    int ret = avcodec_send_frame(_encoder_context.get(), _frame.get());
+    if (ret < 0) {
+      LOG(ERROR) << "avcodec_send_frame error: " << avutils::error_msg(ret);
+      return std::error_condition{video_error::FRAME_GENERATION_ERROR};
+    }
+
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = nullptr;
+    packet.size = 0;
+    ret = avcodec_receive_packet(_encoder_context.get(), &packet);
+    if (ret < 0) {
+      LOG(ERROR) << "avcodec_receive_packet error: " << avutils::error_msg(ret);
+      return std::error_condition{video_error::FRAME_GENERATION_ERROR};
+    }
+
+    encoded_frame frame;
+    frame.data.assign(packet.data, packet.data + packet.size);
+    frame.id = f.id;
+    frame.timestamp = f.timestamp;
+    frame.creation_time = std::chrono::system_clock::now();
+    frame.key_frame = true;
+    av_packet_unref(&packet);
+
+    encode_frame_millis.Observe(s.millis());
+    return std::move(frame);
+  }
+
+ private:
+  std::error_condition init(const owned_image_frame &f) {
+    LOG(INFO) << "Initializing mjpeg encoder " << f.width << "x" << f.height;
+    _encoder_context = avutils::encoder_context(AV_CODEC_ID_MJPEG);
+    if (!_encoder_context) {
+      return video_error::STREAM_INITIALIZATION_ERROR;
+    }
+    _encoder_context->width = f.width;
+    _encoder_context->height = f.height;
+    // parallelism is achieved by running several encoders
+    _encoder_context->thread_count = 1;
+
+    int ret = avcodec_open2(_encoder_context.get(), nullptr, nullptr);
+    if (ret < 0) {
+      LOG(ERROR) << "Failed to open mjpeg encoder: " << avutils::error_msg(ret);
+      _encoder_context.reset();
+      return video_error::STREAM_INITIALIZATION_ERROR;
+    }
+
+    _pixel_format = f.pixel_format;
+    const AVPixelFormat av_pixel_format = avutils::to_av_pixel_format(f.pixel_format);
+    _frame = avutils::av_frame(f.width, f.height, 1, _encoder_context->pix_fmt);
+    _sws_context = avutils::sws_context(f.width, f.height, av_pixel_format, f.width,
+                                        f.height, _encoder_context->pix_fmt);
+    if (!_frame || !_sws_context) {
+      _encoder_context.reset();
+      return video_error::STREAM_INITIALIZATION_ERROR;
+    }
+
+    return {};
+  }
+
+  image_pixel_format _pixel_format;
+  std::shared_ptr<AVCodecContext> _encoder_context{nullptr};
+  std::shared_ptr<AVFrame> _frame{nullptr};  // for pixel format conversion
+  std::shared_ptr<SwsContext> _sws_context{nullptr};
+};
+
+// Encodes frames on a pool of threads and hands them out in submission order.
+class mjpeg_encoder_pool {
+ public:
+  mjpeg_encoder_pool(size_t threads_count, size_t max_frames_in_flight)
+      : _max_frames_in_flight(max_frames_in_flight) {
+    CHECK_GT(threads_count, 0);
+    CHECK_GE(max_frames_in_flight, threads_count);
+    LOG(INFO) << "Starting mjpeg encoder pool: threads=" << threads_count
+              << ", max_frames_in_flight=" << max_frames_in_flight;
+
+    for (size_t i = 0; i < threads_count; i++) {
+      _workers.emplace_back(&mjpeg_encoder_pool::worker_thread_loop, this, i);
+    }
+  }
+
+  ~mjpeg_encoder_pool() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopped = true;
+    }
+    _on_job.notify_all();
+    _on_result.notify_all();
+
+    for (auto &w : _workers) {
+      w.join();
+    }
+    frames_in_flight.Decrement(_submitted - _delivered);
+    LOG(INFO) << "Stopped mjpeg encoder pool";
+  }
+
+  // Blocks while too many frames are being encoded. Encoded frames are
+  // taken by the same thread after submit(), so they don't count.
+  void submit(owned_image_frame &&f) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _on_result.wait(lock, [this]() {
+      return _stopped
+             || _submitted - _delivered - _results.size() < _max_frames_in_flight;
+    });
+
+    _jobs.push(job{_submitted, std::move(f)});
+    _submitted++;
+    frames_in_flight.Increment();
+    _on_job.notify_one();
+  }
+
+  // Returns encoded frames which are next in submission order,
+  // if wait_all is set, waits until all submitted frames are encoded.
+  std::vector<encoded_packet> take_ready(bool wait_all, std::error_condition &ec) {
+    std::vector<encoded_packet> result;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (wait_all) {
+      _on_result.wait(lock, [this]() {
+        return _stopped || _results.size() == _submitted - _delivered;
+      });
+    }
+
+    for (auto it = _results.find(_delivered); it != _results.end();
+         it = _results.find(_delivered)) {
+      if (!it->second.ok()) {
+        ec = it->second.error_condition();
+        return result;
+      }
+      result.emplace_back(it->second.move());
+      _results.erase(it);
+      _delivered++;
+      frames_in_flight.Decrement();
+    }
+    _on_result.notify_all();
+
+    return result;
+  }
+
+ private:
+  struct job {
+    uint64_t seq;
+    owned_image_frame frame;
+  };
+
+  void worker_thread_loop(size_t idx) {
+    threadutils::set_current_thread_name("mjpeg-" + std::to_string(idx));
+    mjpeg_thread_encoder encoder;
+
+    while (true) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _on_job.wait(lock, [this]() { return _stopped || !_jobs.empty(); });
+      if (_stopped) {
+        return;
+      }
+
+      job j = std::move(_jobs.front());
+      _jobs.pop();
+      lock.unlock();
+
+      auto result = encoder.encode(j.frame);
+
+      lock.lock();
+      _results.emplace(j.seq, std::move(result));
+      _on_result.notify_all();
+    }
+  }
+
+  const uint64_t _max_frames_in_flight;
+  std::vector<std::thread> _workers;
+
+  std::mutex _mutex;
+  std::condition_variable _on_job;
+  std::condition_variable _on_result;
+  std::queue<job> _jobs;
+  std::map<uint64_t, streams::error_or<encoded_frame>> _results;
+  uint64_t _submitted{0};
+  uint64_t _delivered{0};
+  bool _stopped{false};
+};
+
+streams::publisher<encoded_packet> to_publisher(std::vector<encoded_packet> &&packets,
+                                                std::error_condition ec) {
+  if (ec) {
+    return streams::publishers::error<encoded_packet>(ec);
+  }
+  if (packets.empty()) {
+    return streams::publishers::empty<encoded_packet>();
+  }
+  return streams::publishers::of(std::move(packets));
+}
+
+}  // namespace
+
+streams::op<owned_image_packet, encoded_packet> encode_as_mjpeg(
+    size_t threads_count, size_t max_frames_in_flight) {
+  avutils::init();
+
+  if (threads_count == 0) {
+    threads_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+  if (max_frames_in_flight == 0) {
+    max_frames_in_flight = 2 * threads_count;
+  }
+
+  return [threads_count,
+          max_frames_in_flight](streams::publisher<owned_image_packet> &&src) {
+    auto pool = new mjpeg_encoder_pool(threads_count, max_frames_in_flight);
+    auto metadata_sent = std::make_shared<bool>(false);
+
+    auto frames = std::move(src) >> streams::flat_map([pool, metadata_sent](
+                                          owned_image_packet &&p) {
+      owned_image_frame *f = boost::get<owned_image_frame>(&p);
+      if (f == nullptr) {
+        return streams::publishers::empty<encoded_packet>();
+      }
+
+      pool->submit(std::move(*f));
+
+      std::error_condition ec;
+      std::vector<encoded_packet> packets;
+      if (!*metadata_sent) {
+        // MJPEG doesn't have codec data
+        packets.emplace_back(encoded_metadata{"mjpeg", ""});
+        *metadata_sent = true;
+      }
+      for (auto &&packet : pool->take_ready(false, ec)) {
+        packets.emplace_back(std::move(packet));
+      }
+      return to_publisher(std::move(packets), ec);
+    });
+
+    auto remaining = streams::generators<encoded_packet>::stateful(
+        []() { return new std::queue<encoded_packet>; },
+        [pool](std::queue<encoded_packet> *packets,
+               streams::observer<encoded_packet> &sink) {
+          if (packets->empty()) {
+            std::error_condition ec;
+            for (auto &&packet : pool->take_ready(true, ec)) {
+              packets->push(std::move(packet));
+            }
+            if (ec) {
+              sink.on_error(ec);
+              return;
+            }
+          }
+          if (packets->empty()) {
+            sink.on_complete();
+            return;
+          }
+          sink.on_next(std::move(packets->front()));
+          packets->pop();
+        });
+
+    return streams::publishers::concat(std::move(frames), std::move(remaining))
+           >> streams::do_finally([pool]() {
+               LOG(INFO) << "Deleting mjpeg encoder pool";
+               delete pool;
+             });
+  };
+}
+
+}  // namespace video
+}  // namespace satori
@@ -24,7 +24,7 @@ bot_img_callback_t to_bot_img_callback(const opencv_bot_img_callback_t &callback
 
 void opencv_bot_register(const opencv_bot_descriptor &bot) {
   bot_register({image_pixel_format::BGR, to_bot_img_callback(bot.img_callback),
-                bot.ctrl_callback});
+                bot.ctrl_callback, bot.state});
 }
 
 int opencv_bot_main(int argc, char **argv) { return bot_main(argc, argv); }
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "logging.h"
+#include "video_streams.h"
+
+namespace satori {
+namespace video {
+namespace {
+
+// Position of the playlist stream after the frames published so far.
+struct playlist_timeline {
+  int64_t last_id{0};
+  bool started{false};
+  std::chrono::system_clock::time_point last_timestamp;
+  // smallest positive timestamp step seen, so B-frames don't inflate it
+  std::chrono::system_clock::duration frame_duration{0};
+};
+
+// Shifts frame ids and timestamps of one file to continue the playlist timeline.
+class file_offsets {
+ public:
+  explicit file_offsets(std::shared_ptr<playlist_timeline> timeline)
+      : _timeline(std::move(timeline)) {}
+
+  encoded_packet operator()(encoded_packet &&packet) {
+    encoded_frame *frame = boost::get<encoded_frame>(&packet);
+    if (frame == nullptr) {
+      return std::move(packet);
+    }
+
+    playlist_timeline &timeline = *_timeline;
+    if (_first_frame) {
+      _first_frame = false;
+      _id_offset = timeline.last_id;
+      if (timeline.started) {
+        _time_offset =
+            timeline.last_timestamp + timeline.frame_duration - frame->timestamp;
+      }
+    }
+
+    frame->id.i1 += _id_offset;
+    frame->id.i2 += _id_offset;
+    frame->timestamp += _time_offset;
+
+    if (timeline.started && frame->timestamp > timeline.last_timestamp) {
+      const auto step = frame->timestamp - timeline.last_timestamp;
+      if (timeline.frame_duration.count() == 0 || step < timeline.frame_duration) {
+        timeline.frame_duration = step;
+      }
+    }
+    if (!timeline.started || frame->timestamp > timeline.last_timestamp) {
+      timeline.last_timestamp = frame->timestamp;
+    }
+    timeline.last_id = std::max(timeline.last_id, frame->id.i2);
+    timeline.started = true;
+    return std::move(packet);
+  }
+
+ private:
+  const std::shared_ptr<playlist_timeline> _timeline;
+  bool _first_frame{true};
+  int64_t _id_offset{0};
+  std::chrono::system_clock::duration _time_offset{0};
+};
+
+struct playlist_state {
+  boost::asio::io_service &io;
+  const std::vector<std::string> filenames;
+  const bool loop;
+  const bool batch;
+  const file_read_options read_options;
+  std::shared_ptr<playlist_timeline> timeline;
+  size_t next{0};
+
+  void generate_one(streams::observer<streams::publisher<encoded_packet>> &observer) {
+    if (next == filenames.size()) {
+      if (!loop || filenames.empty()) {
+        observer.on_complete();
+        return;
+      }
+      LOG(4) << "restarting playlist";
+      next = 0;
+    }
+
+    const std::string &filename = filenames[next++];
+    LOG(1) << "playlist continues with " << filename;
+    observer.on_next(file_source(io, filename, false, batch, file_range{}, read_options)
+                     >> streams::map(file_offsets{timeline}));
+  }
+};
+
+}  // namespace
+
+streams::publisher<encoded_packet> playlist_source(
+    boost::asio::io_service &io, const std::vector<std::string> &filenames, bool loop,
+    bool batch, const file_read_options &read_options) {
+  return streams::generators<streams::publisher<encoded_packet>>::stateful(
+             [&io, filenames, loop, batch, read_options]() {
+               return new playlist_state{io,
+                                         filenames,
+                                         loop,
+                                         batch,
+                                         read_options,
+                                         std::make_shared<playlist_timeline>()};
+             },
+             [](playlist_state *state,
+                streams::observer<streams::publisher<encoded_packet>> &sink) {
+               state->generate_one(sink);
+             })
+         >> streams::flat_map(
+                [](streams::publisher<encoded_packet> &&p) { return std::move(p); });
+}
+
+}  // namespace video
+}  // namespace satori
@@ -23,8 +23,18 @@ pool_job_controller::pool_job_controller(boost::asio::io_service &io,
                                          size_t max_streams_capacity,
                                          std::shared_ptr<rtm::client> &rtm_client,
                                          job_controller &streams)
+    : pool_job_controller(io, pool, job_type,
+                          [max_streams_capacity]() { return max_streams_capacity; },
+                          rtm_client, streams) {}
+
+pool_job_controller::pool_job_controller(boost::asio::io_service &io,
+                                         const std::string &pool,
+                                         const std::string &job_type,
+                                         std::function<size_t()> &&streams_capacity,
+                                         std::shared_ptr<rtm::client> &rtm_client,
+                                         job_controller &streams)
     : _io(io),
-      _max_streams_capacity(max_streams_capacity),
+      _streams_capacity(std::move(streams_capacity)),
       _pool(pool),
       _job_type(job_type),
       _client(rtm_client),
@@ -54,7 +64,8 @@ void pool_job_controller::on_heartbeat(const boost::system::error_code &ec) {
   CHECK(jobs.is_array()) << "not an array: " << jobs;
 
   nlohmann::json available_capacity = nlohmann::json::object();
-  available_capacity[_job_type] = _max_streams_capacity - jobs.size();
+  const size_t capacity = _streams_capacity();
+  available_capacity[_job_type] = capacity > jobs.size() ? capacity - jobs.size() : 0;
 
   nlohmann::json hb_message = nlohmann::json::object();
   hb_message["from"] = node_id;
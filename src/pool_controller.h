@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <json.hpp>
 #include <list>
 #include <string>
@@ -21,6 +22,12 @@ class pool_job_controller : rtm::subscription_callbacks {
                       const std::string &job_type, size_t max_streams_capacity,
                       std::shared_ptr<rtm::client> &rtm_client, job_controller &streams);
 
+  // streams_capacity is queried before every heartbeat
+  pool_job_controller(boost::asio::io_service &io, const std::string &pool,
+                      const std::string &job_type,
+                      std::function<size_t()> &&streams_capacity,
+                      std::shared_ptr<rtm::client> &rtm_client, job_controller &streams);
+
   void start();
   void shutdown();
 
@@ -33,7 +40,7 @@ class pool_job_controller : rtm::subscription_callbacks {
   void on_error(std::error_condition ec) override;
 
   boost::asio::io_service &_io;
-  const size_t _max_streams_capacity;
+  const std::function<size_t()> _streams_capacity;
   const std::string _pool;
   const std::string _job_type;
   std::shared_ptr<rtm::client> _client;
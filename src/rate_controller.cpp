@@ -0,0 +1,71 @@
+#include "rate_controller.h"
+
+#include "logging.h"
+#include "metrics.h"
+
+namespace satori {
+namespace video {
+
+namespace {
+
+auto &rate_controller_level = prometheus::BuildGauge()
+                                  .Name("rate_controller_level")
+                                  .Register(metrics_registry())
+                                  .Add({});
+
+auto &rate_controller_changes_total = prometheus::BuildCounter()
+                                          .Name("rate_controller_changes_total")
+                                          .Register(metrics_registry());
+
+}  // namespace
+
+rate_controller::rate_controller() : rate_controller(settings{}) {}
+
+rate_controller::rate_controller(const settings &s) : _settings(s) {
+  CHECK_LE(_settings.low_in_flight, _settings.high_in_flight);
+  CHECK_LE(_settings.low_delay.count(), _settings.high_delay.count());
+}
+
+void rate_controller::on_backpressure(uint32_t in_flight,
+                                      std::chrono::microseconds delay,
+                                      std::chrono::steady_clock::time_point now) {
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  const uint32_t level = _level;
+  if (in_flight >= _settings.high_in_flight || delay >= _settings.high_delay) {
+    _calm = false;
+    if (level < _settings.max_level && now - _last_change >= _settings.degrade_interval) {
+      LOG(INFO) << "Sink is congested: in_flight=" << in_flight
+                << ", delay=" << delay.count() << "us";
+      set_level(level + 1, now);
+    }
+    return;
+  }
+
+  if (in_flight > _settings.low_in_flight || delay > _settings.low_delay) {
+    _calm = false;
+    return;
+  }
+
+  if (!_calm) {
+    _calm = true;
+    _calm_since = now;
+  }
+  if (level > 0 && now - _calm_since >= _settings.recovery_interval
+      && now - _last_change >= _settings.recovery_interval) {
+    set_level(level - 1, now);
+  }
+}
+
+void rate_controller::set_level(uint32_t level,
+                                std::chrono::steady_clock::time_point now) {
+  LOG(INFO) << "Changing quality level " << _level << " -> " << level;
+  rate_controller_changes_total.Add({{"direction", level > _level ? "down" : "up"}})
+      .Increment();
+  rate_controller_level.Set(level);
+  _level = level;
+  _last_change = now;
+}
+
+}  // namespace video
+}  // namespace satori
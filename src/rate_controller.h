@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace satori {
+namespace video {
+
+// Chooses encoder quality level based on backpressure reported by a sink.
+// Level 0 is the original quality, every next level halves the bitrate
+// and doubles the keyframe interval. Level goes down (quality goes up)
+// only after the sink stays uncongested for recovery_interval.
+class rate_controller {
+ public:
+  struct settings {
+    uint32_t max_level{3};
+    uint32_t high_in_flight{50};
+    uint32_t low_in_flight{5};
+    std::chrono::microseconds high_delay{std::chrono::milliseconds{500}};
+    std::chrono::microseconds low_delay{std::chrono::milliseconds{50}};
+    // minimal time between two consecutive quality reductions,
+    // gives encoder a chance to drain the queue with new settings
+    std::chrono::milliseconds degrade_interval{1000};
+    std::chrono::milliseconds recovery_interval{5000};
+  };
+
+  rate_controller();
+  explicit rate_controller(const settings &s);
+
+  // Called by a sink, in_flight is the number of packets which are not published yet,
+  // delay is the time the last packet spent in sink queue.
+  void on_backpressure(
+      uint32_t in_flight, std::chrono::microseconds delay,
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+  uint32_t level() const { return _level; }
+
+ private:
+  void set_level(uint32_t level, std::chrono::steady_clock::time_point now);
+
+  const settings _settings;
+  std::atomic<uint32_t> _level{0};
+
+  std::mutex _mutex;
+  std::chrono::steady_clock::time_point _last_change;
+  bool _calm{false};
+  std::chrono::steady_clock::time_point _calm_since;
+};
+
+}  // namespace video
+}  // namespace satori
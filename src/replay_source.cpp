@@ -1,54 +1,118 @@
 #include "video_streams.h"
 
+#include <algorithm>
+#include <deque>
 #include <fstream>
+#include <future>
 #include <gsl/gsl>
 #include <json.hpp>
+#include <memory>
 #include <string>
 #include <thread>
 
+#include "binary_replay.h"
 #include "logging.h"
 #include "streams/asio_streams.h"
 
 namespace satori {
 namespace video {
 
+namespace {
+
+// parses one line-aligned block of a JSON-lines file
+std::vector<nlohmann::json> parse_json_block(const std::string &block) {
+  std::vector<nlohmann::json> result;
+  size_t line_start = 0;
+  while (line_start < block.size()) {
+    size_t line_end = block.find('\n', line_start);
+    if (line_end == std::string::npos) {
+      line_end = block.size();
+    }
+    if (line_end > line_start) {
+      const auto begin = block.begin() + line_start;
+      const auto end = block.begin() + line_end;
+      nlohmann::json data;
+      try {
+        data = nlohmann::json::parse(begin, end);
+      } catch (const nlohmann::json::parse_error &e) {
+        ABORT() << "Unable to parse line: " << e.what() << " " << std::string(begin, end);
+      }
+      CHECK(data.is_object()) << "bad data: " << data;
+      result.push_back(std::move(data));
+    }
+    line_start = line_end + 1;
+  }
+  return result;
+}
+
+}  // namespace
+
+// Reads the file in blocks extended to the end of line and parses them
+// asynchronously, up to two blocks per thread ahead. Blocks are handed out in
+// file order.
 class read_json_impl {
  public:
-  explicit read_json_impl(const std::string &filename)
-      : _filename(filename), _input(filename) {}
+  read_json_impl(const std::string &filename, size_t block_size)
+      : _filename(filename),
+        _input(filename, std::ios::binary),
+        _block_size(block_size),
+        _max_pending_blocks(2 * std::max(1u, std::thread::hardware_concurrency())) {}
 
   void generate_one(streams::observer<nlohmann::json> &observer) {
-    if (!_input.good()) {
+    if (!_input.is_open()) {
       LOG(ERROR) << "replay file not found: " << _filename;
       observer.on_error(std::make_error_condition(std::errc::no_such_file_or_directory));
       return;
     }
 
-    std::string line;
-    if (!std::getline(_input, line)) {
-      LOG(4) << "end of file";
-      observer.on_complete();
-      return;
+    while (_position == _current_block.size()) {
+      read_ahead();
+      if (_pending_blocks.empty()) {
+        LOG(4) << "end of file";
+        observer.on_complete();
+        return;
+      }
+      _current_block = _pending_blocks.front().get();
+      _pending_blocks.pop_front();
+      _position = 0;
     }
-    LOG(4) << "line=" << line;
-    nlohmann::json data;
-    try {
-      data = nlohmann::json::parse(line);
-    } catch (const nlohmann::json::parse_error &e) {
-      ABORT() << "Unable to parse line: " << e.what() << " " << line;
-    }
-    CHECK(data.is_object()) << "bad data: " << data;
-    observer.on_next(std::move(data));
+
+    observer.on_next(std::move(_current_block[_position++]));
   }
 
  private:
+  void read_ahead() {
+    while (_pending_blocks.size() < _max_pending_blocks && _input) {
+      std::string block(_block_size, '\0');
+      _input.read(&block[0], _block_size);
+      block.resize(static_cast<size_t>(_input.gcount()));
+      std::string rest_of_line;
+      if (_input && std::getline(_input, rest_of_line)) {
+        block.append(rest_of_line);
+      }
+      if (block.empty()) {
+        break;
+      }
+      _pending_blocks.push_back(
+          std::async(std::launch::async, [block = std::move(block)]() {
+            return parse_json_block(block);
+          }));
+    }
+  }
+
   const std::string _filename;
   std::ifstream _input;
+  const size_t _block_size;
+  const size_t _max_pending_blocks;
+  std::deque<std::future<std::vector<nlohmann::json>>> _pending_blocks;
+  std::vector<nlohmann::json> _current_block;
+  size_t _position{0};
 };
 
-streams::publisher<nlohmann::json> read_json(const std::string &filename) {
+streams::publisher<nlohmann::json> read_json_lines(const std::string &filename,
+                                                   size_t block_size) {
   return streams::generators<nlohmann::json>::stateful(
-      [filename]() { return new read_json_impl(filename); },
+      [filename, block_size]() { return new read_json_impl(filename, block_size); },
       [](read_json_impl *impl, streams::observer<nlohmann::json> &sink) {
         return impl->generate_one(sink);
       });
@@ -60,15 +124,16 @@ static streams::publisher<nlohmann::json> get_messages(nlohmann::json &&doc) {
   CHECK(messages.is_array()) << "bad doc: " << doc;
 
   std::vector<nlohmann::json> result;
+  result.reserve(messages.size());
   for (auto &el : messages) {
-    result.push_back(el);
+    result.push_back(std::move(el));
   }
 
   return streams::publishers::of(std::move(result));
 }
 
 streams::publisher<network_packet> read_metadata(const std::string &metadata_file) {
-  return read_json(metadata_file) >> streams::head()
+  return read_json_lines(metadata_file) >> streams::head()
          >> streams::map([](nlohmann::json &&t) {
              return network_packet{parse_network_metadata(t)};
            });
@@ -81,11 +146,34 @@ static double get_timestamp(const nlohmann::json &item) {
   return t;
 }
 
+// network frames of a replay line, received at line's timestamp
+static streams::publisher<network_packet> get_received_frames(nlohmann::json &&item) {
+  const auto arrival_time = std::chrono::system_clock::time_point{
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+          std::chrono::duration<double>(get_timestamp(item)))};
+
+  CHECK(item.find("messages") != item.end()) << "bad item: " << item;
+  auto &messages = item["messages"];
+  CHECK(messages.is_array()) << "bad item: " << item;
+
+  std::vector<network_packet> result;
+  for (auto &message : messages) {
+    network_frame frame = parse_network_frame(message);
+    frame.arrival_time = arrival_time;
+    if (message.find("t") == message.end()) {
+      // old recordings don't have frame timestamps
+      frame.t = arrival_time;
+    }
+    result.emplace_back(std::move(frame));
+  }
+  return streams::publishers::of(std::move(result));
+}
+
 streams::publisher<network_packet> network_replay_source(boost::asio::io_service &io,
                                                          const std::string &filename,
                                                          bool batch) {
   auto metadata = read_metadata(filename + ".metadata");
-  streams::publisher<nlohmann::json> items = read_json(filename);
+  streams::publisher<nlohmann::json> items = read_json_lines(filename);
   if (!batch) {
     auto last_time = new double{-1.0};
     items = std::move(items)
@@ -113,5 +201,28 @@ streams::publisher<network_packet> network_replay_source(boost::asio::io_service
   return streams::publishers::concat(std::move(metadata), std::move(frames));
 }
 
+void convert_network_replay(const std::string &network_replay,
+                            const std::string &binary_replay) {
+  auto frames =
+      read_json_lines(network_replay) >> streams::flat_map(&get_received_frames);
+  auto packets = streams::publishers::concat(read_metadata(network_replay + ".metadata"),
+                                             std::move(frames))
+                 >> decode_network_stream();
+
+  std::unique_ptr<binary_replay_writer> writer;
+  auto when_done = packets->process([&writer, &binary_replay](encoded_packet &&packet) {
+    if (const encoded_metadata *metadata = boost::get<encoded_metadata>(&packet)) {
+      CHECK(!writer) << "metadata change is not supported";
+      writer = std::make_unique<binary_replay_writer>(binary_replay, *metadata);
+    } else {
+      CHECK(writer) << "frame before metadata";
+      writer->write(boost::get<encoded_frame>(packet));
+    }
+  });
+  CHECK(when_done.ok()) << "failed to convert " << network_replay;
+  CHECK(writer) << "no metadata in " << network_replay;
+  writer->close();
+}
+
 }  // namespace video
 }  // namespace satori
@@ -6,6 +6,7 @@
 
 #include "data.h"
 #include "metrics.h"
+#include "rate_controller.h"
 #include "satori_video.h"
 #include "streams/streams.h"
 
@@ -30,11 +31,13 @@ class rtm_sink_impl : public streams::subscriber<encoded_packet>,
                       boost::static_visitor<void> {
  public:
   rtm_sink_impl(const std::shared_ptr<rtm::publisher> &client,
-                boost::asio::io_service &io_service, const std::string &rtm_channel)
+                boost::asio::io_service &io_service, const std::string &rtm_channel,
+                const std::shared_ptr<rate_controller> &rate_controller)
       : _client{client},
         _io_service{io_service},
         _frames_channel{rtm_channel},
-        _metadata_channel{rtm_channel + metadata_channel_suffix} {}
+        _metadata_channel{rtm_channel + metadata_channel_suffix},
+        _rate_controller{rate_controller} {}
 
   void operator()(const encoded_metadata &m) {
     nlohmann::json packet = m.to_network().to_json();
@@ -46,6 +49,10 @@ class rtm_sink_impl : public streams::subscriber<encoded_packet>,
   }
 
   void operator()(const encoded_frame &f) {
+    if (f.decode_only) {
+      // pre-roll of a file range is not published
+      return;
+    }
     std::vector<network_frame> network_frames = f.to_network();
 
     for (const network_frame &nf : network_frames) {
@@ -53,13 +60,17 @@ class rtm_sink_impl : public streams::subscriber<encoded_packet>,
 
       _in_flight++;
       _io_service.post([
-        this, packet = std::move(packet), creation_time = f.creation_time
+        this, packet = std::move(packet), creation_time = f.creation_time,
+        post_time = std::chrono::steady_clock::now()
       ]() mutable {
         frame_publish_delay_milliseconds.Observe(
             std::chrono::duration_cast<std::chrono::milliseconds>(
                 std::chrono::system_clock::now() - creation_time)
                 .count());
         _client->publish(_frames_channel, std::move(packet), this);
+        _last_queue_delay = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - post_time);
+        report_backpressure();
       });
     }
 
@@ -100,7 +111,17 @@ class rtm_sink_impl : public streams::subscriber<encoded_packet>,
     _src->request(1);
   }
 
-  void on_ok() override { _in_flight--; }
+  void on_ok() override {
+    _in_flight--;
+    report_backpressure();
+  }
+
+  // called from io thread only
+  void report_backpressure() {
+    if (_rate_controller) {
+      _rate_controller->on_backpressure(_in_flight, _last_queue_delay);
+    }
+  }
 
   const std::shared_ptr<rtm::publisher> _client;
   boost::asio::io_service &_io_service;
@@ -109,13 +130,16 @@ class rtm_sink_impl : public streams::subscriber<encoded_packet>,
   streams::subscription *_src;
   uint64_t _frames_counter{0};
   std::atomic_uint32_t _in_flight{0};
+  const std::shared_ptr<rate_controller> _rate_controller;
+  std::chrono::microseconds _last_queue_delay{0};
 };
 }  // namespace
 
 streams::subscriber<encoded_packet> &rtm_sink(
     const std::shared_ptr<rtm::publisher> &client, boost::asio::io_service &io_service,
-    const std::string &rtm_channel) {
-  return *(new rtm_sink_impl(client, io_service, rtm_channel));
+    const std::string &rtm_channel,
+    const std::shared_ptr<rate_controller> &rate_controller) {
+  return *(new rtm_sink_impl(client, io_service, rtm_channel, rate_controller));
 }
 
 }  // namespace video
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <boost/variant.hpp>
+#include <chrono>
+#include <functional>
 #include <thread>
 
 #include "../metrics.h"
@@ -13,12 +15,42 @@ namespace satori {
 namespace video {
 namespace streams {
 
+// Controls how queued elements are grouped into batches. By default, everything
+// queued is delivered at once.
+struct batching_options {
+  // batch has at most this many elements and waits until it's complete,
+  // 0 disables batching
+  size_t target_size{0};
+  // how long the first element of a batch may wait for batch to complete
+  std::chrono::milliseconds max_wait{0};
+  // elements queued for longer are dropped, 0 disables dropping
+  std::chrono::milliseconds max_staleness{0};
+  // invoked before batch delivery with batch size, number of dropped elements and
+  // how long the first element of the batch has waited, batch size is 0 if all
+  // queued elements were dropped
+  std::function<void(size_t, size_t, std::chrono::steady_clock::duration)> on_batch;
+  // invoked after batch delivery with batch size and how long delivery took,
+  // which is processing time if downstream is synchronous
+  std::function<void(size_t, std::chrono::steady_clock::duration)> on_delivered;
+};
+
+// Priority elements skip the queue: they are delivered in a separate batch ahead of
+// queued elements, don't count toward batch size and are never dropped.
+// Specialize for element types that carry a priority lane.
+template <typename T>
+struct priority_traits {
+  static bool is_priority(const T & /*t*/) { return false; }
+};
+
 namespace impl {
 
 class threaded_worker_op {
  public:
-  explicit threaded_worker_op(const std::string &name, boost::optional<size_t> max_queued_frames)
-      : _name(name), _max_queued_frames(max_queued_frames) {}
+  explicit threaded_worker_op(const std::string &name, boost::optional<size_t> max_queued_frames,
+                              batching_options batching)
+      : _name(name),
+        _max_queued_frames(max_queued_frames),
+        _batching(std::move(batching)) {}
 
   template <typename T>
   class instance : publisher_impl<std::queue<T>> {
@@ -26,10 +58,12 @@ class threaded_worker_op {
 
     class source : drain_source_impl<element_t>, subscriber<T> {
      public:
-      source(const std::string &name, boost::optional<size_t> max_queued_frames, publisher<T> &&src,
+      source(const std::string &name, boost::optional<size_t> max_queued_frames,
+             const batching_options &batching, publisher<T> &&src,
              streams::subscriber<element_t> &sink)
           : _name(name),
             _max_queued_frames(max_queued_frames),
+            _batching(batching),
             drain_source_impl<element_t>(sink) {
         _worker_thread = std::make_unique<std::thread>(&source::worker_thread_loop, this);
 
@@ -61,11 +95,17 @@ class threaded_worker_op {
       void on_next(T &&t) override {
         std::lock_guard<std::mutex> guard(_mutex);
         CHECK_NOTNULL(_src) << this << " " << _name;
+        if (priority_traits<T>::is_priority(t)) {
+          _priority_buffer.emplace(std::move(t));
+          _on_send.notify_one();
+          return;
+        }
         if (_max_queued_frames && _buffer.size() >= _max_queued_frames.get()) {
           LOG(ERROR) << this << " input queue is full";
           return;
         }
         _buffer.emplace(std::move(t));
+        _arrivals.push(std::chrono::steady_clock::now());
         _on_send.notify_one();
       }
 
@@ -98,12 +138,17 @@ class threaded_worker_op {
           {
             std::unique_lock<std::mutex> lock(_mutex);
             _worker_thread_ready = true;
-            while (_thread_should_be_active && _buffer.empty()) {
+            while (_thread_should_be_active && !batch_ready()) {
               LOG(5) << this << " " << _name << " waiting for _on_send";
-              _on_send.wait(lock);
+              if (_buffer.empty()) {
+                _on_send.wait(lock);
+              } else {
+                _on_send.wait_until(lock, _arrivals.front() + _batching.max_wait);
+              }
             }
 
-            if (_buffer.empty() || !(_thread_should_be_active || _complete || _ec)) {
+            if ((_buffer.empty() && _priority_buffer.empty())
+                || !(_thread_should_be_active || _complete || _ec)) {
               break;
             }
           }
@@ -161,23 +206,90 @@ class threaded_worker_op {
         }
         LOG(5) << this << " " << _name << " drain_impl " << _buffer.size();
         std::queue<T> tmp;
+        size_t dropped = 0;
+        std::chrono::steady_clock::duration waited{0};
+        bool has_more = false;
+
+        {
+          std::unique_lock<std::mutex> lock(_mutex);
+          if (!_priority_buffer.empty()) {
+            _priority_buffer.swap(tmp);
+            has_more = !_thread_should_be_active && !_buffer.empty();
+          }
+        }
+        if (!tmp.empty()) {
+          LOG(5) << this << " " << _name << " delivering priority batch: " << tmp.size();
+          drain_source_impl<element_t>::deliver_on_next(std::move(tmp));
+          return has_more;
+        }
 
         {
           std::unique_lock<std::mutex> lock(_mutex);
-          if (_buffer.empty()) {
+          if (_thread_should_be_active && !batch_ready()) {
+            // downstream requested more during delivery, worker loop waits for the
+            // next batch
             return false;
           }
-          _buffer.swap(tmp);
+          const auto now = std::chrono::steady_clock::now();
+          if (_batching.max_staleness.count() > 0) {
+            while (!_buffer.empty()
+                   && now - _arrivals.front() > _batching.max_staleness) {
+              _buffer.pop();
+              _arrivals.pop();
+              dropped++;
+            }
+          }
+          if (!_buffer.empty()) {
+            waited = now - _arrivals.front();
+          }
+          if (_batching.target_size == 0) {
+            _buffer.swap(tmp);
+            std::queue<std::chrono::steady_clock::time_point>().swap(_arrivals);
+          } else {
+            while (!_buffer.empty() && tmp.size() < _batching.target_size) {
+              tmp.push(std::move(_buffer.front()));
+              _buffer.pop();
+              _arrivals.pop();
+            }
+          }
+          // rest of the input is flushed without waiting
+          has_more = !_thread_should_be_active && !_buffer.empty();
         }
 
+        if (_batching.on_batch && (!tmp.empty() || dropped > 0)) {
+          _batching.on_batch(tmp.size(), dropped, waited);
+        }
+        if (tmp.empty()) {
+          return false;
+        }
         LOG(5) << this << " " << _name << " delivering batch: " << tmp.size();
+        const size_t batch_size = tmp.size();
+        const auto delivery_start = std::chrono::steady_clock::now();
         drain_source_impl<element_t>::deliver_on_next(std::move(tmp));
-        return false;
+        if (_batching.on_delivered) {
+          _batching.on_delivered(batch_size,
+                                 std::chrono::steady_clock::now() - delivery_start);
+        }
+        return has_more;
+      }
+
+      // should be called under _mutex
+      bool batch_ready() const {
+        if (!_priority_buffer.empty()) {
+          return true;
+        }
+        if (_buffer.empty()) {
+          return false;
+        }
+        const auto deadline = _arrivals.front() + _batching.max_wait;
+        return _batching.target_size == 0 || _buffer.size() >= _batching.target_size
+               || std::chrono::steady_clock::now() >= deadline;
       }
 
       std::atomic_bool _worker_thread_ready{false};
       const std::string _name;
       const boost::optional<size_t> _max_queued_frames;
+      const batching_options _batching;
       std::mutex _mutex;
       std::condition_variable _on_send;
 
@@ -186,6 +298,9 @@ class threaded_worker_op {
       std::error_condition _ec;
 
       std::queue<T> _buffer;
+      // time when each element of _buffer was queued
+      std::queue<std::chrono::steady_clock::time_point> _arrivals;
+      std::queue<T> _priority_buffer;
       std::unique_ptr<std::thread> _worker_thread;
       std::atomic_bool _thread_should_be_active{true};
       subscription *_src{nullptr};
@@ -194,33 +309,40 @@ class threaded_worker_op {
    public:
     static publisher<std::queue<T>> apply(publisher<T> &&src, threaded_worker_op &&op) {
       return publisher<std::queue<T>>(
-          new instance(op._name, op._max_queued_frames, std::move(src)));
+          new instance(op._name, op._max_queued_frames, op._batching, std::move(src)));
     }
 
-    instance(const std::string &name, boost::optional<size_t> max_queued_frames, publisher<T> &&src)
-        : _name(name), _max_queued_frames(max_queued_frames), _src(std::move(src)) {}
+    instance(const std::string &name, boost::optional<size_t> max_queued_frames,
+             const batching_options &batching, publisher<T> &&src)
+        : _name(name),
+          _max_queued_frames(max_queued_frames),
+          _batching(batching),
+          _src(std::move(src)) {}
 
     void subscribe(subscriber<element_t> &s) override {
-      new source(_name, _max_queued_frames, std::move(_src), s);
+      new source(_name, _max_queued_frames, _batching, std::move(_src), s);
     }
 
    private:
     const std::string _name;
     const boost::optional<size_t> _max_queued_frames;
+    const batching_options _batching;
     publisher<T> _src;
   };
 
  private:
   const std::string _name;
   const boost::optional<size_t> _max_queued_frames;
+  const batching_options _batching;
 };
 
 }  // namespace impl
 
 // threaded worker transforms publisher<T> into publisher<std::queue<T>> by
 // spawning new thread and performing all element delivery in it.
-inline auto threaded_worker(const std::string &name, boost::optional<size_t> max_queued_frames = {}) {
-  return impl::threaded_worker_op(name, max_queued_frames);
+inline auto threaded_worker(const std::string &name, boost::optional<size_t> max_queued_frames = {},
+                            batching_options batching = {}) {
+  return impl::threaded_worker_op(name, max_queued_frames, std::move(batching));
 }
 
 }  // namespace streams
@@ -41,52 +41,49 @@ std::vector<image_frame> drop_strategy_never(const gsl::span<image_frame>& frame
   return {frames.begin(), frames.end()};
 }
 
-using select_function_t =
-    std::function<std::vector<image_frame>(const gsl::span<image_frame>& frames)>;
-
-struct drop_strategy {
-  void update(const nlohmann::json& config) {
-    if (!config.is_object()) {
-        LOG(4) << "config is not an object, drop strategy unaffected";
-        return;
-    }
+void update_drop_strategy(frame_drop_strategy& strategy, const nlohmann::json& config) {
+  if (!config.is_object()) {
+    LOG(4) << "config is not an object, drop strategy unaffected";
+    return;
+  }
 
-    if (config.find("action") == config.end()) {
-        LOG(4) << "no action in config, drop strategy unaffected";
-        return;
-    }
+  if (config.find("action") == config.end()) {
+    LOG(4) << "no action in config, drop strategy unaffected";
+    return;
+  }
 
-    if (config["action"] == "configure") {
-      auto& body = config["body"];
-      const std::string drop_strategy = body.find("frame_drop_strategy") != body.end()
-                                            ? body["frame_drop_strategy"]
-                                            : "as_needed";
+  if (config["action"] == "configure") {
+    auto& body = config["body"];
+    const std::string drop_strategy = body.find("frame_drop_strategy") != body.end()
+                                          ? body["frame_drop_strategy"]
+                                          : "as_needed";
 
-      if (drop_strategy != "as_needed" && drop_strategy != "never") {
-        ABORT() << "Unsupported drop strategy: " << config;
-      }
+    if (drop_strategy != "as_needed" && drop_strategy != "never") {
+      ABORT() << "Unsupported drop strategy: " << config;
+    }
 
-      LOG(4) << "new drop strategy: " << drop_strategy;
+    LOG(4) << "new drop strategy: " << drop_strategy;
 
-      if (drop_strategy == "never") {
-        select_function = drop_strategy_never;
-        return;
-      }
-      select_function = drop_strategy_as_needed;
-    }
+    strategy = drop_strategy == "never" ? frame_drop_strategy::NEVER
+                                        : frame_drop_strategy::AS_NEEDED;
   }
+}
 
-  select_function_t select_function;
-};
-
-drop_strategy& get_drop_strategy() {
-  static drop_strategy strategy{drop_strategy_as_needed};
-  return strategy;
+std::vector<image_frame> select_frames(frame_drop_strategy strategy,
+                                       const gsl::span<image_frame>& frames) {
+  switch (strategy) {
+    case frame_drop_strategy::AS_NEEDED:
+      return drop_strategy_as_needed(frames);
+    case frame_drop_strategy::NEVER:
+      return drop_strategy_never(frames);
+  }
+  ABORT() << "unsupported drop strategy";
+  return {};
 }
 
 bot_ctrl_callback_t to_drop_disabling_callback(const bot_ctrl_callback_t& callback) {
   return [callback](bot_context& context, const nlohmann::json& message) {
-    get_drop_strategy().update(message);
+    update_drop_strategy(static_cast<bot_instance&>(context).drop_strategy, message);
     if (callback) {
       return callback(context, message);
     }
@@ -98,7 +95,8 @@ multiframe_bot_img_callback_t to_multiframe_bot_callback(
     const bot_img_callback_t& callback) {
   return [callback](bot_context& context, const gsl::span<image_frame>& frames) {
     CHECK(!frames.empty());
-    auto selected_frames = get_drop_strategy().select_function(frames);
+    auto selected_frames =
+        select_frames(static_cast<bot_instance&>(context).drop_strategy, frames);
     for (const auto& f : selected_frames) {
       process_single_frame(context, callback, f);
     }
@@ -111,7 +109,7 @@ multiframe_bot_img_callback_t to_multiframe_bot_callback(
 
 void bot_register(const bot_descriptor& bot) {
   multiframe_bot_register({bot.pixel_format, to_multiframe_bot_callback(bot.img_callback),
-                           to_drop_disabling_callback(bot.ctrl_callback)});
+                           to_drop_disabling_callback(bot.ctrl_callback), bot.state});
 }
 
 int bot_main(int argc, char** argv) { return multiframe_bot_main(argc, argv); }
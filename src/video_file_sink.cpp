@@ -1,16 +1,23 @@
 #include "video_streams.h"
 
+#include <fcntl.h>
+#include <unistd.h>
 #include <boost/filesystem.hpp>
+#include <cstring>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <vector>
 
 #include "avutils.h"
 #include "data.h"
+#include "file_writer_pool.h"
 #include "logging.h"
+#include "metrics.h"
+#include "stopwatch.h"
 #include "streams/streams.h"
 
 // TODO: * use AVMEDIA_TYPE_DATA or subtitles for annotations
-// TODO: * maybe use a separate thread for file_writer
-// TODO: * add --segment-frames parameter
 namespace satori {
 namespace video {
 namespace {
@@ -19,6 +26,32 @@ namespace fs = boost::filesystem;
 
 constexpr AVRational milliseconds_time_base = {1, 1000};
 
+auto &write_frame_millis =
+    prometheus::BuildHistogram()
+        .Name("video_file_sink_write_frame_millis")
+        .Register(metrics_registry())
+        .Add({}, std::vector<double>{0, 0.1, 0.2, 0.5, 1, 2, 5, 10, 20, 50, 100, 200, 500,
+                                     1000});
+
+auto &close_file_millis =
+    prometheus::BuildHistogram()
+        .Name("video_file_sink_close_file_millis")
+        .Register(metrics_registry())
+        .Add({}, std::vector<double>{0, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000,
+                                     5000, 10000});
+
+void fsync_file(const fs::path &path) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "failed to open " << path << " for fsync: " << strerror(errno);
+    return;
+  }
+  if (::fsync(fd) != 0) {
+    LOG(ERROR) << "failed to fsync " << path << ": " << strerror(errno);
+  }
+  ::close(fd);
+}
+
 fs::path temp_dir(const fs::path &work_path) {
   CHECK(work_path.has_extension());
 
@@ -38,15 +71,21 @@ fs::path temp_file_template(const fs::path &temp_dir, const fs::path &extension)
   return result;
 }
 
-// decodes stream to extract information about image sizes, etc.
-class stream_decoder {
- public:
-  stream_decoder(const encoded_metadata &metadata) : _metadata{metadata} {
-    avutils::init();
-    _packet = avutils::av_packet();
-    _frame = avutils::av_frame();
-    _context = avutils::decoder_context(_metadata.codec_name, _metadata.codec_data);
+// fragment per key frame, initial moov is empty so the file is playable
+// from the first fragment on
+std::unordered_map<std::string, std::string> fragmented_options(
+    std::unordered_map<std::string, std::string> &&options, bool fragmented) {
+  if (fragmented) {
+    options["movflags"] = "frag_keyframe+empty_moov+default_base_moof";
   }
+  return std::move(options);
+}
+
+// extracts information about image sizes, etc. from stream headers,
+// frames are only parsed, not decoded, unless headers of the codec can't be parsed
+class stream_probe {
+ public:
+  stream_probe(const encoded_metadata &metadata) : _metadata{metadata} {}
 
   void feed(const encoded_frame &f) {
     if (_stream_image_size) {
@@ -54,18 +93,51 @@ class stream_decoder {
       return;
     }
 
+    auto size = avutils::probe_image_size(_metadata, f);
+    if (size.ok()) {
+      LOG(INFO) << "stream resolution is " << size.get();
+      _stream_image_size = size.get();
+      return;
+    }
+
+    LOG(1) << "failed to find image size in frame headers, decoding it";
+    decode(f);
+  }
+
+  const encoded_metadata &metadata() const { return _metadata; }
+
+  const boost::optional<image_size> &stream_image_size() const {
+    return _stream_image_size;
+  }
+
+ private:
+  void decode(const encoded_frame &f) {
+    if (!_context) {
+      if (_decoder_failed) {
+        return;
+      }
+      avutils::init();
+      _context = avutils::decoder_context(_metadata.codec_name, _metadata.codec_data);
+      if (!_context) {
+        LOG(ERROR) << "can't find image size of " << _metadata.codec_name
+                   << " stream, frames won't be written";
+        _decoder_failed = true;
+        return;
+      }
+      _packet = avutils::av_packet();
+      _frame = avutils::av_frame();
+    }
+
     av_init_packet(_packet.get());
     _packet->data = (uint8_t *)f.data.data();
     _packet->size = static_cast<int>(f.data.size());
     _packet->flags |= f.key_frame ? AV_PKT_FLAG_KEY : 0;
-    LOG(4) << "sending a packet";
     int ret = avcodec_send_packet(_context.get(), _packet.get());
     if (ret < 0) {
       LOG(ERROR) << "avcodec_send_packet error: " << avutils::error_msg(ret);
     }
     av_packet_unref(_packet.get());
 
-    LOG(4) << "trying to receive a frame";
     ret = avcodec_receive_frame(_context.get(), _frame.get());
     if (ret >= 0) {
       LOG(INFO) << "stream resolution is " << _frame->width << "x" << _frame->height;
@@ -76,33 +148,28 @@ class stream_decoder {
     }
   }
 
-  const encoded_metadata &metadata() const { return _metadata; }
-
-  const boost::optional<image_size> &stream_image_size() const {
-    return _stream_image_size;
-  }
-
- private:
   const encoded_metadata _metadata;
+  boost::optional<image_size> _stream_image_size;
+  // decoder for codecs which headers can't be parsed
+  std::shared_ptr<AVCodecContext> _context;
   std::shared_ptr<AVPacket> _packet;
   std::shared_ptr<AVFrame> _frame;
-  std::shared_ptr<AVCodecContext> _context;
-  boost::optional<image_size> _stream_image_size;
+  bool _decoder_failed{false};
 };
 
 AVStream *create_video_stream(AVFormatContext &format_context,
-                              const stream_decoder &decoder) {
-  CHECK(decoder.stream_image_size());
+                              const stream_probe &probe) {
+  CHECK(probe.stream_image_size());
   AVStream *video_stream = avformat_new_stream(&format_context, nullptr);
   CHECK_NOTNULL(video_stream) << "failed to create an output video stream";
 
   video_stream->id = format_context.nb_streams - 1;
   video_stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-  video_stream->codecpar->codec_id = avutils::codec_id(decoder.metadata().codec_name);
-  video_stream->codecpar->width = decoder.stream_image_size()->width;
-  video_stream->codecpar->height = decoder.stream_image_size()->height;
+  video_stream->codecpar->codec_id = avutils::codec_id(probe.metadata().codec_name);
+  video_stream->codecpar->width = probe.stream_image_size()->width;
+  video_stream->codecpar->height = probe.stream_image_size()->height;
 
-  const auto &codec_data = decoder.metadata().codec_data;
+  const auto &codec_data = probe.metadata().codec_data;
 
   video_stream->codecpar->extradata_size = codec_data.size();
   auto buffer =
@@ -116,9 +183,10 @@ AVStream *create_video_stream(AVFormatContext &format_context,
 // TODO: maybe add a check for supported codecs and containers
 class video_file_writer {
  public:
-  video_file_writer(const fs::path &filename, const stream_decoder &decoder,
-                    const std::unordered_map<std::string, std::string> &options)
-      : _filename{filename} {
+  video_file_writer(const fs::path &filename, const stream_probe &probe,
+                    const std::unordered_map<std::string, std::string> &options,
+                    bool fragmented)
+      : _filename{filename}, _fragmented{fragmented} {
     avutils::init();
 
     LOG(INFO) << "Creating format context for file " << _filename;
@@ -134,7 +202,7 @@ class video_file_writer {
     CHECK(_format_context) << "could not allocate format context for " << _filename;
 
     LOG(INFO) << "Creating video stream for file " << _filename;
-    _video_stream = create_video_stream(*_format_context, decoder);
+    _video_stream = create_video_stream(*_format_context, probe);
 
     LOG(INFO) << "Opening file " << _filename;
     int ret = avio_open(&_format_context->pb, _filename.c_str(), AVIO_FLAG_WRITE);
@@ -156,7 +224,6 @@ class video_file_writer {
       _started_processing = true;
       _start_ts = f.timestamp;
     }
-    _last_ts = f.timestamp;
 
     AVPacket packet{nullptr};
     av_init_packet(&packet);
@@ -174,94 +241,229 @@ class video_file_writer {
     int ret = av_interleaved_write_frame(_format_context.get(), &packet);
     CHECK_GE(ret, 0) << "failed to write packet: " << avutils::error_msg(ret);
     av_packet_unref(&packet);
-  }
-
-  fs::path filename() const { return _filename; }
 
-  std::chrono::system_clock::time_point start_ts() const {
-    CHECK(_started_processing);
-    return _start_ts;
+    if (_fragmented && f.key_frame) {
+      // key frame completes previous fragment, so readers can play it right away
+      avio_flush(_format_context->pb);
+    }
   }
 
-  std::chrono::system_clock::time_point last_ts() const {
-    CHECK(_started_processing);
-    return _last_ts;
-  }
+  // Hands buffered data over to OS.
+  void flush() { avio_flush(_format_context->pb); }
 
  private:
   const fs::path _filename;
+  const bool _fragmented;
   std::shared_ptr<AVFormatContext> _format_context{nullptr};
   AVStream *_video_stream{nullptr};
   bool _started_processing{false};
   std::chrono::system_clock::time_point _start_ts;
-  std::chrono::system_clock::time_point _last_ts;
 };
 
 class video_file_sink_impl : public streams::subscriber<encoded_packet>,
                              boost::static_visitor<void> {
  public:
-  video_file_sink_impl(
-      const fs::path &path,
-      const boost::optional<std::chrono::system_clock::duration> &segment_duration,
-      std::unordered_map<std::string, std::string> &&options)
-      : _path{path},
+  video_file_sink_impl(boost::asio::io_service &io, const fs::path &path,
+                       const file_segment_limits &segment_limits,
+                       std::unordered_map<std::string, std::string> &&options,
+                       size_t max_queued_frames, file_sync_policy sync_policy,
+                       const std::shared_ptr<file_writer_pool> &writer_pool,
+                       bool fragmented)
+      : _io{io},
+        _path{path},
         _temp_file_template{temp_file_template(temp_dir(path), path.extension())},
-        _segment_duration{segment_duration},
-        _options{std::move(options)} {}
+        _segment_limits{segment_limits},
+        _options{fragmented_options(std::move(options), fragmented)},
+        _fragmented{fragmented},
+        _sync_policy{sync_policy},
+        _writer_pool{writer_pool ? writer_pool
+                                 : std::make_shared<file_writer_pool>(
+                                       1, std::numeric_limits<uint64_t>::max())} {
+    _write_queue = _writer_pool->make_queue(max_queued_frames, [this]() {
+      // buffers are handed over once per batch of frames
+      if (_sync_policy != file_sync_policy::NONE && _file_writer) {
+        _file_writer->flush();
+      }
+    });
+  }
 
   ~video_file_sink_impl() override {
-    if (_file_writer) {
+    if (_segment) {
       release_writer();
     }
+    if (_next_segment_filename) {
+      discard_next_writer();
+    }
+    if (!_tasks.empty()) {
+      _writer_pool->push(_write_queue, take_tasks(), _tasks_bytes);
+    }
+    // pending file operations refer to this sink
+    _writer_pool->drain(_write_queue);
   }
 
   void operator()(const encoded_metadata &metadata) {
-    if (_decoder) {
+    if (_probe) {
       LOG(1) << "ignoring metadata";
       return;
     }
-    _decoder = std::make_unique<stream_decoder>(metadata);
+    _probe = std::make_unique<stream_probe>(metadata);
   }
 
-  void operator()(const encoded_frame &f) {
+  void operator()(encoded_frame &f) {
     LOG(4) << "got encoded frame of size " << f.data.size();
-    if (!_decoder) {
-      LOG(4) << "no stream decoder";
+    if (!_probe) {
+      LOG(4) << "no stream probe";
       return;
     }
-    if (!_decoder->stream_image_size()) {
-      LOG(4) << "feeding stream decoder";
-      _decoder->feed(f);
+    if (!_probe->stream_image_size()) {
+      LOG(4) << "feeding stream probe";
+      _probe->feed(f);
+    }
+    if (!_probe->stream_image_size()) {
+      LOG(4) << "stream probe doesn't have image size";
+      return;
     }
-    if (!_decoder->stream_image_size()) {
-      LOG(4) << "stream decoder doesn't have image size";
+    if (f.decode_only) {
+      // pre-roll of a file range is only probed, not written
+      LOG(4) << "skipping decode only frame";
       return;
     }
 
+    // segments always start with a key frame, so each of them is decodable alone
     if (f.key_frame) {
-      if (_segment_duration && _file_writer
-          && f.timestamp >= _file_writer->start_ts() + *_segment_duration) {
+      if (_segment && segment_is_full(f.timestamp)) {
         release_writer();
       }
 
-      if (!_file_writer) {
-        _file_writer =
-            std::make_unique<video_file_writer>(temp_filename(), *_decoder, _options);
-        LOG(INFO) << "started new file " << _file_writer->filename();
+      if (!_segment) {
+        start_writer(f.timestamp);
       }
     }
 
-    if (_file_writer) {
-      _file_writer->write_frame(f);
+    if (_segment) {
+      _segment->last_ts = f.timestamp;
+      _segment->frames++;
+      _segment->bytes += f.data.size();
+      const uint64_t frame_size = f.data.size();
+      auto write_task = [ this, f = std::move(f) ]() {
+        stopwatch<> s;
+        _file_writer->write_frame(f);
+        write_frame_millis.Observe(s.millis());
+      };
+      push(std::move(write_task), frame_size);
+
+      if (segmented() && !_next_segment_filename) {
+        // next segment's file is created and its header is written in advance,
+        // so rollover doesn't wait for it
+        open_next_writer();
+      }
     }
   }
 
  private:
+  // segment being written, accessed only from the stream thread
+  struct segment {
+    // where the file is while it's written
+    fs::path filename;
+    std::chrono::system_clock::time_point start_ts;
+    std::chrono::system_clock::time_point last_ts;
+    uint64_t frames;
+    uint64_t bytes;
+  };
+
+  // Operations of a packet go to the pool as a single task,
+  // so the packet is either queued or waits for the budget as a whole.
+  void push(std::function<void()> &&task, uint64_t bytes = 0) {
+    _tasks.push_back(std::move(task));
+    _tasks_bytes += bytes;
+  }
+
+  std::function<void()> take_tasks() {
+    std::vector<std::function<void()>> tasks;
+    tasks.swap(_tasks);
+    return [tasks = std::move(tasks)]() {
+      for (auto &t : tasks) {
+        t();
+      }
+    };
+  }
+
+  bool segmented() const {
+    return _segment_limits.duration || _segment_limits.frames || _segment_limits.bytes;
+  }
+
+  bool segment_is_full(std::chrono::system_clock::time_point ts) const {
+    return (_segment_limits.duration
+            && ts >= _segment->start_ts + *_segment_limits.duration)
+           || (_segment_limits.frames && _segment->frames >= *_segment_limits.frames)
+           || (_segment_limits.bytes && _segment->bytes >= *_segment_limits.bytes);
+  }
+
+  void start_writer(std::chrono::system_clock::time_point start_ts) {
+    if (!_next_segment_filename) {
+      open_next_writer();
+    }
+    const fs::path temp_name = *_next_segment_filename;
+    _next_segment_filename.reset();
+    _segment = segment{temp_name, start_ts, start_ts, 0, 0};
+    if (_fragmented) {
+      // fragmented file is playable while written, so it's moved out of temporary
+      // directory right away
+      _segment->filename = in_progress_filename();
+    }
+    LOG(INFO) << "starting new file " << _segment->filename;
+
+    push([ this, temp_name, filename = _segment->filename ]() {
+      CHECK(_next_file_writer);
+      _file_writer = std::move(_next_file_writer);
+      if (filename != temp_name) {
+        rename_file(temp_name, filename);
+      }
+    });
+  }
+
+  void open_next_writer() {
+    _next_segment_filename = temp_filename();
+    push([ this, filename = *_next_segment_filename ]() {
+      _next_file_writer = std::make_unique<video_file_writer>(filename, *_probe,
+                                                              _options, _fragmented);
+    });
+  }
+
+  void discard_next_writer() {
+    const fs::path filename = *_next_segment_filename;
+    _next_segment_filename.reset();
+
+    push([this, filename]() {
+      _next_file_writer.reset();
+      boost::system::error_code ec;
+      fs::remove(filename, ec);
+      if (ec.value() != 0) {
+        LOG(ERROR) << "Failed to remove unused file " << filename << ": " << ec.message();
+      }
+    });
+  }
+
   void release_writer() {
-    const fs::path old_name = _file_writer->filename();
+    const fs::path old_name = _segment->filename;
     const fs::path new_name = current_filename();
-    _file_writer.reset();
+    _segment.reset();
 
+    push([this, old_name, new_name]() {
+      stopwatch<> s;
+      _file_writer.reset();
+      if (_sync_policy == file_sync_policy::FSYNC) {
+        fsync_file(old_name);
+      }
+      close_file_millis.Observe(s.millis());
+
+      if (old_name != new_name) {
+        rename_file(old_name, new_name);
+      }
+    });
+  }
+
+  static void rename_file(const fs::path &old_name, const fs::path &new_name) {
     boost::system::error_code ec;
     fs::rename(old_name, new_name, ec);
     CHECK_EQ(ec.value(), 0) << "Failed to rename " << old_name << " to " << new_name
@@ -269,16 +471,32 @@ class video_file_sink_impl : public streams::subscriber<encoded_packet>,
     LOG(INFO) << "Successfully renamed " << old_name << " to " << new_name;
   }
 
+  // Fragmented segment is named after its first frame until it's closed.
+  fs::path in_progress_filename() const {
+    if (!segmented()) {
+      return _path;
+    }
+
+    const auto start_epoch_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                    _segment->start_ts.time_since_epoch())
+                                    .count();
+    fs::path result{_path.stem()};
+    result += "-";
+    result += std::to_string(start_epoch_ms);
+    result += _path.extension();
+    return _path.parent_path() / result;
+  }
+
   fs::path current_filename() const {
-    if (!_segment_duration) {
+    if (!segmented()) {
       return _path.string();
     }
 
     const auto start_epoch_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                                    _file_writer->start_ts().time_since_epoch())
+                                    _segment->start_ts.time_since_epoch())
                                     .count();
     const auto end_epoch_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                                  _file_writer->last_ts().time_since_epoch())
+                                  _segment->last_ts.time_since_epoch())
                                   .count();
     fs::path result{_path.stem()};
     result += "-";
@@ -299,7 +517,26 @@ class video_file_sink_impl : public streams::subscriber<encoded_packet>,
   // TODO: propagate error down the stream if encoder is not supported
   void on_next(encoded_packet &&packet) override {
     boost::apply_visitor(*this, packet);
-    _src->request(1);
+    if (_tasks.empty()) {
+      _src->request(1);
+      return;
+    }
+
+    const uint64_t bytes = _tasks_bytes;
+    _tasks_bytes = 0;
+    // the stream is paused until the pool accepts the packet, so the thread
+    // delivering it is never blocked and nothing is buffered outside the budget
+    auto on_accepted = [ this, &io = _io, alive = std::weak_ptr<void>(_alive) ]() {
+      io.post([this, alive]() {
+        if (alive.lock()) {
+          _src->request(1);
+        }
+      });
+    };
+    if (_writer_pool->try_push(_write_queue, take_tasks(), bytes,
+                               std::move(on_accepted))) {
+      _src->request(1);
+    }
   }
 
   void on_error(std::error_condition ec) override { ABORT() << ec.message(); }
@@ -314,22 +551,40 @@ class video_file_sink_impl : public streams::subscriber<encoded_packet>,
     _src->request(1);
   }
 
+  boost::asio::io_service &_io;
   const fs::path _path;
   const fs::path _temp_file_template;
-  const boost::optional<std::chrono::system_clock::duration> _segment_duration;
+  const file_segment_limits _segment_limits;
   const std::unordered_map<std::string, std::string> _options;
-  std::unique_ptr<stream_decoder> _decoder{nullptr};
-  std::unique_ptr<video_file_writer> _file_writer{nullptr};
+  const bool _fragmented;
+  const file_sync_policy _sync_policy;
+  std::unique_ptr<stream_probe> _probe{nullptr};
+  boost::optional<segment> _segment;
+  boost::optional<fs::path> _next_segment_filename;
   streams::subscription *_src{nullptr};
+  // accessed only from the writer thread
+  std::unique_ptr<video_file_writer> _file_writer{nullptr};
+  std::unique_ptr<video_file_writer> _next_file_writer{nullptr};
+  const std::shared_ptr<file_writer_pool> _writer_pool;
+  std::shared_ptr<file_writer_pool::queue> _write_queue;
+  // operations of the packet being processed
+  std::vector<std::function<void()>> _tasks;
+  uint64_t _tasks_bytes{0};
+  // expires with the sink, so pending requests of accepted packets are dropped
+  const std::shared_ptr<void> _alive{std::make_shared<bool>(true)};
 };
 
 }  // namespace
 
 streams::subscriber<encoded_packet> &video_file_sink(
-    const fs::path &path,
-    const boost::optional<std::chrono::system_clock::duration> &segment_duration,
-    std::unordered_map<std::string, std::string> &&options) {
-  return *(new video_file_sink_impl(path, segment_duration, std::move(options)));
+    boost::asio::io_service &io, const fs::path &path,
+    const file_segment_limits &segment_limits,
+    std::unordered_map<std::string, std::string> &&options, size_t max_queued_frames,
+    file_sync_policy sync_policy, const std::shared_ptr<file_writer_pool> &writer_pool,
+    bool fragmented) {
+  return *(new video_file_sink_impl(io, path, segment_limits, std::move(options),
+                                    max_queued_frames, sync_policy, writer_pool,
+                                    fragmented));
 }
 
 }  // namespace video
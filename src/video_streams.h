@@ -8,15 +8,59 @@
 #include <unordered_map>
 
 #include "data.h"
+#include "frame_skip_controller.h"
+#include "rate_controller.h"
 #include "rtm_client.h"
 #include "streams/streams.h"
 
 namespace satori {
 namespace video {
 
+// Part of a file to read, either by time since the start of the video stream or
+// by frame number counted from zero in decoding order. Start is inclusive,
+// end is exclusive.
+struct file_range {
+  boost::optional<std::chrono::milliseconds> start_time;
+  boost::optional<std::chrono::milliseconds> end_time;
+  boost::optional<uint64_t> start_frame;
+  boost::optional<uint64_t> end_frame;
+
+  bool empty() const { return !start_time && !end_time && !start_frame && !end_frame; }
+};
+
+// How file_source reads a file in batch mode.
+struct file_read_options {
+  // Packets are demuxed ahead on a separate thread into a queue limited by
+  // packets count and total size, so reading overlaps with decoding.
+  // Zero packets disables read-ahead.
+  size_t prefetch_packets{100};
+  size_t prefetch_bytes{16 * 1024 * 1024};
+
+  // Size of AVIO buffer, zero keeps FFmpeg default.
+  size_t io_buffer_size{0};
+
+  // Reads the file through memory mapping instead of FFmpeg file protocol.
+  bool mmap{false};
+};
+
+// If range is not empty, file_source seeks to the key frame preceding range start
+// using keyframe index (see keyframe_index.h). Frames before range start are marked
+// as decode only, they aren't paced in real time and aren't published or written
+// by encoded frame sinks. Frame ids are frame numbers plus one, so they don't
+// depend on range.
 streams::publisher<encoded_packet> file_source(boost::asio::io_service &io,
                                                const std::string &filename, bool loop,
-                                               bool batch);
+                                               bool batch,
+                                               const file_range &range = file_range{},
+                                               const file_read_options &read_options =
+                                                   file_read_options{});
+
+// Plays files one after another as a single stream: frame ids and timestamps of
+// each file continue those of the previous one. Metadata of each file is passed
+// on, so the decoder is reused if codec parameters don't change.
+streams::publisher<encoded_packet> playlist_source(
+    boost::asio::io_service &io, const std::vector<std::string> &filenames, bool loop,
+    bool batch, const file_read_options &read_options = file_read_options{});
 
 streams::publisher<owned_image_packet> camera_source(boost::asio::io_service &io,
                                                      const std::string &resolution,
@@ -26,29 +70,82 @@ streams::publisher<owned_image_packet> camera_source(boost::asio::io_service &io
 streams::publisher<encoded_packet> url_source(const std::string &url,
                                               const std::string &options = "");
 
+// Reads JSON-lines file, like network replays and bot analysis outputs.
+// The file is read in line-aligned blocks parsed on worker threads,
+// objects are published in file order.
+streams::publisher<nlohmann::json> read_json_lines(const std::string &filename,
+                                                   size_t block_size = 1024 * 1024);
+
 streams::publisher<network_packet> network_replay_source(boost::asio::io_service &io,
                                                          const std::string &filename,
                                                          bool batch);
 
+// Plays binary replay (see binary_replay.h). Range is read like in file_source(),
+// times are counted from the creation time of the first frame.
+streams::publisher<encoded_packet> binary_replay_source(
+    boost::asio::io_service &io, const std::string &filename, bool batch,
+    const file_range &range = file_range{});
+
 streams::publisher<network_packet> rtm_source(
     const std::shared_ptr<rtm::subscriber> &client, const std::string &channel_name);
 
 streams::op<network_packet, encoded_packet> decode_network_stream();
 
+// low_latency mode is meant for live streams, frames are handed out
+// as soon as they are decoded instead of being held for reordering.
+// If skip_controller is set, frames it skips aren't converted and delivered.
 streams::op<encoded_packet, owned_image_packet> decode_image_frames(
     const image_size &bounding_size, image_pixel_format pixel_format,
-    bool keep_aspect_ratio);
+    bool keep_aspect_ratio, bool low_latency = false,
+    const std::shared_ptr<frame_skip_controller> &skip_controller = nullptr);
 
+// If rate_controller is set, it is notified about publishing backpressure.
 streams::subscriber<encoded_packet> &rtm_sink(
     const std::shared_ptr<rtm::publisher> &client, boost::asio::io_service &io_service,
-    const std::string &rtm_channel);
+    const std::string &rtm_channel,
+    const std::shared_ptr<rate_controller> &rate_controller = nullptr);
+
+// Tells how video_file_sink makes written data durable.
+enum class file_sync_policy {
+  NONE,   // OS decides when data reaches the disk
+  FLUSH,  // buffers are handed over to OS after every batch of frames
+  FSYNC   // FLUSH, plus every file is fsync-ed when it is closed
+};
+
+// Limits of a single video file. When any of them is reached, a new file
+// is started at the next key frame. Without limits, a single file is written.
+struct file_segment_limits {
+  boost::optional<std::chrono::system_clock::duration> duration;
+  boost::optional<uint64_t> frames;
+  boost::optional<uint64_t> bytes;  // of encoded frames, container overhead excluded
+};
+
+class file_writer_pool;
 
+// Files are written on writer_pool threads, or on a dedicated thread if no pool
+// is given. The sink doesn't request the next frame while more than
+// max_queued_frames frames wait to be written or the pool is out of its memory
+// budget, the request is then issued on io once the frame is queued.
+// If fragmented, MP4 files are written as a fragment per key frame, every
+// fragment is handed over to OS once complete, so files are playable while
+// written, and closing a file only writes its last fragment. Such file is
+// written under path itself, or, if segmented, as <stem>-<first frame ms><ext>
+// until it's renamed to include the last frame time when closed. Other files
+// are written in temp-recordings directory next to path and moved when closed.
 streams::subscriber<encoded_packet> &video_file_sink(
-    const boost::filesystem::path &path,
-    const boost::optional<std::chrono::system_clock::duration> &segment_duration,
-    std::unordered_map<std::string, std::string> &&options);
+    boost::asio::io_service &io, const boost::filesystem::path &path,
+    const file_segment_limits &segment_limits,
+    std::unordered_map<std::string, std::string> &&options,
+    size_t max_queued_frames = 250,
+    file_sync_policy sync_policy = file_sync_policy::NONE,
+    const std::shared_ptr<file_writer_pool> &writer_pool = nullptr,
+    bool fragmented = false);
 
-streams::op<owned_image_packet, encoded_packet> encode_as_mjpeg();
+// Encodes images on a pool of threads_count encoders (0 means one per core),
+// output order matches input order. At most max_frames_in_flight images are
+// being encoded at the same time (0 means twice the number of threads).
+streams::op<owned_image_packet, encoded_packet> encode_as_mjpeg(
+    size_t threads_count = 0, size_t max_frames_in_flight = 0);
 
 streams::op<encoded_packet, encoded_packet> repeat_metadata();
 
@@ -13,16 +13,21 @@ namespace video {
 
 class vp9_encoder {
  public:
-  vp9_encoder(uint8_t lag_in_frames) : _lag_in_frames(lag_in_frames) {}
+  vp9_encoder(uint8_t lag_in_frames, const std::shared_ptr<rate_controller> &controller)
+      : _lag_in_frames(lag_in_frames), _rate_controller(controller) {}
 
   streams::publisher<encoded_packet> init(const owned_image_frame &f) {
     CHECK(!_encoder_context);
-    LOG(INFO) << "Initializing encoder";
+    _level = _rate_controller ? _rate_controller->level() : 0;
+    LOG(INFO) << "Initializing encoder, quality level " << _level;
 
     avutils::init();
     _encoder_context = avutils::encoder_context(_encoder_id);
     _encoder_context->width = f.width;
     _encoder_context->height = f.height;
+    // every quality level halves bitrate and makes key frames twice less frequent
+    _encoder_context->bit_rate >>= _level;
+    _encoder_context->gop_size <<= _level;
 
     // http://wiki.webmproject.org/ffmpeg/vp9-encoding-guide
     AVDictionary *codec_options = nullptr;
@@ -41,13 +46,13 @@ class vp9_encoder {
           video_error::STREAM_INITIALIZATION_ERROR);
     }
 
-    // TODO: make align parameterizable
+    _pixel_format = f.pixel_format;
     const AVPixelFormat av_pixel_format = avutils::to_av_pixel_format(f.pixel_format);
-    _tmp_frame = avutils::av_frame(f.width, f.height, 1, av_pixel_format);
+    // TODO: make align parameterizable
     _frame = avutils::av_frame(f.width, f.height, 1, _encoder_context->pix_fmt);
-
-    _sws_context = avutils::sws_context(_tmp_frame, _frame);
-    if (_sws_context == nullptr) {
+    _sws_context = avutils::sws_context(f.width, f.height, av_pixel_format, f.width,
+                                        f.height, _encoder_context->pix_fmt);
+    if (_frame == nullptr || _sws_context == nullptr) {
       return streams::publishers::error<encoded_packet>(
           video_error::STREAM_INITIALIZATION_ERROR);
     }
@@ -67,15 +72,49 @@ class vp9_encoder {
       return streams::publishers::concat(std::move(metadata), std::move(frames));
     }
 
+    const bool image_changed = f.width != _encoder_context->width
+                               || f.height != _encoder_context->height
+                               || f.pixel_format != _pixel_format;
+    if (image_changed || (_rate_controller && _rate_controller->level() != _level)) {
+      // libvpx doesn't pick up new image size and rate control settings on the fly,
+      // so encoder is drained and reopened, new stream starts with a key frame
+      std::vector<streams::publisher<encoded_packet>> parts;
+      parts.push_back(flush(f.id, f.timestamp));
+      _encoder_context.reset();
+      parts.push_back(init(f));
+      parts.push_back(encode_frame(f));
+      return streams::publishers::concat(std::move(parts));
+    }
+
     return encode_frame(f);
   }
 
  private:
+  streams::publisher<encoded_packet> flush(
+      const frame_id &id, std::chrono::system_clock::time_point timestamp) {
+    LOG(INFO) << "Flushing encoder";
+    avcodec_send_frame(_encoder_context.get(), nullptr);
+    return receive_packets(id, timestamp);
+  }
+
   streams::publisher<encoded_packet> encode_frame(const owned_image_frame &f) {
-    avutils::copy_image_to_av_frame(f, _tmp_frame);
-    avutils::sws_scale(_sws_context, _tmp_frame, _frame);
+    // single pass conversion straight from image planes
+    avutils::sws_scale(_sws_context, f, _frame);
     avcodec_send_frame(_encoder_context.get(), _frame.get());
 
+    auto packets = receive_packets(f.id, f.timestamp);
+
+    _counter++;
+    if (_counter % 100 == 0) {
+      LOG(INFO) << "Encoded " << _counter << " frames";
+    }
+    LOG(2) << "Encoded " << _counter << " frames";
+
+    return packets;
+  }
+
+  streams::publisher<encoded_packet> receive_packets(
+      const frame_id &id, std::chrono::system_clock::time_point timestamp) {
     std::vector<encoded_packet> packets;
     while (true) {
       AVPacket packet;
@@ -92,8 +131,8 @@ class vp9_encoder {
 
       encoded_frame frame;
       frame.data.assign(packet.data, packet.data + packet.size);
-      frame.id = f.id;
-      frame.timestamp = f.timestamp;
+      frame.id = id;
+      frame.timestamp = timestamp;
       frame.creation_time = std::chrono::system_clock::now();
       frame.key_frame = static_cast<bool>(packet.flags & AV_PKT_FLAG_KEY);
       packets.emplace_back(std::move(frame));
@@ -101,12 +140,6 @@ class vp9_encoder {
       av_packet_unref(&packet);
     }
 
-    _counter++;
-    if (_counter % 100 == 0) {
-      LOG(INFO) << "Encoded " << _counter << " frames";
-    }
-    LOG(2) << "Encoded " << _counter << " frames";
-
     return streams::publishers::of(std::move(packets));
   }
 
@@ -116,15 +149,18 @@ class vp9_encoder {
   const uint8_t _lag_in_frames;
   const AVCodecID _encoder_id{AV_CODEC_ID_VP9};
   std::shared_ptr<AVCodecContext> _encoder_context{nullptr};
-  std::shared_ptr<AVFrame> _tmp_frame{nullptr};  // for pixel format conversion
-  std::shared_ptr<AVFrame> _frame{nullptr};
+  image_pixel_format _pixel_format;
+  std::shared_ptr<AVFrame> _frame{nullptr};  // for pixel format conversion
   std::shared_ptr<SwsContext> _sws_context{nullptr};
   int64_t _counter{0};
+  const std::shared_ptr<rate_controller> _rate_controller;
+  uint32_t _level{0};
 };  // namespace video
 
-streams::op<owned_image_packet, encoded_packet> encode_vp9(uint8_t lag_in_frames) {
-  return [lag_in_frames](streams::publisher<owned_image_packet> &&src) {
-    auto encoder = new vp9_encoder(lag_in_frames);
+streams::op<owned_image_packet, encoded_packet> encode_vp9(
+    uint8_t lag_in_frames, const std::shared_ptr<rate_controller> &controller) {
+  return [lag_in_frames, controller](streams::publisher<owned_image_packet> &&src) {
+    auto encoder = new vp9_encoder(lag_in_frames, controller);
 
     return std::move(src) >> streams::flat_map([encoder](owned_image_packet &&packet) {
              if (const owned_image_frame *frame =
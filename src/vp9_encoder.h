@@ -1,11 +1,14 @@
 #pragma once
 
 #include "data.h"
+#include "rate_controller.h"
 #include "streams/streams.h"
 
 namespace satori {
 namespace video {
 
-streams::op<owned_image_packet, encoded_packet> encode_vp9(uint8_t lag_in_frames);
+// If rate_controller is set, encoder follows its quality level.
+streams::op<owned_image_packet, encoded_packet> encode_vp9(
+    uint8_t lag_in_frames, const std::shared_ptr<rate_controller> &controller = nullptr);
 }
 }  // namespace satori
@@ -3,7 +3,10 @@
 #define BOOST_TEST_ALTERNATIVE_INIT_API
 #include <boost/test/included/unit_test.hpp>
 
+#include <fstream>
+
 #include "avutils.h"
+#include "base64.h"
 #include "logging_impl.h"
 
 namespace satori {
@@ -168,6 +171,42 @@ BOOST_AUTO_TEST_CASE(av_frame_to_image) {
   BOOST_CHECK_EQUAL(0xcd, (uint8_t)frame.plane_data[0][data_size - 1]);
 }
 
+namespace {
+std::string read_base64_line(const std::string &filename) {
+  std::ifstream file(filename);
+  BOOST_REQUIRE(file);
+  std::string line;
+  std::getline(file, line);
+  auto data = base64::decode(line);
+  BOOST_REQUIRE(data.ok());
+  return data.get();
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(probe_image_size) {
+  encoded_frame vp9_frame;
+  vp9_frame.data = read_base64_line("test_data/vp9_320x180.frame");
+  vp9_frame.key_frame = true;
+  auto vp9_size = avutils::probe_image_size(encoded_metadata{"vp9", ""}, vp9_frame);
+  BOOST_TEST(vp9_size.ok());
+  BOOST_CHECK_EQUAL(320, vp9_size.get().width);
+  BOOST_CHECK_EQUAL(180, vp9_size.get().height);
+
+  encoded_frame h264_frame;
+  h264_frame.data = read_base64_line("test_data/h264_320x180.frame");
+  h264_frame.key_frame = true;
+  auto h264_size = avutils::probe_image_size(
+      encoded_metadata{"h264", read_base64_line("test_data/h264_320x180.metadata")},
+      h264_frame);
+  BOOST_TEST(h264_size.ok());
+  BOOST_CHECK_EQUAL(320, h264_size.get().width);
+  BOOST_CHECK_EQUAL(180, h264_size.get().height);
+
+  encoded_frame garbage;
+  garbage.data = "garbage";
+  BOOST_TEST(!avutils::probe_image_size(encoded_metadata{"vp9", ""}, garbage).ok());
+}
+
 }  // namespace video
 }  // namespace satori
 
@@ -0,0 +1,228 @@
+#define BOOST_TEST_MODULE BinaryReplayTest
+#include <boost/filesystem.hpp>
+#include <boost/test/included/unit_test.hpp>
+#include <fstream>
+
+#include "binary_replay.h"
+#include "video_streams.h"
+
+namespace satori {
+namespace video {
+
+namespace {
+
+namespace fs = boost::filesystem;
+
+const auto t0 = std::chrono::system_clock::time_point{std::chrono::seconds{1500000000}};
+
+encoded_frame make_frame(int64_t i, bool key_frame) {
+  encoded_frame f;
+  f.data = std::string(static_cast<size_t>(10 + i), static_cast<char>('a' + i));
+  f.id = {i, i};
+  f.timestamp = t0 + std::chrono::milliseconds(40 * i);
+  f.creation_time = t0 + std::chrono::milliseconds(40 * i + 5);
+  f.key_frame = key_frame;
+  return f;
+}
+
+fs::path write_test_replay() {
+  const fs::path path = fs::temp_directory_path() / fs::unique_path("%%%%-%%%%.vreplay");
+  binary_replay_writer writer{path.string(), encoded_metadata{"h264", "codec data"}};
+  for (int64_t i = 0; i < 5; i++) {
+    writer.write(make_frame(i, i == 0 || i == 3));
+  }
+  writer.close();
+  return path;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(write_and_read) {
+  const fs::path path = write_test_replay();
+  BOOST_TEST(is_binary_replay(path.string()));
+  BOOST_TEST(!is_binary_replay("test_data/test.replay"));
+
+  binary_replay_reader reader{path.string()};
+  BOOST_TEST(!reader.open());
+  BOOST_TEST(reader.metadata().codec_name == "h264");
+  BOOST_TEST(reader.metadata().codec_data == "codec data");
+  BOOST_TEST(reader.frames_count() == 5);
+
+  encoded_frame f;
+  for (int64_t i = 0; i < 5; i++) {
+    const encoded_frame expected = make_frame(i, i == 0 || i == 3);
+    BOOST_TEST(reader.next(f));
+    BOOST_TEST(f.data == expected.data);
+    BOOST_TEST(f.id == expected.id);
+    BOOST_TEST((f.timestamp == expected.timestamp));
+    BOOST_TEST((f.creation_time == expected.creation_time));
+    BOOST_TEST(f.key_frame == expected.key_frame);
+  }
+  BOOST_TEST(!reader.next(f));
+
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(seek) {
+  const fs::path path = write_test_replay();
+  binary_replay_reader reader{path.string()};
+  BOOST_TEST(!reader.open());
+
+  encoded_frame f;
+  // frame 2 is the closest, frame 0 is the preceding key frame
+  BOOST_TEST(reader.seek(std::chrono::milliseconds(100)));
+  BOOST_TEST(reader.next(f));
+  BOOST_TEST(f.id.i1 == 0);
+
+  BOOST_TEST(reader.seek(std::chrono::milliseconds(130)));
+  BOOST_TEST(reader.next(f));
+  BOOST_TEST(f.id.i1 == 3);
+
+  BOOST_TEST(reader.seek_frame(4));
+  BOOST_TEST(reader.next(f));
+  BOOST_TEST(f.id.i1 == 3);
+  BOOST_TEST(reader.next(f));
+  BOOST_TEST(f.id.i1 == 4);
+  BOOST_TEST(!reader.next(f));
+
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(no_index) {
+  const fs::path path = write_test_replay();
+  // index of 5 frames and footer
+  fs::resize_file(path, fs::file_size(path) - 5 * 17 - 24);
+
+  binary_replay_reader reader{path.string()};
+  BOOST_TEST(!reader.open());
+  BOOST_TEST(reader.frames_count() == 0);
+  BOOST_TEST(!reader.seek(std::chrono::milliseconds(100)));
+
+  int frames = 0;
+  encoded_frame f;
+  while (reader.next(f)) {
+    frames++;
+  }
+  BOOST_TEST(frames == 5);
+
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(bad_index) {
+  const fs::path path = write_test_replay();
+  {
+    // offset of the last frame points past the frames
+    std::fstream file{path.string(), std::ios::in | std::ios::out | std::ios::binary};
+    file.seekp(fs::file_size(path) - 24 - 17);
+    const uint64_t offset = fs::file_size(path);
+    file.write(reinterpret_cast<const char *>(&offset), sizeof(offset));
+  }
+
+  binary_replay_reader reader{path.string()};
+  BOOST_TEST(!reader.open());
+  BOOST_TEST(reader.frames_count() == 0);
+  BOOST_TEST(!reader.seek_frame(4));
+
+  int frames = 0;
+  encoded_frame f;
+  while (reader.next(f)) {
+    frames++;
+  }
+  BOOST_TEST(frames == 5);
+
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(bad_additional_data) {
+  const fs::path path = fs::temp_directory_path() / fs::unique_path("%%%%-%%%%.vreplay");
+  {
+    encoded_metadata metadata{"h264", "codec data"};
+    metadata.additional_data = nlohmann::json{{"a", 1}};
+    binary_replay_writer writer{path.string(), metadata};
+  }
+  {
+    // breaks closing brace of the JSON
+    std::fstream file{path.string(), std::ios::in | std::ios::out | std::ios::binary};
+    const std::string content((std::istreambuf_iterator<char>(file)),
+                              std::istreambuf_iterator<char>());
+    file.seekp(content.find('}'));
+    file.put(' ');
+  }
+
+  binary_replay_reader reader{path.string()};
+  BOOST_TEST(static_cast<bool>(reader.open()));
+
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(range) {
+  const fs::path path = write_test_replay();
+  boost::asio::io_service io;
+
+  auto read_range = [&io, &path](const file_range &range) {
+    std::vector<std::pair<int64_t, bool>> frames;
+    auto when_done = binary_replay_source(io, path.string(), true, range)
+                         ->process([&frames](encoded_packet &&packet) {
+                           if (auto *f = boost::get<encoded_frame>(&packet)) {
+                             frames.emplace_back(f->id.i1, f->decode_only);
+                           }
+                         });
+    BOOST_TEST(when_done.ok());
+    return frames;
+  };
+
+  using frames = std::vector<std::pair<int64_t, bool>>;
+  file_range frame_range;
+  frame_range.start_frame = 2;
+  frame_range.end_frame = 4;
+  // reading starts from key frame 0
+  BOOST_TEST(
+      (read_range(frame_range) == frames{{0, true}, {1, true}, {2, false}, {3, false}}));
+
+  file_range time_range;
+  time_range.start_time = std::chrono::milliseconds(120);
+  // reading starts from key frame 3
+  BOOST_TEST((read_range(time_range) == frames{{3, false}, {4, false}}));
+
+  time_range.start_time = std::chrono::milliseconds(0);
+  time_range.end_time = std::chrono::milliseconds(80);
+  BOOST_TEST((read_range(time_range) == frames{{0, false}, {1, false}}));
+
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(convert) {
+  const fs::path path = fs::temp_directory_path() / fs::unique_path("%%%%-%%%%.vreplay");
+  convert_network_replay("test_data/test.replay", path.string());
+
+  boost::asio::io_service io;
+  std::vector<encoded_packet> expected;
+  auto when_done = (network_replay_source(io, "test_data/test.replay", true)
+                    >> decode_network_stream())
+                       ->process([&expected](encoded_packet &&packet) {
+                         expected.push_back(std::move(packet));
+                       });
+  BOOST_TEST(when_done.ok());
+
+  std::vector<encoded_packet> actual;
+  when_done = binary_replay_source(io, path.string(), true)
+                  ->process([&actual](encoded_packet &&packet) {
+                    actual.push_back(std::move(packet));
+                  });
+  BOOST_TEST(when_done.ok());
+
+  BOOST_TEST(expected.size() == actual.size());
+  BOOST_TEST(boost::get<encoded_metadata>(actual[0]).codec_data
+             == boost::get<encoded_metadata>(expected[0]).codec_data);
+  for (size_t i = 1; i < std::min(expected.size(), actual.size()); i++) {
+    BOOST_TEST(boost::get<encoded_frame>(actual[i]).data
+               == boost::get<encoded_frame>(expected[i]).data);
+    BOOST_TEST(boost::get<encoded_frame>(actual[i]).id
+               == boost::get<encoded_frame>(expected[i]).id);
+  }
+
+  fs::remove(path);
+}
+
+}  // namespace video
+}  // namespace satori
@@ -100,3 +100,51 @@ BOOST_AUTO_TEST_CASE(basic) {
     BOOST_TEST("dummy-shutdown-value", m.data["dummy-shutdown-key"]);
   }
 }
+
+BOOST_AUTO_TEST_CASE(parallel_bots) {
+  sv::multiframe_bot_descriptor descriptor;
+  descriptor.pixel_format = sv::image_pixel_format::RGB0;
+  descriptor.ctrl_callback = &::process_command;
+  descriptor.img_callback = &::process_image;
+  descriptor.state = sv::state_scope::FRAME;
+
+  nlohmann::json bot_config = R"({"dummy-key":"dummy-value"})"_json;
+  sv::bot_instance bot1{"dummy-bot-id", sv::execution_mode::BATCH, descriptor};
+  sv::bot_instance bot2{"dummy-bot-id", sv::execution_mode::BATCH, descriptor};
+  bot1.configure(bot_config);
+  bot2.configure(bot_config);
+
+  constexpr int frames_count = 10;
+  std::vector<sv::bot_input> bot_input;
+  for (int i = 0; i < frames_count; i++) {
+    sv::owned_image_frame frame{};
+    frame.id = {i, i};
+    sv::owned_image_packets frames;
+    frames.push(std::move(frame));
+    bot_input.emplace_back(std::move(frames));
+  }
+
+  sv::streams::publisher<sv::bot_output> bot_output_stream =
+      sv::streams::publishers::of(std::move(bot_input))
+      >> sv::run_parallel_bots({&bot1, &bot2});
+
+  std::vector<struct sv::bot_message> analysis;
+  std::vector<struct sv::bot_message> shutdown;
+  bot_output_stream->process([&analysis, &shutdown](sv::bot_output &&o) {
+    auto *m = boost::get<struct sv::bot_message>(&o);
+    if (m == nullptr) {
+      return;
+    }
+    if (m->kind == sv::bot_message_kind::ANALYSIS) {
+      analysis.push_back(*m);
+    } else if (m->data.find("dummy-shutdown-key") != m->data.end()) {
+      shutdown.push_back(*m);
+    }
+  });
+
+  BOOST_CHECK_EQUAL(frames_count, analysis.size());
+  for (int i = 0; i < static_cast<int>(analysis.size()); i++) {
+    BOOST_CHECK_EQUAL(i, analysis[i].id.i1);
+  }
+  BOOST_CHECK_EQUAL(2, shutdown.size());
+}
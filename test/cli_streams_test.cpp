@@ -0,0 +1,63 @@
+#define BOOST_TEST_MODULE CliStreamsTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+#include "cli_streams.h"
+
+using namespace satori::video;
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+struct temp_dir {
+  temp_dir() : path{fs::temp_directory_path() / fs::unique_path()} {
+    fs::create_directories(path);
+  }
+  ~temp_dir() { fs::remove_all(path); }
+
+  void touch(const std::string &name) const {
+    std::ofstream out((path / name).string());
+  }
+
+  const fs::path path;
+};
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(manifest_directory) {
+  temp_dir dir;
+  dir.touch("b.mp4");
+  dir.touch("a.mp4");
+  dir.touch("a.mp4.keyframes");
+  dir.touch(".hidden.mp4");
+  fs::create_directories(dir.path / "nested");
+
+  const std::vector<std::string> files =
+      cli_streams::read_input_manifest(dir.path.string());
+  BOOST_TEST(files.size() == 2);
+  BOOST_TEST(files[0] == (dir.path / "a.mp4").string());
+  BOOST_TEST(files[1] == (dir.path / "b.mp4").string());
+}
+
+BOOST_AUTO_TEST_CASE(manifest_file) {
+  temp_dir dir;
+  const fs::path manifest = dir.path / "manifest.txt";
+  {
+    std::ofstream out(manifest.string());
+    out << "# clips\n"
+        << "first.mp4\n"
+        << "\n"
+        << "/videos/second.mkv  \n"
+        << "sub/third.webm\r\n";
+  }
+
+  const std::vector<std::string> files =
+      cli_streams::read_input_manifest(manifest.string());
+  BOOST_TEST(files.size() == 3);
+  BOOST_TEST(files[0] == (dir.path / "first.mp4").string());
+  BOOST_TEST(files[1] == "/videos/second.mkv");
+  BOOST_TEST(files[2] == (dir.path / "sub/third.webm").string());
+}
@@ -21,6 +21,7 @@ struct test_definition {
   int expected_width;
   int expected_height;
   int expected_frames_count;
+  bool low_latency{false};
 };
 
 sv::streams::publisher<sv::encoded_packet> test_stream(const test_definition &td) {
@@ -65,8 +66,8 @@ void run_decode_image_frames_test(const test_definition &td) {
   }
 
   sv::streams::publisher<sv::owned_image_packet> image_stream =
-      test_stream(td)
-      >> sv::decode_image_frames({-1, -1}, sv::image_pixel_format::RGB0, true);
+      test_stream(td) >> sv::decode_image_frames({-1, -1}, sv::image_pixel_format::RGB0,
+                                                 true, td.low_latency);
 
   int last_frame_width;
   int last_frame_height;
@@ -126,6 +127,20 @@ BOOST_AUTO_TEST_CASE(h264) {
   run_decode_image_frames_test(test);
 }
 
+BOOST_AUTO_TEST_CASE(h264_low_latency) {
+  test_definition test;
+
+  test.metadata_filename = "test_data/h264_320x180.metadata";
+  test.frames_filename = "test_data/h264_320x180.frame";
+  test.codec_name = "h264";
+  test.expected_width = 320;
+  test.expected_height = 180;
+  test.expected_frames_count = 6;
+  test.low_latency = true;
+
+  run_decode_image_frames_test(test);
+}
+
 BOOST_AUTO_TEST_CASE(jpeg) {
   test_definition test;
 
@@ -1,7 +1,10 @@
 #define BOOST_TEST_MODULE FileSourceTest
+#include <algorithm>
 #include <boost/test/included/unit_test.hpp>
 
+#include "avutils.h"
 #include "data.h"
+#include "keyframe_index.h"
 #include "video_streams.h"
 
 namespace satori {
@@ -55,6 +58,68 @@ BOOST_AUTO_TEST_CASE(test_repeat_metadata) {
   BOOST_TEST(metadata_count == 7);
 }
 
+BOOST_AUTO_TEST_CASE(playlist) {
+  boost::asio::io_service io;
+  size_t metadata_count = 0;
+  std::vector<frame_id> ids;
+  std::vector<std::chrono::system_clock::time_point> timestamps;
+
+  auto when_done =
+      playlist_source(io, {"test_data/test.mp4", "test_data/test.mp4"}, false, true)
+          ->process([&](encoded_packet &&pkt) {
+            if (const encoded_frame *f = boost::get<encoded_frame>(&pkt)) {
+              ids.push_back(f->id);
+              timestamps.push_back(f->timestamp);
+            } else {
+              metadata_count++;
+            }
+          });
+  BOOST_TEST(when_done.ok());
+
+  BOOST_TEST(metadata_count == 2);
+  BOOST_TEST(ids.size() == 12);
+  for (size_t i = 0; i < ids.size(); i++) {
+    BOOST_TEST(ids[i] == id(i + 1, i + 1));
+  }
+  const auto first_file_end =
+      std::max_element(timestamps.begin(), timestamps.begin() + 6);
+  BOOST_TEST((*first_file_end < timestamps[6]));
+}
+
+BOOST_AUTO_TEST_CASE(read_options) {
+  auto read_frames = [](const file_read_options &options) {
+    boost::asio::io_service io;
+    std::vector<std::string> frames;
+    auto when_done =
+        file_source(io, "test_data/test.mp4", false, true, file_range{}, options)
+            ->process([&frames](encoded_packet &&pkt) {
+              if (const encoded_frame *f = boost::get<encoded_frame>(&pkt)) {
+                frames.push_back(f->data);
+              }
+            });
+    BOOST_TEST(when_done.ok());
+    return frames;
+  };
+
+  file_read_options synchronous;
+  synchronous.prefetch_packets = 0;
+  const std::vector<std::string> expected = read_frames(synchronous);
+  BOOST_TEST(expected.size() == 6);
+
+  file_read_options prefetch;
+  prefetch.prefetch_packets = 2;
+  BOOST_TEST(read_frames(prefetch) == expected);
+
+  file_read_options small_buffer;
+  small_buffer.prefetch_bytes = 1;
+  small_buffer.io_buffer_size = 4096;
+  BOOST_TEST(read_frames(small_buffer) == expected);
+
+  file_read_options mapped;
+  mapped.mmap = true;
+  BOOST_TEST(read_frames(mapped) == expected);
+}
+
 BOOST_AUTO_TEST_CASE(rotated_video) {
   boost::asio::io_service io;
 
@@ -74,5 +139,125 @@ BOOST_AUTO_TEST_CASE(rotated_video) {
   BOOST_CHECK_EQUAL(6, id_counter);
 }
 
+BOOST_AUTO_TEST_CASE(playlist_resolution_change) {
+  boost::asio::io_service io;
+
+  auto stream =
+      playlist_source(io, {"test_data/test.mp4", "test_data/test_320x240.mp4"}, false,
+                      true)
+      >> decode_image_frames({avutils::original_image_width,
+                              avutils::original_image_height},
+                             image_pixel_format::BGR, false);
+
+  std::vector<std::pair<int, int>> sizes;
+  auto when_done = stream->process([&sizes](owned_image_packet &&pkt) {
+    if (const owned_image_frame *f = boost::get<owned_image_frame>(&pkt)) {
+      sizes.emplace_back(f->width, f->height);
+    }
+  });
+  BOOST_TEST(when_done.ok());
+
+  // frames held by the decoder at the end of the first file aren't lost
+  BOOST_TEST(sizes.size() == 12);
+  for (size_t i = 0; i < sizes.size(); i++) {
+    BOOST_TEST(sizes[i].first == (i < 6 ? 640 : 320));
+    BOOST_TEST(sizes[i].second == (i < 6 ? 480 : 240));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(keyframe_index_of_file) {
+  auto index = load_keyframe_index("test_data/test.mp4");
+  BOOST_TEST(index.ok());
+  BOOST_TEST(index.get().frames_count == 6);
+  BOOST_TEST(!index.get().key_frames.empty());
+  BOOST_TEST(index.get().key_frames[0].frame_number == 0);
+  BOOST_TEST(index.get().key_frame_for_frame(5).frame_number <= 5);
+
+  // second load comes from the cache and should be identical
+  auto cached = load_keyframe_index("test_data/test.mp4");
+  BOOST_TEST(cached.ok());
+  BOOST_TEST(cached.get().frames_count == 6);
+  BOOST_TEST(cached.get().key_frames.size() == index.get().key_frames.size());
+}
+
+BOOST_AUTO_TEST_CASE(keyframe_index_split) {
+  keyframe_index index;
+  index.stream_index = 0;
+  index.time_base_num = 1;
+  index.time_base_den = 1000;
+  index.start_timestamp = 0;
+  index.frames_count = 100;
+  index.key_frames = {{0, 0}, {30, 1000}, {60, 2000}, {90, 3000}};
+
+  const std::vector<file_range> halves = index.split(2);
+  BOOST_TEST(halves.size() == 2);
+  BOOST_TEST(*halves[0].start_frame == 0);
+  BOOST_TEST(*halves[0].end_frame == 30);
+  BOOST_TEST(*halves[1].start_frame == 30);
+  BOOST_TEST(!halves[1].end_frame);
+
+  // segments can't be shorter than a group of pictures
+  const std::vector<file_range> many = index.split(10);
+  BOOST_TEST(many.size() == 4);
+  BOOST_TEST(*many[3].start_frame == 90);
+  BOOST_TEST(!many[3].end_frame);
+
+  BOOST_TEST(index.split(1).size() == 1);
+  BOOST_TEST(index.split(1)[0].end_frame == boost::none);
+}
+
+BOOST_AUTO_TEST_CASE(frame_range) {
+  boost::asio::io_service io;
+
+  file_range range;
+  range.start_frame = 2;
+  range.end_frame = 5;
+
+  std::vector<frame_id> delivered_ids;
+  std::vector<frame_id> decoded_ids;
+  auto when_done =
+      (file_source(io, "test_data/test.mp4", false, true, range)
+       >> streams::map([&delivered_ids](encoded_packet &&pkt) {
+           if (const encoded_frame *f = boost::get<encoded_frame>(&pkt)) {
+             if (!f->decode_only) {
+               delivered_ids.push_back(f->id);
+             }
+           }
+           return std::move(pkt);
+         })
+       >> decode_image_frames({320, 240}, image_pixel_format::BGR, true))
+          ->process([&decoded_ids](owned_image_packet &&pkt) {
+            if (const owned_image_frame *f = boost::get<owned_image_frame>(&pkt)) {
+              decoded_ids.push_back(f->id);
+            }
+          });
+  BOOST_TEST(when_done.ok());
+
+  BOOST_TEST(delivered_ids.size() == 3);
+  BOOST_TEST(decoded_ids.size() == 3);
+  BOOST_TEST(decoded_ids[0] == id(3, 3));
+  BOOST_TEST(decoded_ids[1] == id(4, 4));
+  BOOST_TEST(decoded_ids[2] == id(5, 5));
+}
+
+BOOST_AUTO_TEST_CASE(time_range) {
+  boost::asio::io_service io;
+
+  file_range range;
+  range.start_time = std::chrono::milliseconds{0};
+  range.end_time = std::chrono::milliseconds{3600 * 1000};
+
+  size_t frames_count{0};
+  auto when_done = file_source(io, "test_data/test.mp4", false, true, range)
+                       ->process([&frames_count](encoded_packet &&pkt) {
+                         if (const encoded_frame *f = boost::get<encoded_frame>(&pkt)) {
+                           BOOST_TEST(!f->decode_only);
+                           frames_count++;
+                         }
+                       });
+  BOOST_TEST(when_done.ok());
+  BOOST_TEST(frames_count == 6);
+}
+
 }  // namespace video
 }  // namespace satori
@@ -0,0 +1,136 @@
+#define BOOST_TEST_MODULE FileWriterPoolTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <future>
+
+#include "file_writer_pool.h"
+
+using namespace satori::video;
+
+BOOST_AUTO_TEST_CASE(tasks_of_queue_are_ordered) {
+  file_writer_pool pool{4, 1000};
+
+  std::vector<std::shared_ptr<file_writer_pool::queue>> queues;
+  std::vector<std::vector<int>> results(8);
+  std::vector<std::atomic<int>> running(8);
+  std::atomic<bool> overlapped{false};
+  for (size_t q = 0; q < results.size(); q++) {
+    queues.push_back(pool.make_queue(3));
+  }
+
+  for (int i = 0; i < 100; i++) {
+    for (size_t q = 0; q < queues.size(); q++) {
+      pool.push(queues[q],
+                [&results, &running, &overlapped, q, i]() {
+                  if (running[q]++ > 0) {
+                    overlapped = true;
+                  }
+                  results[q].push_back(i);
+                  running[q]--;
+                },
+                10);
+    }
+  }
+
+  for (size_t q = 0; q < queues.size(); q++) {
+    pool.drain(queues[q]);
+    BOOST_TEST(results[q].size() == 100);
+    for (int i = 0; i < static_cast<int>(results[q].size()); i++) {
+      BOOST_TEST(results[q][i] == i);
+    }
+  }
+  BOOST_TEST(!overlapped);
+}
+
+BOOST_AUTO_TEST_CASE(push_blocks_when_out_of_budget) {
+  file_writer_pool pool{1, 10};
+  auto q1 = pool.make_queue(10);
+  auto q2 = pool.make_queue(10);
+
+  std::promise<void> unblock;
+  std::shared_future<void> unblocked = unblock.get_future().share();
+  pool.push(q1, [unblocked]() { unblocked.wait(); }, 5);
+  pool.push(q1, []() {}, 5);
+
+  std::atomic<bool> pushed{false};
+  auto third = std::async(std::launch::async, [&pool, &q2, &pushed]() {
+    pool.push(q2, []() {}, 5);
+    pushed = true;
+  });
+
+  BOOST_TEST((third.wait_for(std::chrono::milliseconds(100))
+              == std::future_status::timeout));
+  BOOST_TEST(!pushed);
+
+  unblock.set_value();
+  third.wait();
+  BOOST_TEST(pushed);
+
+  pool.drain(q1);
+  pool.drain(q2);
+}
+
+BOOST_AUTO_TEST_CASE(try_push_waits_for_budget) {
+  file_writer_pool pool{1, 10};
+  auto q1 = pool.make_queue(10);
+  auto q2 = pool.make_queue(10);
+
+  std::promise<void> unblock;
+  std::shared_future<void> unblocked = unblock.get_future().share();
+  std::vector<int> results;
+  BOOST_TEST(pool.try_push(q1, [unblocked]() { unblocked.wait(); }, 5, nullptr));
+  BOOST_TEST(pool.try_push(q1, [&results]() { results.push_back(1); }, 5, nullptr));
+
+  std::promise<void> accept;
+  std::future<void> accepted = accept.get_future();
+  BOOST_TEST(!pool.try_push(q2, [&results]() { results.push_back(2); }, 5,
+                            [&accept]() { accept.set_value(); }));
+  BOOST_TEST((accepted.wait_for(std::chrono::milliseconds(100))
+              == std::future_status::timeout));
+
+  unblock.set_value();
+  accepted.wait();
+  pool.drain(q2);
+  pool.drain(q1);
+  BOOST_TEST(results == std::vector<int>({1, 2}));
+}
+
+BOOST_AUTO_TEST_CASE(batches) {
+  file_writer_pool pool{1, 1000};
+  std::atomic<int> batches{0};
+  std::atomic<int> tasks{0};
+  auto q = pool.make_queue(100, [&batches]() { batches++; });
+
+  std::promise<void> unblock;
+  std::shared_future<void> unblocked = unblock.get_future().share();
+  pool.push(q, [unblocked, &tasks]() {
+    unblocked.wait();
+    tasks++;
+  });
+  // lets the first batch start
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  for (int i = 0; i < 10; i++) {
+    pool.push(q, [&tasks]() { tasks++; });
+  }
+  unblock.set_value();
+  pool.drain(q);
+
+  BOOST_TEST(tasks == 11);
+  BOOST_TEST(batches == 2);
+}
+
+BOOST_AUTO_TEST_CASE(capacity_estimate) {
+  file_writer_pool pool{2, 1000};
+  BOOST_TEST(!pool.estimate_capacity());
+
+  auto q = pool.make_queue(10);
+  pool.push(q, []() { std::this_thread::sleep_for(std::chrono::milliseconds(20)); });
+  pool.drain(q);
+  std::this_thread::sleep_for(std::chrono::milliseconds(180));
+
+  // one queue kept one of two threads busy ~10% of time
+  auto capacity = pool.estimate_capacity();
+  BOOST_TEST(capacity.is_initialized());
+  BOOST_TEST(*capacity > 2);
+  BOOST_TEST(*capacity < 100);
+}
@@ -0,0 +1,90 @@
+#define BOOST_TEST_MODULE FrameSkipControllerTest
+#include <boost/test/included/unit_test.hpp>
+
+#include "frame_skip_controller.h"
+
+using namespace satori::video;
+
+namespace {
+
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+frame_skip_controller::settings test_settings() {
+  frame_skip_controller::settings s;
+  s.target_latency = milliseconds{200};
+  s.smoothing = 1.0;
+  s.min_ratio = 0.1;
+  return s;
+}
+
+// Feeds frames at 25 fps, returns number of delivered frames.
+int feed(frame_skip_controller &c, std::chrono::steady_clock::time_point &t, int frames) {
+  int delivered = 0;
+  for (int i = 0; i < frames; i++) {
+    t += milliseconds{40};
+    if (c.on_input_frame(t)) {
+      delivered++;
+    }
+  }
+  return delivered;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(delivers_everything_when_bot_keeps_up) {
+  frame_skip_controller c{test_settings()};
+  auto t = std::chrono::steady_clock::now();
+
+  BOOST_TEST(feed(c, t, 10) == 10);
+  c.on_processed(1, milliseconds{10}, milliseconds{20});
+  BOOST_TEST(c.ratio() == 1.0);
+  BOOST_TEST(feed(c, t, 10) == 10);
+  BOOST_TEST(std::abs(c.effective_fps() - 25) < 0.01);
+}
+
+BOOST_AUTO_TEST_CASE(subsamples_uniformly_when_bot_is_slow) {
+  frame_skip_controller c{test_settings()};
+  auto t = std::chrono::steady_clock::now();
+
+  feed(c, t, 2);
+  // bot takes twice the frame interval
+  c.on_processed(2, milliseconds{160}, milliseconds{100});
+  BOOST_TEST(std::abs(c.ratio() - 0.5) < 0.01);
+
+  int delivered_in_a_row = 0;
+  for (int i = 0; i < 10; i++) {
+    t += milliseconds{40};
+    if (c.on_input_frame(t)) {
+      delivered_in_a_row++;
+      BOOST_TEST(delivered_in_a_row == 1);
+    } else {
+      delivered_in_a_row = 0;
+    }
+  }
+  BOOST_TEST(feed(c, t, 10) == 5);
+  BOOST_TEST(std::abs(c.effective_fps() - 12.5) < 0.01);
+}
+
+BOOST_AUTO_TEST_CASE(sheds_queued_frames_above_target_latency) {
+  frame_skip_controller c{test_settings()};
+  auto t = std::chrono::steady_clock::now();
+
+  feed(c, t, 2);
+  c.on_processed(1, milliseconds{40}, milliseconds{400});
+  BOOST_TEST(std::abs(c.ratio() - 0.5) < 0.01);
+
+  // latency is back to normal
+  c.on_processed(1, milliseconds{40}, milliseconds{50});
+  BOOST_TEST(c.ratio() == 1.0);
+}
+
+BOOST_AUTO_TEST_CASE(keeps_min_ratio) {
+  frame_skip_controller c{test_settings()};
+  auto t = std::chrono::steady_clock::now();
+
+  feed(c, t, 2);
+  c.on_processed(1, milliseconds{4000}, milliseconds{8000});
+  BOOST_TEST(std::abs(c.ratio() - 0.1) < 0.01);
+  BOOST_TEST(feed(c, t, 100) == 10);
+}
@@ -0,0 +1,68 @@
+#define BOOST_TEST_MODULE FrameTraceTest
+#include <boost/test/included/unit_test.hpp>
+
+#include "frame_trace.h"
+
+namespace sv = satori::video;
+
+namespace {
+
+using std::chrono::milliseconds;
+using time_point = std::chrono::steady_clock::time_point;
+
+const time_point start = time_point{} + std::chrono::hours(1);
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(stages) {
+  sv::frame_trace trace;
+  trace.arrival = start;
+  trace.decode_start = start + milliseconds(1);
+  trace.decode_end = start + milliseconds(5);
+  trace.callback_start = start + milliseconds(25);
+  trace.callback_end = start + milliseconds(40);
+
+  const nlohmann::json stages = sv::frame_trace_to_json(trace, start + milliseconds(42));
+
+  BOOST_TEST(stages["receive"].get<double>() == 1);
+  BOOST_TEST(stages["decode"].get<double>() == 4);
+  BOOST_TEST(stages["queue"].get<double>() == 20);
+  BOOST_TEST(stages["callback"].get<double>() == 15);
+  BOOST_TEST(stages["publish"].get<double>() == 2);
+  BOOST_TEST(stages["total"].get<double>() == 42);
+}
+
+BOOST_AUTO_TEST_CASE(missing_stages) {
+  sv::frame_trace trace;
+  trace.callback_start = start;
+  trace.callback_end = start + milliseconds(10);
+
+  const nlohmann::json stages = sv::frame_trace_to_json(trace, start + milliseconds(12));
+
+  BOOST_TEST(stages.size() == 2);
+  BOOST_TEST(stages["callback"].get<double>() == 10);
+  BOOST_TEST(stages["publish"].get<double>() == 2);
+}
+
+BOOST_AUTO_TEST_CASE(out_of_order_stages) {
+  sv::frame_trace trace;
+  // source clock is ahead
+  trace.arrival = start + milliseconds(5);
+  trace.decode_start = start;
+  trace.decode_end = start + milliseconds(3);
+
+  const nlohmann::json stages = sv::frame_trace_to_json(trace, start + milliseconds(4));
+
+  BOOST_TEST(stages.size() == 1);
+  BOOST_TEST(stages["decode"].get<double>() == 3);
+}
+
+BOOST_AUTO_TEST_CASE(steady_time) {
+  BOOST_TEST((sv::steady_time(std::chrono::system_clock::time_point{}) == time_point{}));
+
+  const auto t =
+      sv::steady_time(std::chrono::system_clock::now() - std::chrono::seconds(2));
+  const auto age = std::chrono::steady_clock::now() - t;
+  BOOST_TEST((age >= std::chrono::seconds(2)));
+  BOOST_TEST((age < std::chrono::seconds(3)));
+}
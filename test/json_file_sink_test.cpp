@@ -0,0 +1,111 @@
+#define BOOST_TEST_MODULE JsonFileSinkTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <fstream>
+#include <sstream>
+
+#include "json_file_sink.h"
+
+namespace sv = satori::video;
+namespace fs = boost::filesystem;
+
+namespace {
+
+std::string read_file(const fs::path &path, bool gzip = false) {
+  std::ifstream file{path.string(), std::ios::binary};
+  boost::iostreams::filtering_istream in;
+  if (gzip) {
+    in.push(boost::iostreams::gzip_decompressor{});
+  }
+  in.push(file);
+  std::ostringstream out;
+  boost::iostreams::copy(in, out);
+  return out.str();
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(basic) {
+  const fs::path dir = fs::temp_directory_path() / fs::unique_path();
+  fs::create_directories(dir);
+  auto &sink = sv::streams::json_file_sink(dir / "out.json");
+  sink.on_next(nlohmann::json("one"));
+  sink.on_next(nlohmann::json{{"two", 2}});
+  sink.on_next(nlohmann::json("three"));
+  sink.on_complete();
+
+  BOOST_CHECK_EQUAL("\"one\"\n{\"two\":2}\n\"three\"\n", read_file(dir / "out.json"));
+
+  fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(empty) {
+  const fs::path dir = fs::temp_directory_path() / fs::unique_path();
+  fs::create_directories(dir);
+  sv::streams::json_file_sink(dir / "out.json").on_complete();
+
+  BOOST_TEST(fs::exists(dir / "out.json"));
+  BOOST_CHECK_EQUAL("", read_file(dir / "out.json"));
+
+  fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(gzip) {
+  const fs::path dir = fs::temp_directory_path() / fs::unique_path();
+  fs::create_directories(dir);
+  sv::streams::json_file_options options;
+  options.compression = sv::streams::json_file_compression::GZIP;
+  auto &sink = sv::streams::json_file_sink(dir / "out.json.gz", options);
+  std::string expected;
+  for (int i = 0; i < 1000; i++) {
+    sink.on_next(nlohmann::json(i));
+    expected += std::to_string(i) + "\n";
+  }
+  sink.on_complete();
+
+  BOOST_TEST(fs::file_size(dir / "out.json.gz") < expected.size());
+  BOOST_CHECK_EQUAL(expected, read_file(dir / "out.json.gz", true));
+
+  fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(rotation) {
+  const fs::path dir = fs::temp_directory_path() / fs::unique_path();
+  fs::create_directories(dir);
+  sv::streams::json_file_options options;
+  options.max_file_bytes = 10;
+  // every message is a separate batch
+  options.max_queued_messages = 1;
+  auto writer_pool = std::make_shared<sv::file_writer_pool>(1, 1000);
+  auto &sink = sv::streams::json_file_sink(dir / "out.json", options, writer_pool);
+  std::string expected;
+  for (int i = 0; i < 100; i++) {
+    sink.on_next(nlohmann::json(i));
+    expected += std::to_string(i) + "\n";
+  }
+  sink.on_complete();
+
+  std::string actual;
+  size_t files = 0;
+  for (; fs::exists(dir / ("out." + std::to_string(files + 1) + ".json")); files++) {
+    actual += read_file(dir / ("out." + std::to_string(files + 1) + ".json"));
+  }
+  actual = read_file(dir / "out.json") + actual;
+
+  BOOST_TEST(files >= 10);
+  BOOST_CHECK_EQUAL(expected, actual);
+
+  fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(compression_names) {
+  BOOST_TEST((sv::streams::parse_json_file_compression("gzip")
+              == sv::streams::json_file_compression::GZIP));
+  BOOST_TEST((sv::streams::parse_json_file_compression("none")
+              == sv::streams::json_file_compression::NONE));
+  BOOST_TEST(!sv::streams::parse_json_file_compression("zip"));
+}
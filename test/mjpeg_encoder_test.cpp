@@ -0,0 +1,93 @@
+#define BOOST_TEST_MODULE MjpegEncoderTest
+#include <boost/test/included/unit_test.hpp>
+
+#include "logging.h"
+#include "video_streams.h"
+
+using namespace satori::video;
+
+namespace {
+
+streams::publisher<owned_image_packet> test_frames(int number_of_frames,
+                                                   uint16_t width = 64,
+                                                   uint16_t height = 48) {
+  auto make_frame = [width, height](int i) {
+    owned_image_frame f;
+    f.id = {i, i};
+    f.pixel_format = image_pixel_format::BGR;
+    f.width = width;
+    f.height = height;
+    f.timestamp = std::chrono::system_clock::time_point{std::chrono::milliseconds(i)};
+    f.plane_data[0] = std::string(width * height * 3, static_cast<char>(i % 256));
+    f.plane_strides[0] = width * 3;
+    for (int p = 1; p < max_image_planes; p++) {
+      f.plane_strides[p] = 0;
+    }
+    return owned_image_packet{f};
+  };
+  return streams::publishers::range(0, number_of_frames)
+         >> streams::map(std::move(make_frame));
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(mjpeg_encoder_preserves_order) {
+  const int number_of_frames = 200;
+
+  for (size_t threads : {1, 2, 4, 8}) {
+    int metadata_count{0};
+    std::vector<frame_id> ids;
+    auto when_done = (test_frames(number_of_frames) >> encode_as_mjpeg(threads))
+                         ->process([&metadata_count, &ids](encoded_packet &&packet) {
+                           if (const encoded_frame *f =
+                                   boost::get<encoded_frame>(&packet)) {
+                             BOOST_TEST(f->key_frame);
+                             BOOST_TEST(!f->data.empty());
+                             ids.push_back(f->id);
+                           } else {
+                             metadata_count++;
+                           }
+                         });
+    BOOST_TEST(when_done.ok());
+
+    BOOST_TEST(metadata_count == 1);
+    BOOST_TEST(ids.size() == number_of_frames);
+    for (size_t i = 0; i < ids.size(); i++) {
+      BOOST_TEST(ids[i].i1 == static_cast<int64_t>(i));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(mjpeg_encoder_roundtrip) {
+  const int number_of_frames = 20;
+
+  int frames_count{0};
+  auto when_done = (test_frames(number_of_frames) >> encode_as_mjpeg(4)
+                    >> decode_image_frames({-1, -1}, image_pixel_format::BGR, true))
+                       ->process([&frames_count](owned_image_packet &&packet) {
+                         if (const owned_image_frame *f =
+                                 boost::get<owned_image_frame>(&packet)) {
+                           BOOST_TEST(f->width == 64);
+                           BOOST_TEST(f->height == 48);
+                           frames_count++;
+                         }
+                       });
+  BOOST_TEST(when_done.ok());
+  BOOST_TEST(frames_count == number_of_frames);
+}
+
+BOOST_AUTO_TEST_CASE(mjpeg_encoder_slower_than_input) {
+  // big frames take longer to encode than to submit, so the pool is always full
+  const int number_of_frames = 30;
+
+  int frames_count{0};
+  auto when_done =
+      (test_frames(number_of_frames, 1280, 720) >> encode_as_mjpeg(1, 1))
+          ->process([&frames_count](encoded_packet &&packet) {
+            if (boost::get<encoded_frame>(&packet) != nullptr) {
+              frames_count++;
+            }
+          });
+  BOOST_TEST(when_done.ok());
+  BOOST_TEST(frames_count == number_of_frames);
+}
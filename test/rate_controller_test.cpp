@@ -0,0 +1,68 @@
+#define BOOST_TEST_MODULE RateControllerTest
+#include <boost/test/included/unit_test.hpp>
+
+#include "rate_controller.h"
+
+using namespace satori::video;
+
+namespace {
+
+using std::chrono::milliseconds;
+
+rate_controller::settings test_settings() {
+  rate_controller::settings s;
+  s.max_level = 2;
+  s.high_in_flight = 10;
+  s.low_in_flight = 2;
+  s.high_delay = milliseconds{100};
+  s.low_delay = milliseconds{10};
+  s.degrade_interval = milliseconds{1000};
+  s.recovery_interval = milliseconds{5000};
+  return s;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(degrades_under_pressure) {
+  rate_controller c{test_settings()};
+  const auto t0 = std::chrono::steady_clock::now();
+
+  c.on_backpressure(5, milliseconds{20}, t0);
+  BOOST_TEST(c.level() == 0);
+
+  c.on_backpressure(10, milliseconds{0}, t0);
+  BOOST_TEST(c.level() == 1);
+
+  // too early for next reduction
+  c.on_backpressure(0, milliseconds{200}, t0 + milliseconds{500});
+  BOOST_TEST(c.level() == 1);
+
+  c.on_backpressure(0, milliseconds{200}, t0 + milliseconds{1000});
+  BOOST_TEST(c.level() == 2);
+
+  // max level is reached
+  c.on_backpressure(100, milliseconds{200}, t0 + milliseconds{5000});
+  BOOST_TEST(c.level() == 2);
+}
+
+BOOST_AUTO_TEST_CASE(recovers_when_calm) {
+  rate_controller c{test_settings()};
+  const auto t0 = std::chrono::steady_clock::now();
+
+  c.on_backpressure(10, milliseconds{0}, t0);
+  BOOST_TEST(c.level() == 1);
+
+  c.on_backpressure(1, milliseconds{1}, t0 + milliseconds{1000});
+  BOOST_TEST(c.level() == 1);
+
+  // calm period is interrupted
+  c.on_backpressure(5, milliseconds{1}, t0 + milliseconds{3000});
+  c.on_backpressure(1, milliseconds{1}, t0 + milliseconds{5500});
+  BOOST_TEST(c.level() == 1);
+
+  c.on_backpressure(1, milliseconds{1}, t0 + milliseconds{10000});
+  BOOST_TEST(c.level() == 1);
+
+  c.on_backpressure(1, milliseconds{1}, t0 + milliseconds{10500});
+  BOOST_TEST(c.level() == 0);
+}
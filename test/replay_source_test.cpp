@@ -0,0 +1,52 @@
+#define BOOST_TEST_MODULE ReplaySourceTest
+#include <boost/filesystem.hpp>
+#include <boost/test/included/unit_test.hpp>
+#include <fstream>
+
+#include "video_streams.h"
+
+namespace satori {
+namespace video {
+
+namespace {
+
+namespace fs = boost::filesystem;
+
+std::vector<nlohmann::json> read_all(const std::string &filename, size_t block_size) {
+  std::vector<nlohmann::json> result;
+  auto when_done = read_json_lines(filename, block_size)->process(
+      [&result](nlohmann::json &&item) { result.push_back(std::move(item)); });
+  BOOST_TEST(when_done.ok());
+  return result;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(read_json_lines_keeps_order) {
+  const fs::path path = fs::temp_directory_path() / fs::unique_path("%%%%-%%%%.jsonl");
+  {
+    std::ofstream output(path.string());
+    for (int i = 0; i < 1000; i++) {
+      output << nlohmann::json{{"i", i}, {"pad", std::string(i % 37, 'x')}} << "\n";
+    }
+  }
+
+  for (size_t block_size : {1, 64, 4096, 1024 * 1024}) {
+    const auto items = read_all(path.string(), block_size);
+    BOOST_TEST(items.size() == 1000);
+    for (size_t i = 0; i < items.size(); i++) {
+      BOOST_TEST(items[i]["i"] == i);
+    }
+  }
+  fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(read_json_lines_of_replay) {
+  const auto expected = read_all("test_data/test.replay", 1024 * 1024);
+  BOOST_TEST(expected.size() == 24);
+  BOOST_TEST(read_all("test_data/test.replay", 100) == expected,
+             boost::test_tools::per_element());
+}
+
+}  // namespace video
+}  // namespace satori
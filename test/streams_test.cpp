@@ -63,8 +63,24 @@ std::vector<std::string> events(streams::publisher<T> &&p,
 std::vector<std::string> strings(std::initializer_list<std::string> strs) {
   return std::vector<std::string>(strs);
 }
+
+struct lane_item {
+  int value;
+  bool priority;
+};
 }  // namespace
 
+namespace satori {
+namespace video {
+namespace streams {
+template <>
+struct priority_traits<lane_item> {
+  static bool is_priority(const lane_item &item) { return item.priority; }
+};
+}  // namespace streams
+}  // namespace video
+}  // namespace satori
+
 BOOST_TEST_SPECIALIZED_COLLECTION_COMPARE(std::vector<std::string>)
 
 BOOST_AUTO_TEST_CASE(empty) {
@@ -225,6 +241,103 @@ BOOST_AUTO_TEST_CASE(threaded_worker_cancel) {
   BOOST_TEST(events(std::move(p)) == strings({"1", "2", "3", "."}));
 }
 
+BOOST_AUTO_TEST_CASE(threaded_worker_batching) {
+  LOG_SCOPE_FUNCTION(0);
+  streams::batching_options batching;
+  batching.target_size = 3;
+  batching.max_wait = 1s;
+  size_t batches = 0;
+  batching.on_batch = [&batches](size_t, size_t, std::chrono::steady_clock::duration) {
+    batches++;
+  };
+  auto p = streams::publishers::range(1, 8)
+           >> streams::threaded_worker("test", {}, batching)
+           >> streams::map(
+               [](std::queue<int> &&q) { return static_cast<int>(q.size()); });
+  BOOST_TEST(events(std::move(p)) == strings({"3", "3", "1", "."}));
+  BOOST_TEST(batches == 3);
+}
+
+BOOST_AUTO_TEST_CASE(threaded_worker_priority) {
+  LOG_SCOPE_FUNCTION(0);
+  streams::batching_options batching;
+  batching.target_size = 10;
+  batching.max_wait = 1s;
+  auto p = streams::publishers::range(1, 7)
+           >> streams::map([](int i) { return lane_item{i, i == 6}; })
+           >> streams::threaded_worker("test", {}, batching)
+           >> streams::map([](std::queue<lane_item> &&q) {
+               // priority batch is reported as negative value
+               return q.front().priority ? -q.front().value : static_cast<int>(q.size());
+             });
+  BOOST_TEST(events(std::move(p)) == strings({"-6", "5", "."}));
+}
+
+BOOST_AUTO_TEST_CASE(threaded_worker_batching_request_one) {
+  LOG_SCOPE_FUNCTION(0);
+  struct async_source {
+    void start(streams::observer<int> *s) {
+      std::thread{[s]() {
+        for (int i = 1; i <= 9; i++) {
+          int value = i;
+          s->on_next(std::move(value));
+          std::this_thread::sleep_for(5ms);
+        }
+        s->on_complete();
+      }}
+          .detach();
+    }
+  };
+
+  // elements arrive while a batch is processed, then the next one is requested
+  struct slow_sink : streams::subscriber<std::queue<int>> {
+    void on_next(std::queue<int> &&q) override {
+      sizes.push_back(q.size());
+      std::this_thread::sleep_for(7ms);
+      src->request(1);
+    }
+
+    void on_error(std::error_condition /*ec*/) override { done = true; }
+
+    void on_complete() override { done = true; }
+
+    void on_subscribe(streams::subscription &s) override {
+      src = &s;
+      src->request(1);
+    }
+
+    streams::subscription *src{nullptr};
+    std::vector<size_t> sizes;
+    std::atomic<bool> done{false};
+  };
+
+  streams::batching_options batching;
+  batching.target_size = 3;
+  batching.max_wait = 1s;
+  auto p = streams::generators<int>::async<async_source>(
+               [](streams::observer<int> &o) {
+                 auto src = new async_source();
+                 src->start(&o);
+                 return src;
+               },
+               [](async_source *src) { delete src; })
+           >> streams::flatten() >> streams::threaded_worker("test", {}, batching);
+  slow_sink sink;
+  p->subscribe(sink);
+  while (!sink.done) {
+    std::this_thread::sleep_for(1ms);
+  }
+
+  size_t total = 0;
+  for (size_t i = 0; i < sink.sizes.size(); i++) {
+    total += sink.sizes[i];
+    if (i + 1 < sink.sizes.size()) {
+      BOOST_TEST(sink.sizes[i] == 3);
+    }
+  }
+  BOOST_TEST(total == 9);
+}
+
 BOOST_AUTO_TEST_CASE(async_cancel) {
   LOG_SCOPE_FUNCTION(0);
   struct async_source {
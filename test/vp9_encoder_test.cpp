@@ -52,3 +52,39 @@ BOOST_AUTO_TEST_CASE(vp9_encoder) {
             << ", key_frames_count = " << key_frames_count;
   BOOST_TEST(min_key_frames_count <= key_frames_count);
 }
+
+BOOST_AUTO_TEST_CASE(vp9_encoder_resolution_change) {
+  const int number_of_frames = 40;
+  auto frames =
+      streams::publishers::range(0, number_of_frames) >> streams::map([](int i) {
+        const uint16_t size = i < number_of_frames / 2 ? 16 : 32;
+        owned_image_frame f;
+        f.id = {i, i};
+        f.pixel_format = image_pixel_format::BGR;
+        f.width = size;
+        f.height = size;
+        f.plane_data[0] = std::string(size * size * 3, static_cast<char>(i));
+        f.plane_strides[0] = size * 3;
+        for (int p = 1; p < max_image_planes; p++) {
+          f.plane_strides[p] = 0;
+        }
+        return owned_image_packet{f};
+      });
+
+  int metadata_count{0};
+  int frames_count{0};
+  auto when_done =
+      (std::move(frames) >> encode_vp9(1))
+          ->process([&metadata_count, &frames_count](encoded_packet &&packet) {
+            if (boost::get<encoded_frame>(&packet) != nullptr) {
+              frames_count++;
+            } else {
+              metadata_count++;
+            }
+          });
+  BOOST_CHECK(when_done.ok());
+
+  // encoder is reopened for the new size
+  BOOST_CHECK_EQUAL(2, metadata_count);
+  BOOST_CHECK_EQUAL(number_of_frames, frames_count);
+}